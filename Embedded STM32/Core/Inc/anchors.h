@@ -0,0 +1,82 @@
+/*
+**************************************************************************************************************
+* @file     anchors.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Precomputed grid mapping a position to the anchors a tag should position with
+**************************************************************************************************************
+*/
+
+#ifndef INC_ANCHORS_H_
+#define INC_ANCHORS_H_
+
+#include "main.h"
+#include "registers.h"
+
+/* Largest anchor table, one bit per anchor in a zone mask */
+#define ANCHOR_TABLE_MAX 32
+
+/* Anchors a tag positions with in each zone */
+#define ANCHORS_PER_ZONE 6
+
+/* Smallest grid cell in mm, doubled until the bay fits in ANCHOR_GRID_CELLS */
+#define ANCHOR_CELL_SIZE 1000
+#define ANCHOR_GRID_CELLS 512
+
+/* Most distinct anchor subsets */
+#define ANCHOR_MAX_ZONES 32
+
+/* No zone selected, the tag positions with every anchor in its device list */
+#define ANCHOR_ZONE_NONE 0xFF
+
+/* Grid over the bay, each cell holds the zone of the anchors nearest its centre */
+typedef struct _anchorGrid {
+	const deviceCoords_t *anchors;			//anchor table
+	uint8_t anchorCount;
+	int32_t originX;						//corner of the first cell in mm
+	int32_t originY;
+	uint32_t cellSize;						//side of a cell in mm
+	uint16_t columns;						//cells along x
+	uint16_t rows;							//cells along y
+	uint8_t cells[ANCHOR_GRID_CELLS];		//zone of each cell, row by row
+	uint32_t zones[ANCHOR_MAX_ZONES];		//bit per entry of the anchor table for each zone
+	uint8_t zoneCount;
+} anchorGrid_t;
+
+/** Build the grid from an anchor table. The grid covers the anchors, positions beyond them map to
+ *  the nearest edge cell
+ *  @param grid pointer to grid
+ *  @param anchors the anchor table, must stay valid while the grid is used
+ *  @param anchorCount number of anchors in the table
+ *  @return ANCHOR_TABLE_ERROR if the table is empty, too long or has too many distinct subsets,
+ *  otherwise GOOD_INIT
+ */
+int anchor_grid_build(anchorGrid_t *grid, const deviceCoords_t *anchors, uint8_t anchorCount);
+
+/** Get the zone of a position
+ *  @param grid pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return the zone, ANCHOR_ZONE_NONE if the grid has not been built
+ */
+uint8_t anchor_grid_zone(anchorGrid_t *grid, int32_t posX, int32_t posY);
+
+/** Get the zone of a position, staying in the current zone while it still holds a point within
+ *  the hysteresis distance along x or y, so a crane parked on a zone boundary does not switch back and forth
+ *  @param grid pointer to grid
+ *  @param zone the current zone
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @param hysteresis distance past a boundary before leaving a zone, in mm
+ *  @return the zone
+ */
+uint8_t anchor_grid_select(anchorGrid_t *grid, uint8_t zone, int32_t posX, int32_t posY, uint32_t hysteresis);
+
+/** Get the anchors of a zone
+ *  @param grid pointer to grid
+ *  @param zone the zone
+ *  @return bit per entry of the anchor table, 0 for ANCHOR_ZONE_NONE
+ */
+uint32_t anchor_grid_mask(anchorGrid_t *grid, uint8_t zone);
+
+#endif /* INC_ANCHORS_H_ */
@@ -0,0 +1,37 @@
+/*
+**************************************************************************************************************
+* @file     crc.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Checksums of stored configuration
+**************************************************************************************************************
+*/
+
+#ifndef INC_CRC_H_
+#define INC_CRC_H_
+
+#include "main.h"
+
+/* Initial value of a CRC-16 */
+#define CRC16_INIT 0xFFFF
+
+/* Initial value of a CRC-32, the final CRC is the updated value inverted */
+#define CRC32_INIT 0xFFFFFFFF
+
+/** Update a CRC-16/CCITT with a data buffer, start with CRC16_INIT
+ *  @param crc the CRC so far
+ *  @param data pointer to data buffer
+ *  @param size size of data buffer
+ *  @return the updated CRC
+ */
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t size);
+
+/** Update a CRC-32 (IEEE 802.3, reflected) with a data buffer, start with CRC32_INIT and invert the result
+ *  @param crc the CRC so far
+ *  @param data pointer to data buffer
+ *  @param size size of data buffer
+ *  @return the updated CRC
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t size);
+
+#endif /* INC_CRC_H_ */
@@ -0,0 +1,99 @@
+/*
+**************************************************************************************************************
+* @file     geofence.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Polygon zones of the bay, precomputed into a grid so a position is placed with one lookup
+**************************************************************************************************************
+*/
+
+#ifndef INC_GEOFENCE_H_
+#define INC_GEOFENCE_H_
+
+#include "main.h"
+
+/* Most zones, one bit per zone in a mask, and most vertices of a zone */
+#define GEOFENCE_MAX_ZONES 8
+#define GEOFENCE_MAX_VERTICES 8
+
+/* Smallest grid cell in mm, doubled until the zones fit in GEOFENCE_GRID_CELLS */
+#define GEOFENCE_CELL_SIZE 500
+#define GEOFENCE_GRID_CELLS 1024
+
+/* Consecutive positions a change of zones must be seen in before it is reported */
+#define GEOFENCE_CONFIRM 2
+
+/* Kinds of zone, reported with each event */
+#define GEOFENCE_NO_GO 0			//the crane must not enter
+#define GEOFENCE_RATED_LOAD 1		//the crane may only carry a reduced load
+#define GEOFENCE_MAINTENANCE 2		//bay under maintenance
+
+/* Corner of a zone in mm */
+typedef struct _geofenceVertex {
+	int32_t posX;
+	int32_t posY;
+} geofenceVertex_t;
+
+/* Zone of the bay, a simple polygon */
+typedef struct _geofenceZone {
+	uint8_t type;										//GEOFENCE_NO_GO, GEOFENCE_RATED_LOAD or GEOFENCE_MAINTENANCE
+	uint8_t vertexCount;								//entries used in vertices, at least 3
+	geofenceVertex_t vertices[GEOFENCE_MAX_VERTICES];	//corners in order around the zone
+} geofenceZone_t;
+
+/* Zones a grid cell lies in, and the zones whose boundary crosses it */
+typedef struct _geofenceCell {
+	uint8_t inside;				//bit per zone holding the whole cell
+	uint8_t edges;				//bit per zone a position in the cell must be tested against
+} geofenceCell_t;
+
+/* Grid over the zones */
+typedef struct _geofence {
+	const geofenceZone_t *zones;				//zone table
+	uint8_t zoneCount;
+	int32_t originX;							//corner of the first cell in mm
+	int32_t originY;
+	int32_t limitX;								//far corner of the zones in mm
+	int32_t limitY;
+	uint32_t cellSize;							//side of a cell in mm
+	uint16_t columns;							//cells along x
+	uint16_t rows;								//cells along y
+	geofenceCell_t cells[GEOFENCE_GRID_CELLS];	//row by row
+} geofence_t;
+
+/* Zones a crane is in */
+typedef struct _geofenceState {
+	uint8_t inside;				//bit per zone the crane has been reported in
+	uint8_t pending;			//zones the crane has been seen in since they last changed
+	uint8_t count;				//consecutive positions pending has been seen
+} geofenceState_t;
+
+/** Build the grid from a zone table. Positions beyond the corners of the zones are in no zone
+ *  @param geofence pointer to grid
+ *  @param zones the zone table, must stay valid while the grid is used
+ *  @param zoneCount number of zones in the table, may be 0
+ *  @return GEOFENCE_ERROR if the table is too long or a zone has too few or too many vertices,
+ *  otherwise GOOD_INIT
+ */
+int geofence_build(geofence_t *geofence, const geofenceZone_t *zones, uint8_t zoneCount);
+
+/** Get the zones a position is in, with one cell lookup and a test against each zone whose boundary
+ *  crosses the cell
+ *  @param geofence pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return bit per zone
+ */
+uint8_t geofence_lookup(geofence_t *geofence, int32_t posX, int32_t posY);
+
+/** Place a crane at its latest position and get the zones it has entered or left, once the change
+ *  has been seen in GEOFENCE_CONFIRM consecutive positions
+ *  @param geofence pointer to grid
+ *  @param state zones the crane is in, zeroed before the first position
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return bit per zone entered or left, the bits set in state->inside were entered
+ */
+uint8_t geofence_update(geofence_t *geofence, geofenceState_t *state, int32_t posX, int32_t posY);
+
+#endif /* INC_GEOFENCE_H_ */
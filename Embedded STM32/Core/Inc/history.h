@@ -0,0 +1,109 @@
+/*
+**************************************************************************************************************
+* @file     history.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Ring buffer of the recent positions of a crane, one per interval, with running statistics
+**************************************************************************************************************
+*/
+
+#ifndef INC_HISTORY_H_
+#define INC_HISTORY_H_
+
+#include "main.h"
+
+/* Time the window covers in s, and the interval each entry averages the positions of in ms. A crane
+ * positioned less often than the interval holds its last entry over the empty intervals */
+#ifndef HISTORY_SECONDS
+#define HISTORY_SECONDS 64
+#endif
+#ifndef HISTORY_BUCKET_MS
+#define HISTORY_BUCKET_MS 1000
+#endif
+
+/* Entries kept, one per interval of the window */
+#define HISTORY_SIZE ((HISTORY_SECONDS * 1000) / HISTORY_BUCKET_MS)
+
+#if ((HISTORY_SECONDS * 1000) % HISTORY_BUCKET_MS) || (HISTORY_SIZE & (HISTORY_SIZE - 1)) || (HISTORY_SIZE > 32768)
+#error "HISTORY_SECONDS must hold a power of two number of HISTORY_BUCKET_MS intervals, no more than 32768"
+#endif
+
+#define HISTORY_MASK (HISTORY_SIZE - 1)
+
+/* RAM the histories of every tag may take in bytes, out of the 64 KB SRAM */
+#define HISTORY_RAM_BUDGET 8192
+
+/* Horizontal position of a history entry in mm */
+typedef struct _historyEntry {
+	int32_t posX;
+	int32_t posY;
+} historyEntry_t;
+
+/* Positions in the window in order of their extreme value, to track the minimum or maximum of one axis */
+typedef struct _historyExtreme {
+	uint16_t seq[HISTORY_SIZE];		//sequence numbers, the front holds the extreme
+	uint16_t first;					//index of the front
+	uint16_t count;
+} historyExtreme_t;
+
+/* Window of the most recent positions, averaged per interval */
+typedef struct _history {
+	historyEntry_t entries[HISTORY_SIZE];	//indexed by sequence number & HISTORY_MASK
+	uint16_t seq;							//sequence number of the next position
+	uint16_t count;							//positions in the window
+	int64_t sumX;							//sums over the window, exact so they never drift
+	int64_t sumY;
+	int64_t sumXX;
+	int64_t sumYY;
+	historyExtreme_t extremes[4];			//minimum x, maximum x, minimum y, maximum y
+	uint32_t bucket;						//interval being averaged, tick / HISTORY_BUCKET_MS
+	int64_t bucketX;						//sums of the positions in the interval
+	int64_t bucketY;
+	uint16_t bucketCount;					//positions in the interval
+} history_t;
+
+/** Empty the history
+ *  @param history pointer to history
+ */
+void history_init(history_t *history);
+
+/** Add a position to the interval it falls in. The mean of an interval enters the window once a position
+ *  falls in a later one, replacing the oldest entry once the window is full. A window with no position
+ *  for all of HISTORY_SECONDS is emptied
+ *  @param history pointer to history
+ *  @param position the position
+ *  @param tick tick the position was taken
+ */
+void history_add(history_t *history, const coordinates_t *position, uint32_t tick);
+
+/** Get the mean position of the window
+ *  @param history pointer to history
+ *  @param mean struct to store the mean, posZ is left as it is
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_mean(history_t *history, coordinates_t *mean);
+
+/** Get the variance of the positions in the window along each axis
+ *  @param history pointer to history
+ *  @param varX x variance in mm^2
+ *  @param varY y variance in mm^2
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_variance(history_t *history, uint32_t *varX, uint32_t *varY);
+
+/** Get the bounding box of the positions in the window
+ *  @param history pointer to history
+ *  @param min struct to store the lower corner, posZ is left as it is
+ *  @param max struct to store the upper corner, posZ is left as it is
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_bounds(history_t *history, coordinates_t *min, coordinates_t *max);
+
+/** Check if the crane has stayed put over the whole window of HISTORY_SECONDS
+ *  @param history pointer to history
+ *  @param span largest side of the bounding box of a crane that has not moved, in mm
+ *  @return 1 if the window is full and its positions fit in the span, otherwise 0
+ */
+uint8_t history_still(history_t *history, uint32_t span);
+
+#endif /* INC_HISTORY_H_ */
@@ -13,7 +13,217 @@
 #include "main.h"
 #include "registers.h"
 
-#define I2C_DELAY 5
+/* Time the pozyx is given to accept a transaction (NACK polling) before it is failed, in ms */
+#define I2C_READY_BUDGET 10
+
+/* Set to 1 to count the time each positioning cycle spends waiting on the i2c bus */
+#ifndef I2C_WAIT_STATS
+#define I2C_WAIT_STATS 0
+#endif
+
+/* Default deadline for a single transaction, from the time it reaches the front of the queue, in ms */
+#define I2C_TRANSACTION_TIMEOUT 25
+
+/* Bus recovery: SCL clocks sent to free a slave holding SDA low, and the longest the slave may
+ * stretch each clock, in us */
+#define I2C_RECOVERY_CLOCKS 9
+#define I2C_STRETCH_TIMEOUT 1000
+
+/* I2C1 pins, driven as GPIO during bus recovery */
+#define I2C_SCL_PORT GPIOA
+#define I2C_SCL_PIN GPIO_PIN_9
+#define I2C_SDA_PORT GPIOA
+#define I2C_SDA_PIN GPIO_PIN_10
+
+#define I2C_QUEUE_LENGTH 16
+#define I2C_MAX_TX_SIZE 32
+
+/* I2C bus speed profiles, in order of increasing speed */
+typedef enum {
+	I2C_SPEED_STANDARD,			//100 kHz
+	I2C_SPEED_FAST,				//400 kHz
+	I2C_SPEED_FAST_PLUS,		//1 MHz
+	I2C_SPEED_COUNT
+} i2cSpeedProfile_t;
+
+/* Types of transaction that can be placed on the i2c queue */
+typedef enum {
+	I2C_OP_WRITE_REG,
+	I2C_OP_READ_REG,
+	I2C_OP_FUNCTION_CALL
+} i2cOperation_t;
+
+/* Life cycle of a queued transaction */
+typedef enum {
+	I2C_TRANSACTION_IDLE,
+	I2C_TRANSACTION_QUEUED,
+	I2C_TRANSACTION_ACTIVE,
+	I2C_TRANSACTION_DONE
+} i2cTransactionState_t;
+
+/* Time spent waiting on the i2c bus since the last reset, see I2C_WAIT_STATS */
+typedef struct _i2cWaitStats {
+	uint32_t transactions;		//number of transactions completed
+	uint32_t readyPolls;		//number of times the pozyx NACKed because it was busy
+	uint32_t readyCycles;		//cycles between the first NACK and the pozyx accepting the transaction
+	uint32_t blockedCycles;		//cycles the caller spent blocked in I2C_Queue_Wait
+} i2cWaitStats_t;
+
+/* Bus faults since power up */
+typedef struct _i2cBusHealth {
+	uint32_t timeouts;			//transactions failed at their deadline
+	uint32_t busErrors;			//bus or arbitration errors
+	uint32_t recoveries;		//bus recovery sequences run
+	uint32_t stuckBus;			//recoveries that could not free SDA
+} i2cBusHealth_t;
+
+typedef struct _i2cTransaction i2cTransaction_t;
+typedef void (*i2cCallback_t)(i2cTransaction_t *transaction);
+
+/* A single i2c transaction. Transactions may be chained through next and are executed
+ * back to back, the chain is aborted at the first failure. The transaction and its rx buffer
+ * are owned by the caller and must stay valid until the transaction is done */
+struct _i2cTransaction {
+	I2C_HandleTypeDef *hi2c;
+	i2cOperation_t operation;
+	uint16_t devAddress;
+	uint16_t memAddress;
+	uint8_t txData[I2C_MAX_TX_SIZE];
+	uint16_t txSize;
+	uint8_t *rxData;
+	uint16_t rxSize;
+	uint8_t checkResult;					//fail if the function call returns POZYX_FAILURE
+	uint8_t phase;							//0 = memory address/parameters, 1 = read back
+	uint32_t timeout;						//deadline in ms, 0 for I2C_TRANSACTION_TIMEOUT
+	uint32_t startTick;						//tick the transaction reached the front of the queue
+	uint32_t startCycles;					//cycle count the transaction reached the front of the queue
+	volatile HAL_StatusTypeDef status;
+	volatile i2cTransactionState_t state;
+	i2cTransaction_t *next;					//next transaction in the chain, NULL if last
+	i2cCallback_t callback;					//called from the main loop once the chain is done, set on the first
+	void *context;							//transaction of the chain
+};
+
+/** Prepare a register write transaction
+ *  @param transaction pointer to transaction
+ *  @param MemAddress memory address of register
+ *  @param txData pointer to data buffer
+ *  @param txSize size of data buffer
+ *  @return HAL_ERROR if the data does not fit in the transaction, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Prepare_Write(i2cTransaction_t *transaction, uint16_t MemAddress, uint8_t *txData, uint16_t txSize);
+
+/** Prepare a register read transaction
+ *  @param transaction pointer to transaction
+ *  @param MemAddress memory address of register
+ *  @param rxData pointer to data buffer
+ *  @param rxSize size of data buffer
+ *  @return HAL status of the preparation
+ */
+HAL_StatusTypeDef I2C_Prepare_Read(i2cTransaction_t *transaction, uint16_t MemAddress, uint8_t *rxData, uint16_t rxSize);
+
+/** Prepare a function call transaction
+ *  @param transaction pointer to transaction
+ *  @param DevAddress the address of the slave
+ *  @param MemAddress the address for the register memory
+ *  @param txData a pointer to a buffer containing the function parameters
+ *  @param txSize the size of txData
+ *  @param rxData a pointer to a buffer in which the read data will be stored
+ *  @param rxSize the size of rxData
+ *  @return HAL_ERROR if the parameters do not fit in the transaction, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Prepare_Function_Call(i2cTransaction_t *transaction, uint16_t DevAddress, uint16_t MemAddress,
+											uint8_t *txData, uint16_t txSize, uint8_t *rxData, uint16_t rxSize);
+
+/** Place a transaction (or chain of transactions) on the i2c queue. The transfer is run over DMA
+ *  and the function returns immediately. If the first transaction has a callback it is run from
+ *  I2C_Queue_Process once the chain is done
+ *  @param hi2c pointer to i2c handle
+ *  @param transaction the first transaction of the chain
+ *  @return HAL_OK if queued, HAL_BUSY if the queue is full
+ */
+HAL_StatusTypeDef I2C_Queue_Submit(I2C_HandleTypeDef *hi2c, i2cTransaction_t *transaction);
+
+/** Block until every transaction in a chain is done. Each transaction is bounded by its deadline
+ *  so the wait is bounded by the sum of the deadlines in the queue. Only for start up and configuration,
+ *  the positioning cycle is run from the chain callbacks
+ *  @param transaction the first transaction of the chain
+ *  @return the first non HAL_OK status in the chain, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Queue_Wait(i2cTransaction_t *transaction);
+
+/** Get the result of a chain that is done
+ *  @param transaction the first transaction of the chain
+ *  @return the first non HAL_OK status in the chain, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Queue_Status(i2cTransaction_t *transaction);
+
+/** Service the i2c queue from the main loop. Starts transactions that could not be started
+ *  from the interrupt, fails transactions past their deadline, recovers the bus after a fault
+ *  and runs the callbacks of completed chains
+ */
+void I2C_Queue_Process(void);
+
+/** Check if the i2c queue has any pending or active transactions
+ *  @return 1 if busy, otherwise 0
+ */
+uint8_t I2C_Queue_Busy(void);
+
+/** Get the i2c wait statistics accumulated since the last reset. Only counted when
+ *  I2C_WAIT_STATS is set
+ *  @param stats pointer to struct to copy the statistics to
+ */
+void I2C_Wait_Stats_Get(i2cWaitStats_t *stats);
+
+/** Reset the i2c wait statistics, typically at the start of a positioning cycle
+ */
+void I2C_Wait_Stats_Reset(void);
+
+/** Get the bus fault counters
+ *  @param health pointer to struct to copy the counters to
+ */
+void I2C_Bus_Health_Get(i2cBusHealth_t *health);
+
+/** Recover a hung bus. The peripheral is reset, SCL is clocked until the slave releases SDA and
+ *  a STOP is sent before the peripheral is reinitialised at the current speed. Must not be called
+ *  while a transaction is on the bus
+ *  @param hi2c pointer to i2c handle
+ *  @return HAL_ERROR if SDA is still held low, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Bus_Recover(I2C_HandleTypeDef *hi2c);
+
+/** Compute the TIMINGR value for a speed profile from the i2c kernel clock
+ *  @param i2cClock frequency of the i2c kernel clock in Hz
+ *  @param profile the speed profile
+ *  @param timing pointer to store the TIMINGR value
+ *  @param frequency pointer to store the resulting SCL frequency in Hz, may be NULL
+ *  @return HAL_ERROR if the profile cannot be met with the given clock, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Compute_Timing(uint32_t i2cClock, i2cSpeedProfile_t profile, uint32_t *timing,
+									 uint32_t *frequency);
+
+/** Reconfigure the i2c peripheral for a speed profile using the current PCLK1 (derived from SYSCLK)
+ *  @param hi2c pointer to i2c handle
+ *  @param profile the speed profile
+ *  @return HAL_ERROR if the profile cannot be met or the peripheral failed to initialise, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Set_Speed(I2C_HandleTypeDef *hi2c, i2cSpeedProfile_t profile);
+
+/** Get the speed profile the bus is currently running at
+ *  @return the speed profile
+ */
+i2cSpeedProfile_t I2C_Get_Speed(void);
+
+/** Get the SCL frequency the bus is currently running at
+ *  @return SCL frequency in Hz
+ */
+uint32_t I2C_Get_Frequency(void);
+
+/** Get a short name for a speed profile
+ *  @param profile the speed profile
+ *  @return "SM", "FM" or "FM+"
+ */
+const char *I2C_Speed_Name(i2cSpeedProfile_t profile);
 
 /** Send an I2C function call to the pozyx master tag
  *  Function will send an I2C containing the slave address, memory address and
@@ -27,8 +237,8 @@
  *  @param txSize the size of txData
  *  @param rxData a pointer to a received data buffer in which the read data will be stored
  *  @param rxSize the size of rxData
- *  @param Timeout the timeout time in ms for an i2c transaction
- *  @return HAL status of the communication process
+ *  @param Timeout the deadline in ms for the i2c transaction
+ *  @return HAL status of the communication process, HAL_TIMEOUT if the deadline passed
  */
 HAL_StatusTypeDef I2C_Send_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
 										 uint16_t MemAddSize, uint8_t *txData, uint16_t txSize,
@@ -0,0 +1,52 @@
+/*
+**************************************************************************************************************
+* @file     imu.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Turns the linear acceleration of a remote tag into the acceleration of the crane in the bay
+**************************************************************************************************************
+*/
+
+#ifndef INC_IMU_H_
+#define INC_IMU_H_
+
+#include "main.h"
+
+/* Acceleration in mm/s^2 of one mg, the unit of LIA_X and LIA_Y */
+#define IMU_MG 9.80665f
+
+/* Weight of a parked sample in the running bias of the accelerometer */
+#define IMU_BIAS_GAIN 0.05f
+
+/* Time between samples of a parked crane in ms, taken only to learn the bias */
+#define IMU_BIAS_PERIOD 500
+
+/* Longest a position is carried on the accelerometer after the last position that passed the gating, in ms */
+#define IMU_MAX_COAST 1000
+
+/* Accelerometer of a remote tag */
+typedef struct _imu {
+	float cosMount;				//rotation from the axes of the tag to the axes of the bay
+	float sinMount;
+	float bias[2];				//running bias in the axes of the tag in mm/s^2
+	uint32_t tick;				//tick the last sample was requested
+	uint32_t samples;			//samples read
+	uint32_t failures;			//samples that could not be read
+} imu_t;
+
+/** Initialise the accelerometer of a tag
+ *  @param imu pointer to accelerometer
+ *  @param mount angle in degrees from the x axis of the bay to the x axis of the tag, counter clockwise
+ */
+void imu_init(imu_t *imu, int16_t mount);
+
+/** Convert a linear acceleration sample of the tag into the acceleration of the crane in the axes of the
+ *  bay. The sample of a parked crane is taken as bias, and the crane is not accelerating
+ *  @param imu pointer to accelerometer
+ *  @param raw LIA_X and LIA_Y of the tag in mg
+ *  @param parked 1 if the crane is parked
+ *  @param acceleration x and y acceleration to fill in mm/s^2
+ */
+void imu_acceleration(imu_t *imu, const int16_t raw[2], uint8_t parked, float acceleration[2]);
+
+#endif /* INC_IMU_H_ */
@@ -0,0 +1,90 @@
+/*
+**************************************************************************************************************
+* @file     kalman.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Constant velocity Kalman filter smoothing the positions of a crane
+**************************************************************************************************************
+*/
+
+#ifndef INC_KALMAN_H_
+#define INC_KALMAN_H_
+
+#include "main.h"
+
+/* Acceleration of the crane modelled as white noise, standard deviation in mm/s^2 */
+#define KALMAN_ACCEL_SIGMA 500.0f
+
+/* Error of a measured acceleration the filter is propagated with, standard deviation in mm/s^2 */
+#define KALMAN_IMU_SIGMA 150.0f
+
+/* Variance of a position in mm^2 when its covariance is not known, and the smallest variance trusted */
+#define KALMAN_MEAS_VARIANCE 22500.0f
+#define KALMAN_MIN_VARIANCE 100.0f
+
+/* Squared Mahalanobis distance beyond which a position is rejected, chi-squared with 2 dof at 99% */
+#define KALMAN_GATE 9.21f
+
+/* Consecutive rejected positions after which the filter starts again from the next position */
+#define KALMAN_MAX_REJECTS 5
+
+/* Longest the filter predicts over in one step in ms, a longer gap starts the filter again */
+#define KALMAN_MAX_GAP 5000
+
+/* State of the filter, position and velocity in the horizontal plane */
+typedef struct _kalman {
+	float state[4];				//x, y in mm, then x, y velocity in mm/s
+	float covariance[4][4];		//covariance of the state
+	uint32_t tick;				//tick the state is at
+	uint32_t fixTick;			//tick of the last position taken
+	uint8_t initialised;		//1 once a position has been taken
+	uint8_t rejects;			//consecutive rejected positions
+	uint32_t rejected;			//positions rejected since the filter was initialised
+	float maxSpeed;				//fastest the crane travels in mm/s, the velocity a new filter is unsure of
+} kalman_t;
+
+/** Reset the filter, the next position starts it again
+ *  @param filter pointer to filter
+ *  @param maxSpeed fastest the crane travels in mm/s
+ */
+void kalman_init(kalman_t *filter, int32_t maxSpeed);
+
+/** Predict the state forward to a tick, so a missed position widens the covariance the next one is gated with
+ *  @param filter pointer to filter
+ *  @param tick the tick to predict to
+ */
+void kalman_predict(kalman_t *filter, uint32_t tick);
+
+/** Propagate the state forward to a tick with a measured acceleration of the crane, held since the
+ *  state was last moved on
+ *  @param filter pointer to filter
+ *  @param acceleration x and y acceleration in mm/s^2
+ *  @param tick the tick to propagate to
+ */
+void kalman_propagate(kalman_t *filter, const float acceleration[2], uint32_t tick);
+
+/** Predict the state to a tick and correct it with a position, unless the position is too far from
+ *  the prediction to be believed
+ *  @param filter pointer to filter
+ *  @param position the measured position
+ *  @param covariance covariance of the position in mm^2, NULL for KALMAN_MEAS_VARIANCE
+ *  @param tick the tick the position was measured at
+ *  @return FIX_REJECTED if the position was rejected, otherwise POSITIONS_RETRIEVED
+ */
+int kalman_update(kalman_t *filter, const coordinates_t *position, const covariance_t *covariance, uint32_t tick);
+
+/** Get the smoothed position and velocity
+ *  @param filter pointer to filter
+ *  @param position struct to store the position, posZ is left as it is
+ *  @param velX x velocity in mm/s, may be NULL
+ *  @param velY y velocity in mm/s, may be NULL
+ */
+void kalman_state(kalman_t *filter, coordinates_t *position, int16_t *velX, int16_t *velY);
+
+/** Get the smoothed speed
+ *  @param filter pointer to filter
+ *  @return speed in mm/s
+ */
+uint32_t kalman_speed(kalman_t *filter);
+
+#endif /* INC_KALMAN_H_ */
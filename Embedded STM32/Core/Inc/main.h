@@ -48,6 +48,39 @@ extern "C"
     int32_t posZ;
   } coordinates_t;
 
+  typedef struct __attribute__((packed)) _covariance
+  {
+    int16_t errX;
+    int16_t errY;
+    int16_t errZ;
+    int16_t errXY;
+    int16_t errXZ;
+    int16_t errYZ;
+  } covariance_t;
+
+  typedef struct _telemetry
+  {
+    uint32_t positioningTime; // ms from the positioning request until the position was sent back
+    uint8_t rangesUsed;       // ranges the position was solved from, 0 if positioned by the remote tag
+    uint8_t rangesRejected;   // ranges rejected as outliers
+    uint16_t rangeResidual;   // rms range residual of the solved position in mm
+    int16_t velX;             // smoothed velocity in mm/s
+    int16_t velY;
+    uint8_t quality;          // score of the position from its covariance, QUALITY_UNKNOWN if not known
+    uint8_t motion;           // motion state of the crane, 0 parked, 1 creeping, 2 travelling
+    uint16_t coasted;         // ms the position was carried on the accelerometer since the last fix, 0 for a fix
+  } telemetry_t;
+
+  typedef struct _rangeMeasurement
+  {
+    uint16_t networkID; // anchor ranged to
+    int32_t posX;       // position of the anchor in mm
+    int32_t posY;
+    int32_t posZ;
+    uint32_t distance; // measured distance in mm
+    int16_t rss;       // received signal strength in dBm
+  } rangeMeasurement_t;
+
   typedef struct __attribute__((packed)) _calibration
   {
     uint16_t anchorID1;
@@ -64,6 +97,17 @@ extern "C"
 #include "pozyx.h"
 #include "registers.h"
 #include "zigbee.h"
+#include "timing.h"
+#include "trace.h"
+#include "shadow.h"
+#include "retry.h"
+#include "crc.h"
+#include "multilat.h"
+#include "kalman.h"
+#include "quality.h"
+#include "history.h"
+#include "imu.h"
+#include "geofence.h"
 #include "stdlib.h"
 #include "math.h"
 /* USER CODE END Includes */
@@ -107,11 +151,16 @@ extern "C"
 #define BAY_LENGTH_MAX 45600
 #define BAY_WIDTH_MIN 0
 #define BAY_LENGTH_MIN 0
-#define MAX_CRANE_SPEED 1500
+#define MAX_CRANE_SPEED 1500 // built in top speed of a crane in mm/s, the site configuration holds the one in use
 #define OFFSET 1500
-#define MAX_DISTANCE_TRAVELLED 2000
 
 #define CRANE_ID 3
+
+#define STILL_SPAN 350 // largest movement over the history window of a crane that has not moved, in mm
+
+#define ZONE_HYSTERESIS 1000 // distance past a zone boundary before switching anchors
+
+#define FIX_PERIOD 50 // time between positions of a crane in ms
   /* USER CODE END EM */
 
   /* Exported functions prototypes ---------------------------------------------*/
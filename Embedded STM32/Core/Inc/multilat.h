@@ -0,0 +1,55 @@
+/*
+**************************************************************************************************************
+* @file     multilat.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Solves the position of a tag from its ranges to the anchors
+**************************************************************************************************************
+*/
+
+#ifndef INC_MULTILAT_H_
+#define INC_MULTILAT_H_
+
+#include "main.h"
+
+/* Most ranges solved together, one bit per range in the rejected mask */
+#define MULTILAT_MAX_RANGES 32
+
+/* Fewest ranges a position is solved from, and the fewest left after rejecting outliers */
+#define MULTILAT_MIN_RANGES 3
+
+/* Gauss-Newton iterations before giving up, and the step in mm below which the position has converged */
+#define MULTILAT_MAX_ITERATIONS 10
+#define MULTILAT_CONVERGED 1.0f
+
+/* Standard deviation of a range in mm at or above MULTILAT_RSS_GOOD, and the increase per dB below it */
+#define MULTILAT_SIGMA 100
+#define MULTILAT_RSS_GOOD -80
+#define MULTILAT_SIGMA_PER_DB 10
+
+/* Residual in standard deviations beyond which a range is rejected as non line of sight */
+#define MULTILAT_OUTLIER 3.0f
+
+/* Outcome of a solve */
+typedef struct _multilatResult {
+	uint8_t used;				//ranges the position was solved from
+	uint8_t rejected;			//ranges rejected as outliers
+	uint32_t rejectedMask;		//bit per rejected range
+	uint16_t residual;			//rms residual of the used ranges in mm
+	uint8_t iterations;			//Gauss-Newton iterations of the final solve
+	covariance_t covariance;	//covariance of the solved position in mm^2, z entries left at 0
+} multilatResult_t;
+
+/** Solve the horizontal position of a tag from its ranges, at the fixed height of the starting position.
+ *  The ranges are weighted by their signal strength and the worst range is rejected while its residual
+ *  is an outlier and enough ranges remain
+ *  @param ranges the ranges, a distance of 0 marks a failed range
+ *  @param rangeCount number of ranges
+ *  @param position the starting position, set to the solved position
+ *  @param result struct to store the outcome, may be NULL
+ *  @return RANGING_ERROR if too few ranges or the anchors do not fix a position, otherwise POSITIONS_RETRIEVED
+ */
+int multilat_solve(const rangeMeasurement_t *ranges, uint8_t rangeCount, coordinates_t *position,
+		multilatResult_t *result);
+
+#endif /* INC_MULTILAT_H_ */
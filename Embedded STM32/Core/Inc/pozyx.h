@@ -21,6 +21,12 @@
 #define POSITIONS_NOT_READY -4
 #define BAD_FUNCTION_CALL -5
 #define INT_ERR -6
+#define BUS_TIMEOUT_ERROR -7
+#define INT_TIMEOUT_ERROR -8
+#define ANCHOR_TABLE_ERROR -9
+#define RANGING_ERROR -10
+#define FIX_REJECTED -11
+#define GEOFENCE_ERROR -12
 #define GOOD_READ 1
 #define GOOD_INIT 2
 #define DEVICE_ADDED 3
@@ -29,6 +35,96 @@
 #define POSITIONS_REQUESTED 6
 #define DEVICE_CALIBRATED 7
 #define TRANSMITTED_MESSAGE 8
+#define DEVICES_MATCHED 9
+
+/* Size of the block of positioning registers from POZYX_POS_X to POZYX_POS_ERR_YZ */
+#define POSITION_BLOCK_SIZE (POZYX_POS_ERR_YZ + 2 - POZYX_POS_X)
+
+/* Longest the master tag is given to receive the reply from a remote tag, in ms */
+#define REMOTE_RX_TIMEOUT 100
+
+/* Number of consecutive WHO_AM_I reads that must succeed for a bus speed to be accepted */
+#define SPEED_PROBE_READS 3
+
+/* Longest the master tag is given to answer WHO_AM_I after power up, and the time between tries, in ms */
+#define POZYX_BOOT_TIMEOUT 10000
+#define POZYX_READY_POLL 10
+
+/** Probe the master tag at the fastest i2c speed profile the clock allows, falling back to
+ *  slower profiles on NACKs or a bad WHO_AM_I
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @return the speed profile in use, or BAD_READ_ERROR if the tag does not respond at any speed
+ */
+int probe_bus_speed(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c);
+
+/** Wait for the master tag to answer WHO_AM_I after power up
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param timeout longest to wait in ms
+ *  @return BAD_READ_ERROR if the tag did not answer in time, otherwise GOOD_READ
+ */
+int pozyx_wait_ready(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint32_t timeout);
+
+/** Add a device to the checksum of a device list, its network id then its coordinates
+ *  @param crc checksum so far, CRC16_INIT for the first device
+ *  @param device the device
+ *  @return updated checksum
+ */
+uint16_t device_crc_update(uint16_t crc, const deviceCoords_t *device);
+
+/** Get the checksum of the network ids and coordinates of a device list, in the order the devices
+ *  are added
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return CRC-16 of the network ids and coordinates
+ */
+uint16_t device_list_crc(const deviceCoords_t *devices, uint8_t deviceCount);
+
+/** Build a device read back from a pozyx out of its little endian network id and coordinates
+ *  @param networkID network id as read from DEVICES_GETIDS
+ *  @param coordinates x, y and z as read from DEVICE_GETCOORDS
+ *  @return the device, its flag is not stored by the pozyx and left 0
+ */
+deviceCoords_t stored_device(const uint8_t *networkID, const uint8_t *coordinates);
+
+/** Make sure the device list of the master tag holds the given devices. The stored list is read
+ *  back and left as it is if it already matches, otherwise it is cleared and the devices are added
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return DEVICES_MATCHED if the list was kept, DEVICE_ADDED if it was rebuilt, < 0 for an error
+ */
+int master_provision_devices(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, const deviceCoords_t *devices,
+							 uint8_t deviceCount);
+
+/** Notify the driver that the pozyx INT line has been raised, call from the EXTI callback
+ */
+void pozyx_int_callback(void);
+
+/** Check if the pozyx INT line has been raised since the interrupt status was last read
+ *  @return 1 if an interrupt is pending, otherwise 0
+ */
+uint8_t pozyx_int_pending(void);
+
+/** Clear the pending interrupt before INT_STATUS is read without wait_for_interrupt, so an edge during
+ *  the read is not lost
+ */
+void pozyx_int_acknowledge(void);
+
+/** Wait for the pozyx to raise one of the given interrupts. INT_STATUS is only read once the
+ *  INT line has been raised, reading it clears the line
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param mask the POZYX_INT_STATUS bits to wait for
+ *  @param timeout time to wait in ms, 0 to only check a pending interrupt
+ *  @param intStatus pointer to store the last INT_STATUS read, may be NULL
+ *  @return INTERRUPT if an interrupt in mask was raised, INT_ERR if the pozyx raised an error instead,
+ *  INT_TIMEOUT_ERROR if neither was raised in time, BAD_READ_ERROR for an error in communication
+ */
+int wait_for_interrupt(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint8_t mask, uint32_t timeout,
+					   uint8_t *intStatus);
 
 /** Initialise the master tag for operation
  *  @param slaveAddr the address of the slave - this is typically 0x4B
@@ -60,14 +156,34 @@ int add_anchors(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, deviceCoords_t devic
  */
 int check_status_registers(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c);
 
+/** Read a block of consecutive registers from the master tag in a single i2c transaction
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param firstReg the first register of the block
+ *  @param lastReg the last register of the block
+ *  @param rxData buffer to store the register values
+ *  @param rxSize size of rxData
+ *  @return for an error < 0, otherwise > 0
+ */
+int read_register_block(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint16_t firstReg, uint16_t lastReg,
+						uint8_t *rxData, uint16_t rxSize);
+
+/** Decode the positioning register block (POZYX_POS_X to POZYX_POS_ERR_YZ)
+ *  @param data the raw register block of POSITION_BLOCK_SIZE bytes
+ *  @param coordinates a pointer to the coordinates struct to store the positions
+ *  @param covariance a pointer to the covariance struct to store the errors, may be NULL
+ */
+void decode_position_block(uint8_t *data, coordinates_t *coordinates, covariance_t *covariance);
+
 /** Retrieve the positions after a positioning command from the appropriate
  *  pozyx tag registers
  *  @param slaveAddr the address of the slav - this is typically 0x4B
  *  @param hi2c the i2c handle for master tag communication
  *  @param coordinates a pointer to the coordinates struct to store the positions
+ *  @param covariance a pointer to the covariance struct to store the errors, may be NULL
  *  @return for an error < 0, otherwise > 0
  */
-int get_positions(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, coordinates_t *coordinates);
+int get_positions(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, coordinates_t *coordinates, covariance_t *covariance);
 
 /** Send the pozyx master tag a positioning request via i2c
  *  @param hi2c the i2c handle
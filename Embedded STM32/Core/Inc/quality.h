@@ -0,0 +1,31 @@
+/*
+**************************************************************************************************************
+* @file     quality.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Scores the quality of a position from its error covariance
+**************************************************************************************************************
+*/
+
+#ifndef INC_QUALITY_H_
+#define INC_QUALITY_H_
+
+#include "main.h"
+
+/* Horizontal rms error in mm at or below which a position scores 100, and at or above which it scores 0 */
+#define QUALITY_BEST_ERROR 30
+#define QUALITY_WORST_ERROR 250
+
+/* Positions scoring below this are dropped, the rest are sent with their score */
+#define QUALITY_REJECT 20
+
+/* Score of a position whose covariance is not known */
+#define QUALITY_UNKNOWN 0xFF
+
+/** Score a position from its error covariance, by its horizontal rms error sqrt(errX + errY)
+ *  @param covariance covariance of the position in mm^2, may be NULL
+ *  @return 0 for the worst to 100 for the best, QUALITY_UNKNOWN if the covariance is NULL or all zero
+ */
+uint8_t quality_score(const covariance_t *covariance);
+
+#endif /* INC_QUALITY_H_ */
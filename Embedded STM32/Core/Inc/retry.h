@@ -0,0 +1,92 @@
+/*
+**************************************************************************************************************
+* @file     retry.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Bounded retry with backoff for remote UWB operations
+**************************************************************************************************************
+*/
+
+#ifndef INC_RETRY_H_
+#define INC_RETRY_H_
+
+#include "main.h"
+
+/* Number of remote tags counters are kept for */
+#define RETRY_MAX_REMOTES 4
+
+/* Time between retry counter reports in ms */
+#define RETRY_REPORT_PERIOD 60000
+
+/* Operations with their own retry policy */
+typedef enum {
+	RETRY_REMOTE_READ,			//register read from a remote tag
+	RETRY_REMOTE_WRITE,			//register write to a remote tag
+	RETRY_REMOTE_FUNCTION,		//function call on a remote tag
+	RETRY_REMOTE_INIT,			//initialisation of a remote tag
+	RETRY_OP_COUNT
+} retryOperation_t;
+
+/* Retry policy of an operation */
+typedef struct _retryPolicy {
+	uint8_t attempts;			//attempts including the first
+	uint16_t backoff;			//wait before the first retry in ms, doubled for each retry
+	uint16_t maxBackoff;		//longest wait between attempts in ms
+} retryPolicy_t;
+
+/* Outcome counters of an operation */
+typedef struct _retryCounters {
+	uint32_t successes;			//operations that succeeded, at any attempt
+	uint32_t retries;			//attempts repeated after a failure
+	uint32_t failures;			//operations that failed every attempt
+} retryCounters_t;
+
+/* State of an operation being retried */
+typedef struct _retryState {
+	retryOperation_t operation;
+	uint16_t networkAddr;
+	uint8_t attempt;			//attempts made so far
+	uint32_t backoff;			//wait before the next retry in ms
+} retryState_t;
+
+/** Start an operation
+ *  @param state pointer to retry state
+ *  @param operation the operation
+ *  @param networkAddr network address of the remote tag
+ */
+void retry_start(retryState_t *state, retryOperation_t operation, uint16_t networkAddr);
+
+/** Record the result of an attempt and decide whether to try again, without waiting out the backoff
+ *  @param state pointer to retry state
+ *  @param status result of the attempt, > 0 for success
+ *  @param wait pointer to the time to wait before the next attempt in ms, set if it should be attempted again
+ *  @return 1 if the operation should be attempted again, otherwise 0
+ */
+uint8_t retry_schedule(retryState_t *state, int status, uint32_t *wait);
+
+/** Record the result of an attempt and decide whether to try again, waiting out the backoff if so
+ *  @param state pointer to retry state
+ *  @param status result of the attempt, > 0 for success
+ *  @return 1 if the operation should be attempted again, otherwise 0
+ */
+uint8_t retry_again(retryState_t *state, int status);
+
+/** Get the counters of an operation on a remote tag
+ *  @param networkAddr network address of the remote tag
+ *  @param operation the operation
+ *  @param counters pointer to struct to copy the counters to, zeroed if the tag has none
+ */
+void retry_get_counters(uint16_t networkAddr, retryOperation_t operation, retryCounters_t *counters);
+
+/** Reset the counters of every remote tag
+ */
+void retry_reset_counters(void);
+
+/** Send the counters through zigbee, one frame per remote tag and operation that has been used,
+ *  as "r<network address> o<operation> n<successes> a<retries> f<failures>" where the operation
+ *  is r/w/f/s for read, write, function and start up. The counters are reset once sent
+ *  @param huart pointer to uart handle
+ */
+void retry_report(UART_HandleTypeDef *huart);
+
+#endif /* INC_RETRY_H_ */
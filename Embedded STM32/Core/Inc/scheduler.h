@@ -0,0 +1,193 @@
+/*
+**************************************************************************************************************
+* @file     scheduler.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Time slices UWB positioning between the remote tags of several cranes
+**************************************************************************************************************
+*/
+
+#ifndef INC_SCHEDULER_H_
+#define INC_SCHEDULER_H_
+
+#include "main.h"
+#include "wireless.h"
+#include "shadow.h"
+
+/* Most remote tags one master tag serves, one remote shadow cache each */
+#define SCHED_MAX_TAGS SHADOW_MAX_REMOTES
+
+/* Default time between positions of a tag in ms */
+#define SCHED_DEFAULT_PERIOD 200
+
+/* Shortest slot given to a tag in ms, and the slot length as a multiple of its ranging time */
+#define SCHED_MIN_SLOT 20
+#define SCHED_SLOT_MARGIN 2
+
+/* Weight of a new ranging time in the running average, as a power of two */
+#define SCHED_RANGING_SHIFT 3
+
+/* Time between positions of a parked crane and a creeping crane in ms, a travelling crane is positioned
+ * at the period it was added with */
+#define SCHED_PARKED_PERIOD 2000
+#define SCHED_CREEPING_PERIOD 200
+
+/* Smoothed speed at which a crane is travelling in mm/s, it creeps again below half of it */
+#define SCHED_TRAVEL_SPEED 250
+
+/* Time from a remote tag failing to start to the next round of start up attempts in ms, each round is
+ * paced by the RETRY_REMOTE_INIT policy */
+#define SCHED_OFFLINE_PERIOD 60000
+
+/* Byte received over the zigbee uart that requests the scheduler statistics */
+#define SCHED_DUMP_COMMAND 'S'
+
+/* Motion of a crane, setting how often it is positioned */
+typedef enum {
+	MOTION_PARKED,				//has not moved over the history window
+	MOTION_CREEPING,			//moving slowly, inching a load into place
+	MOTION_TRAVELLING			//travelling along the bay
+} motionState_t;
+
+/* A remote tag to add to the scheduler */
+typedef struct _craneTagConfig {
+	uint16_t networkID;				//network address of the remote tag
+	uint8_t craneID;				//crane the tag is mounted on
+	uint16_t period;				//target time between positions in ms
+	int16_t imuMount;				//degrees from the x axis of the bay to the x axis of the tag
+} craneTagConfig_t;
+
+/* A remote tag and the state of the crane it is mounted on */
+typedef struct _craneTag {
+	uint16_t networkID;				//network address of the remote tag
+	uint8_t craneID;				//crane the tag is mounted on
+	uint16_t period;				//target time between positions in ms, set by the motion of the crane
+	uint16_t travelPeriod;			//target time between positions while travelling in ms
+	motionState_t motion;			//motion of the crane
+	uint8_t online;					//1 once the tag has been initialised, only online tags are scheduled
+	retryState_t initRetry;			//start up attempts of an offline tag
+	uint32_t initDue;				//tick the next start up attempt of an offline tag is due
+	uint32_t nextDue;				//tick the next position is due
+	uint32_t rangingTime;			//running average of the positioning time in ms
+	positioningRequest_t request;	//outstanding positioning request
+
+	coordinates_t prevPositions;	//last position that passed the gating
+	kalman_t filter;				//smoothed position and velocity of the crane
+	uint8_t anchorSet;				//anchor zone the tag is using
+	uint8_t anchorTarget;			//anchor zone the tag should be using
+	uint32_t deviceList;			//bit per entry of the anchor table held in the device list of the tag
+
+	history_t history;				//recent positions that passed the gating
+	imu_t imu;						//accelerometer of the tag, sampled between positions with REMOTE_IMU
+	geofenceState_t fences;			//zones of the bay the crane is in
+
+	uint32_t fixes;					//positions retrieved
+	uint32_t failures;				//positioning attempts that failed or timed out
+	uint32_t dropped;				//positions dropped as out of the bay, poor quality or off the filter track
+	uint32_t late;					//slots started a full period after they were due
+	uint32_t motionChanges;			//changes of motion state
+	uint32_t worstLateness;			//longest a slot started after it was due, in ms
+} craneTag_t;
+
+/* Table of remote tags sharing the master tag */
+typedef struct _scheduler {
+	craneTag_t tags[SCHED_MAX_TAGS];
+	uint8_t count;
+	uint32_t statsTick;				//tick the statistics were last reset
+	uint32_t busyTime;				//time the UWB slot was held since the reset, in ms
+} scheduler_t;
+
+/** Initialise an empty scheduler
+ *  @param scheduler pointer to scheduler
+ */
+void scheduler_init(scheduler_t *scheduler);
+
+/** Add a remote tag to the scheduler
+ *  @param scheduler pointer to scheduler
+ *  @param networkID network address of the remote tag
+ *  @param craneID crane the tag is mounted on
+ *  @param period target time between positions in ms
+ *  @return the added tag, NULL if the table is full
+ */
+craneTag_t *scheduler_add(scheduler_t *scheduler, uint16_t networkID, uint8_t craneID, uint16_t period);
+
+/** Pick the tag to give the UWB slot to, earliest deadline first among the tags that are due
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next(scheduler_t *scheduler);
+
+/** Pick the tag to sample the accelerometer of while the UWB slot is free, the longest waiting among the
+ *  tags being tracked. A moving crane is sampled every REMOTE_IMU_PERIOD until IMU_MAX_COAST after its
+ *  last position, a parked crane every IMU_BIAS_PERIOD
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next_imu(scheduler_t *scheduler);
+
+/** Take a tag out of the schedule after it failed to start, the next round of start up attempts is
+ *  due SCHED_OFFLINE_PERIOD later
+ *  @param tag the tag
+ */
+void scheduler_set_offline(craneTag_t *tag);
+
+/** Pick the offline tag to attempt to start while the UWB slot is free, the longest overdue among the
+ *  tags due a start up attempt
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next_offline(scheduler_t *scheduler);
+
+/** Record the result of a start up attempt of an offline tag. A tag that started is scheduled straight
+ *  away, otherwise the next attempt is set by the RETRY_REMOTE_INIT policy, starting a new round
+ *  SCHED_OFFLINE_PERIOD later once the attempts of the policy are used up
+ *  @param tag the tag
+ *  @param status result of the start up attempt
+ *  @return 1 if the tag is online, otherwise 0
+ */
+uint8_t scheduler_init_result(craneTag_t *tag, int status);
+
+/** Get the time a tag is given to send back its position, adapted to its measured ranging time
+ *  @param tag the tag
+ *  @return slot length in ms
+ */
+uint32_t scheduler_slot_length(craneTag_t *tag);
+
+/** Release the UWB slot held by a tag and update its statistics
+ *  @param scheduler pointer to scheduler
+ *  @param tag the tag
+ *  @param status result of the positioning
+ *  @param telemetry telemetry of the positioning, may be NULL
+ */
+void scheduler_complete(scheduler_t *scheduler, craneTag_t *tag, int status, telemetry_t *telemetry);
+
+/** Update the motion state of a crane from its latest position and set the period it is positioned at,
+ *  slowing down to SCHED_PARKED_PERIOD once parked
+ *  @param tag the tag
+ *  @return the motion state
+ */
+motionState_t scheduler_update_motion(craneTag_t *tag);
+
+/** Estimate how many tags the master tag can sustain at a given period from the slots measured so far
+ *  @param scheduler pointer to scheduler
+ *  @param period target time between positions of each tag in ms
+ *  @return number of tags
+ */
+uint8_t scheduler_capacity(scheduler_t *scheduler, uint16_t period);
+
+/** Reset the statistics of the scheduler and every tag
+ *  @param scheduler pointer to scheduler
+ */
+void scheduler_reset_stats(scheduler_t *scheduler);
+
+/** Send the scheduler statistics through zigbee. The first frame is
+ *  "sn<tags> u<utilisation permille> a<capacity at SCHED_DEFAULT_PERIOD>", then each tag is sent as
+ *  "s<index> c<crane> p<period> r<rate mHz> g<ranging ms> n<fixes> f<failures> d<dropped> l<late>
+ *  w<worst lateness ms> o<motion state> h<motion changes>".
+ *  The statistics are reset once sent
+ *  @param scheduler pointer to scheduler
+ *  @param huart pointer to uart handle
+ */
+void scheduler_dump(scheduler_t *scheduler, UART_HandleTypeDef *huart);
+
+#endif /* INC_SCHEDULER_H_ */
@@ -0,0 +1,69 @@
+/*
+**************************************************************************************************************
+* @file     shadow.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Shadow cache of the Pozyx configuration registers
+**************************************************************************************************************
+*/
+
+#ifndef INC_SHADOW_H_
+#define INC_SHADOW_H_
+
+#include "main.h"
+
+/* Configuration registers covered by the shadow, INT_MASK through SENSORS_MODE */
+#define SHADOW_FIRST_REG POZYX_INT_MASK
+#define SHADOW_LAST_REG POZYX_SENSORS_MODE
+#define SHADOW_SIZE (SHADOW_LAST_REG - SHADOW_FIRST_REG + 1)
+
+/* The remote shadow is read as one UWB message, POS_FILTER through SENSORS_MODE */
+#define SHADOW_REMOTE_FIRST_REG POZYX_POS_FILTER
+
+/* Number of remote tags that can be shadowed */
+#define SHADOW_MAX_REMOTES 4
+
+/* A desired value for a configuration register */
+typedef struct _configEntry {
+	uint8_t reg;
+	uint8_t value;
+} configEntry_t;
+
+/* Last known contents of the configuration registers of a tag */
+typedef struct _configShadow {
+	uint16_t networkAddr;		//network address of a remote tag, unused for the master tag
+	uint32_t known;				//bit per register, set if regs holds the value on the tag
+	uint8_t regs[SHADOW_SIZE];
+} configShadow_t;
+
+/** Bring the configuration registers of the master tag in line with the given config. The
+ *  registers are read back in bursts the first time, then only registers that differ are
+ *  written, consecutive registers in a single transaction
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param config desired register values
+ *  @param configSize number of entries in config
+ *  @return for an error < 0, otherwise the number of registers written
+ */
+int shadow_sync_master(I2C_HandleTypeDef *hi2c, uint8_t slaveAddr, const configEntry_t *config, uint8_t configSize);
+
+/** Bring the configuration registers of a remote tag in line with the given config. The
+ *  registers are read back in one UWB message the first time, then only registers that differ
+ *  are written and flashed
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param networkAddr network address of the remote tag
+ *  @param config desired register values
+ *  @param configSize number of entries in config
+ *  @param flash 1 to save the written registers to the flash of the remote tag
+ *  @return for an error < 0, otherwise the number of registers written
+ */
+int shadow_sync_remote(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const configEntry_t *config,
+					   uint8_t configSize, uint8_t flash);
+
+/** Forget the shadowed registers of a remote tag that may have been reset, so they are read back
+ *  on the next sync
+ *  @param networkAddr network address of the remote tag
+ */
+void shadow_invalidate_remote(uint16_t networkAddr);
+
+#endif /* INC_SHADOW_H_ */
@@ -0,0 +1,89 @@
+/*
+**************************************************************************************************************
+* @file     siteconfig.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Configuration of the bay, anchors and cranes, stored in its own flash page
+**************************************************************************************************************
+*/
+
+#ifndef INC_SITECONFIG_H_
+#define INC_SITECONFIG_H_
+
+#include "main.h"
+#include "anchors.h"
+#include "scheduler.h"
+
+/* Flash page holding the configuration, the last 2 KB page of the 256 KB flash. The linker script must
+ * keep the program out of it */
+#define SITE_CONFIG_ADDR 0x0803F800
+#define SITE_CONFIG_PAGE 127
+
+/* Marks a stored configuration, and the layout version of siteConfig_t. Bump the version when the
+ * layout changes so an old block is not read with the new layout */
+#define SITE_CONFIG_MAGIC 0x45544953
+#define SITE_CONFIG_VERSION 4
+
+/* Command byte that starts a configuration upload over zigbee. A whole siteConfig_t block follows, header
+ * and CRC included, and must arrive within SITE_CONFIG_RX_TIMEOUT ms. A valid block is stored and the
+ * board restarts with it, the result is sent back as "#c<status>" */
+#define SITE_CONFIG_COMMAND 'C'
+#define SITE_CONFIG_RX_TIMEOUT 2000
+
+/* Results of loading the configuration */
+#define SITE_CONFIG_STORED 1		//read from flash
+#define SITE_CONFIG_DEFAULT 2		//flash held no valid block, the built in defaults are used
+
+/* Configuration of a site. Aligned to the double word flash is programmed in, and read once at start up
+ * into RAM so no consumer waits on flash */
+typedef struct __attribute__((aligned(8))) _siteConfig {
+	uint32_t magic;							//SITE_CONFIG_MAGIC
+	uint16_t version;						//SITE_CONFIG_VERSION
+	uint16_t size;							//sizeof (siteConfig_t)
+
+	int32_t bayWidthMin;					//bay in mm, positions beyond it by more than the margin are dropped
+	int32_t bayWidthMax;
+	int32_t bayLengthMin;
+	int32_t bayLengthMax;
+	int32_t bayMargin;
+	int32_t maxCraneSpeed;					//fastest a crane travels in mm/s, the velocity the filter starts out unsure of
+
+	uint8_t numAnchors;						//anchors the tags position with when no zone is selected
+	uint8_t anchorCount;					//entries used in anchors
+	uint8_t tagCount;						//entries used in tags
+	deviceCoords_t anchors[ANCHOR_TABLE_MAX];
+	craneTagConfig_t tags[SCHED_MAX_TAGS];
+
+	uint8_t fenceCount;						//entries used in fences
+	geofenceZone_t fences[GEOFENCE_MAX_ZONES];	//no go, rated load and maintenance zones of the bay
+
+	uint32_t crc;							//CRC-32 of every byte before it
+} siteConfig_t;
+
+/* Configuration in use, loaded by site_config_load */
+extern siteConfig_t siteConfig;
+
+/** Load the configuration from flash into siteConfig, falling back to the built in defaults if the
+ *  stored block is missing, of another version or corrupt. The defaults are stored if the page is blank
+ *  @return SITE_CONFIG_STORED if read from flash, otherwise SITE_CONFIG_DEFAULT
+ */
+int site_config_load(void);
+
+/** Fill a configuration with the built in defaults
+ *  @param config pointer to configuration
+ */
+void site_config_defaults(siteConfig_t *config);
+
+/** Check a configuration can be used, its header and CRC match this firmware and its tables fit
+ *  @param config pointer to configuration
+ *  @return 1 if valid, otherwise 0
+ */
+uint8_t site_config_valid(const siteConfig_t *config);
+
+/** Store a configuration in flash, setting its header and CRC
+ *  @param config pointer to configuration
+ *  @return BAD_WRITE_ERROR if the page could not be erased or programmed, otherwise GOOD_INIT
+ */
+int site_config_save(siteConfig_t *config);
+
+#endif /* INC_SITECONFIG_H_ */
@@ -0,0 +1,35 @@
+/*
+**************************************************************************************************************
+* @file     timing.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Cycle accurate timing using the DWT cycle counter
+**************************************************************************************************************
+*/
+
+#ifndef INC_TIMING_H_
+#define INC_TIMING_H_
+
+#include "main.h"
+
+/** Enable the DWT cycle counter
+ */
+void timing_init(void);
+
+/** Get the current value of the DWT cycle counter
+ *  @return number of core clock cycles since the counter was enabled (wraps)
+ */
+uint32_t timing_cycles(void);
+
+/** Convert a number of core clock cycles to microseconds
+ *  @param cycles number of cycles
+ *  @return time in microseconds
+ */
+uint32_t timing_cycles_to_us(uint32_t cycles);
+
+/** Busy wait for a number of microseconds using the cycle counter
+ *  @param us time to wait in microseconds
+ */
+void timing_delay_us(uint32_t us);
+
+#endif /* INC_TIMING_H_ */
@@ -0,0 +1,70 @@
+/*
+**************************************************************************************************************
+* @file     trace.h
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Ring buffer trace of i2c and remote UWB operations
+**************************************************************************************************************
+*/
+
+#ifndef INC_TRACE_H_
+#define INC_TRACE_H_
+
+#include "main.h"
+
+/* Set to 0 to compile out the trace buffer */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+/* Number of records kept, must be a power of two */
+#define TRACE_LENGTH 64
+
+/* Byte received over the zigbee uart that requests a trace dump */
+#define TRACE_DUMP_COMMAND 'T'
+
+/* Operations that are traced */
+typedef enum {
+	TRACE_I2C_WRITE,			//register write to the master tag
+	TRACE_I2C_READ,				//register read from the master tag
+	TRACE_I2C_FUNCTION,			//function call on the master tag
+	TRACE_REMOTE_WRITE,			//register write to a remote tag over UWB
+	TRACE_REMOTE_READ,			//register read from a remote tag over UWB
+	TRACE_REMOTE_FUNCTION,		//function call on a remote tag over UWB
+	TRACE_POSITIONING			//a whole positioning cycle
+} traceType_t;
+
+/* A single traced operation */
+typedef struct _traceRecord {
+	uint32_t start;				//DWT cycle count at the start of the operation
+	uint32_t end;				//DWT cycle count at the end of the operation
+	uint16_t reg;				//register address
+	uint16_t size;				//number of bytes transferred
+	uint8_t type;				//traceType_t
+	int8_t status;				//HAL status or driver error code
+} traceRecord_t;
+
+/** Add a record to the trace buffer, overwriting the oldest record when full. Safe to call
+ *  from an interrupt
+ *  @param type the traced operation
+ *  @param reg register address
+ *  @param size number of bytes transferred
+ *  @param status HAL status or driver error code of the operation
+ *  @param start DWT cycle count at the start of the operation
+ */
+void trace_record(traceType_t type, uint16_t reg, uint16_t size, int status, uint32_t start);
+
+/** Discard every record in the trace buffer
+ */
+void trace_clear(void);
+
+/** Send the trace buffer through zigbee, oldest record first, one frame per record.
+ *  The first frame is "#tn<records> o<overwritten>", then each record is sent as
+ *  "#t<seq> <op><reg> n<size> s<status> a<start us> d<duration us>" where op is
+ *  w/r/f for the master tag, W/R/F for a remote tag and P for a positioning cycle.
+ *  The buffer is cleared once sent
+ *  @param huart pointer to uart handle
+ */
+void trace_dump(UART_HandleTypeDef *huart);
+
+#endif /* INC_TRACE_H_ */
@@ -14,6 +14,73 @@
 #include "registers.h"
 #include "pozyx.h"
 
+/* Longest a remote tag is given to answer WHO_AM_I after power up, and the time between tries, in ms */
+#define REMOTE_BOOT_TIMEOUT 2500
+#define REMOTE_READY_POLL 50
+
+/* Longest a remote tag is given to finish positioning and send back its position, in ms */
+#define REMOTE_POS_TIMEOUT 250
+
+/* Set to 1 to run the remote tag in continuous positioning, pushing each position to the master */
+#ifndef REMOTE_CONTINUOUS
+#define REMOTE_CONTINUOUS 0
+#endif
+
+/* Time between positions of a remote tag in continuous positioning, in ms */
+#define REMOTE_POS_INTERVAL 100
+
+/* Set to 1 to range the remote tag to each anchor and solve its position on the master controller,
+ * instead of the remote tag positioning itself */
+#ifndef REMOTE_RANGING
+#define REMOTE_RANGING 0
+#endif
+
+#if REMOTE_CONTINUOUS && REMOTE_RANGING
+#error "REMOTE_CONTINUOUS and REMOTE_RANGING cannot be used together"
+#endif
+
+/* Set to 1 to run the inertial sensors of the remote tag and carry the position of a moving crane on its
+ * accelerometer between positions */
+#ifndef REMOTE_IMU
+#define REMOTE_IMU 0
+#endif
+
+#if REMOTE_CONTINUOUS && REMOTE_IMU
+#error "REMOTE_CONTINUOUS and REMOTE_IMU cannot be used together"
+#endif
+
+/* Time between accelerometer samples of a moving crane in ms */
+#define REMOTE_IMU_PERIOD 50
+
+/* Sensor mode of the remote tag, accelerometer and gyroscope fused without the magnetometer, which the
+ * steel of the bay disturbs, or the sensors off */
+#define REMOTE_SENSORS_IMU 0x08
+#define REMOTE_SENSORS_MODE (REMOTE_IMU ? REMOTE_SENSORS_IMU : 0x00)
+
+/* LIA_X and LIA_Y, read together */
+#define ACCELERATION_BLOCK_SIZE (POZYX_LIA_Z - POZYX_LIA_X)
+
+/* Range a remote tag sends back once it has ranged, timestamp, distance and RSS */
+#define RANGE_INFO_SIZE 10
+
+/* Steps of a positioning request */
+typedef enum {
+	REQUEST_SENDING,			//positioning command on its way to the tag
+	REQUEST_BACKOFF,			//waiting to send the command again after it failed
+	REQUEST_POSITIONING,		//command acknowledged, the tag is positioning
+	REQUEST_FAILED				//command failed every attempt
+} requestStep_t;
+
+/* An outstanding positioning request to a remote tag */
+typedef struct _positioningRequest {
+	uint16_t networkAddr;		//network address of the tag
+	uint32_t requestTick;		//tick the positioning command was sent
+	uint32_t timeout;			//time the tag is given to send back its position in ms, 0 for REMOTE_POS_TIMEOUT
+	uint8_t pending;			//1 if the position has not been collected yet
+	requestStep_t step;
+	uint32_t retryTick;			//tick the command is sent again after a failure
+} positioningRequest_t;
+
 /** Remotely connect to a tag specified by the given network address and write to  a register at the given
  *  memory address
  *  @param hi2c pointer to i2c handle
@@ -43,10 +110,11 @@ int Remote_Read_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemA
  */
 int Remote_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint8_t *txData, uint16_t txSize);
 
-/** Read the Rx buffer on the pozyx master tag
+/** Wait for the RX_DATA interrupt of the pozyx master tag and read its Rx buffer
  *  @param hi2c pointer to a i2c handle
  *  @param rxData data buffer to store received data
  *  @param rxSize size of rxData
+ *  @return HAL_TIMEOUT if no data arrived within REMOTE_RX_TIMEOUT, otherwise HAL status of the read
  */
 HAL_StatusTypeDef Read_Rx_Buffer(I2C_HandleTypeDef *hi2c, uint8_t *rxData, uint16_t rxSize);
 
@@ -92,9 +160,10 @@ int Remote_Write_Reg_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_
 /** Initialise a remote tag for positioning
  *  @param hi2c pointer to a i2c handle
  *  @parm networkAddr the network address of the remote tag
+ *  @param bootTimeout time to wait for the tag to power up in ms, 0 to ask it only once
  *  @return < 0 for and error, other > 0
  */
-int remote_tag_init(I2C_HandleTypeDef *hi2c, uint16_t networkAddr);
+int remote_tag_init(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint32_t bootTimeout);
 
 /** Add an anchor to the internal list of a remote tag
  *  @param hi2c i2c handle
@@ -104,13 +173,113 @@ int remote_tag_init(I2C_HandleTypeDef *hi2c, uint16_t networkAddr);
  */
 int remote_add_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t device, uint16_t networkAddr);
 
-/** Position a remote tag given by the network address & save the positions to a given struct
+/** Ask a remote tag to position itself without waiting for the result, collect it with
+ *  remote_positioning_collect once remote_positioning_ready. No other remote operation should be sent
+ *  to the tag until then
  *  @param hi2c i2c handle
  *  @param networkAddr the network address of the tag
+ *  @param request struct to track the request
+ *  @return < 0 for an error, otherwise POSITIONS_REQUESTED
+ */
+int remote_positioning_request(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, positioningRequest_t *request);
+
+/** Advance an outstanding positioning request and check if it can be collected without blocking for
+ *  long, either the command failed every attempt, the pozyx has raised an interrupt after the command
+ *  was acknowledged or the request has timed out
+ *  @param request the outstanding request
+ *  @return 1 if ready to collect, otherwise 0
+ */
+uint8_t remote_positioning_ready(positioningRequest_t *request);
+
+/** Collect the position of an outstanding positioning request, waiting for the remote tag to send
+ *  it back for up to the request timeout
+ *  @param hi2c i2c handle
+ *  @param request the outstanding request
  *  @param coordinates position struct
- *  @return < 0 for an error, otherwise > 0
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time, may be NULL
+ *  @return POSITIONS_NOT_READY if the position did not arrive in time,
+ *  < 0 for an error, otherwise > 0
+ */
+int remote_positioning_collect(I2C_HandleTypeDef *hi2c, positioningRequest_t *request, coordinates_t *coordinates,
+							   covariance_t *covariance, telemetry_t *telemetry);
+
+/** Range a remote tag to an anchor
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param anchorID the network address of the anchor
+ *  @param range struct to store the distance and signal strength, the anchor position is left as it is
+ *  @return RANGING_ERROR if the tag did not send back its range in time, < 0 for another error,
+ *  otherwise GOOD_READ
+ */
+int remote_range(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t anchorID, rangeMeasurement_t *range);
+
+/** Read the linear acceleration of a remote tag, gravity removed, in the axes of the tag
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param acceleration x and y acceleration to fill in mg
+ *  @return < 0 for an error, otherwise GOOD_READ
+ */
+int remote_read_acceleration(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, int16_t acceleration[2]);
+
+/** Range a remote tag to the selected anchors one after the other and solve its position on the master
+ *  controller. No other remote operation should be sent to the tag until it returns
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param anchors the anchor table
+ *  @param anchorCount number of anchors in the table
+ *  @param anchorMask bit per entry of the anchor table to range to
+ *  @param coordinates the previous position to start the solve from, set to the solved position
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time and ranges used, may be NULL
+ *  @return RANGING_ERROR if too few ranges succeeded to solve a position, otherwise POSITIONS_RETRIEVED
+ */
+int remote_ranging_position(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const deviceCoords_t *anchors,
+		uint8_t anchorCount, uint32_t anchorMask, coordinates_t *coordinates, covariance_t *covariance,
+		telemetry_t *telemetry);
+
+/** Put a remote tag into continuous positioning, after which it sends each new position to the
+ *  master tag by itself. No other remote operation should be sent to the tag until it is stopped
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param interval time between positions in ms
+ *  @param request struct to track the positions, pending while the tag is positioning
+ *  @return < 0 for an error, otherwise POSITIONS_REQUESTED
+ */
+int remote_continuous_start(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t interval,
+							positioningRequest_t *request);
+
+/** Take a remote tag out of continuous positioning
+ *  @param hi2c i2c handle
+ *  @param request the request returned by remote_continuous_start
+ *  @return < 0 for an error, otherwise TRANSMITTED_MESSAGE
+ */
+int remote_continuous_stop(I2C_HandleTypeDef *hi2c, positioningRequest_t *request);
+
+/** Drain a position sent by a remote tag in continuous positioning. Does not block, call it when
+ *  the pozyx has raised an interrupt
+ *  @param hi2c i2c handle
+ *  @param request the request returned by remote_continuous_start
+ *  @param coordinates position struct
+ *  @param telemetry struct to store the time since the last position, may be NULL
+ *  @return POSITIONS_NOT_READY if no new position has arrived, < 0 for an error, otherwise POSITIONS_RETRIEVED
+ */
+int remote_continuous_collect(I2C_HandleTypeDef *hi2c, positioningRequest_t *request, coordinates_t *coordinates,
+							  telemetry_t *telemetry);
+
+/** Position a remote tag given by the network address & save the positions to a given struct.
+ *  The remote tag sends its position back as soon as it is done, which is picked up from the
+ *  RX_DATA interrupt
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param coordinates position struct
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time, may be NULL
+ *  @return POSITIONS_NOT_READY if the position did not arrive within REMOTE_POS_TIMEOUT,
+ *  < 0 for an error, otherwise > 0
  */
-int remote_positioning(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates);
+int remote_positioning(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates,
+					   covariance_t *covariance, telemetry_t *telemetry);
 
 /** Perform a remote calibration on the remote tag specified by the network address
  *  anchorIDs provide the relevant anchor IDs to calibrate.
@@ -131,10 +300,41 @@ int remote_calibration(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, calibratio
  */
 int remote_flash_register(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddr);
 
+/** Save several writable registers on a remote tag in non-volatile flash memory in a single
+ *  flash operation
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param regs the memory addresses of the registers to save in flash
+ *  @param regCount number of registers in regs
+ */
+int remote_flash_registers(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint8_t *regs, uint8_t regCount);
+
 /** Save the device list on a remote tag in non-volatile flash memory
  *  @param hi2c pointer to i2c handle
  *  @param networkAddr the network address of the remote tag
  */
 int remote_save_device_list(I2C_HandleTypeDef *hi2c, uint16_t networkAddr);
 
+/** Make sure the device list of a remote tag holds the given devices. The stored list is read
+ *  back and left as it is if it already matches, otherwise it is cleared, the devices are added
+ *  and the list is flashed into remote tag memory
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return DEVICES_MATCHED if the list was kept, DEVICE_ADDED if it was rebuilt, < 0 for an error
+ */
+int remote_provision_devices(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const deviceCoords_t *devices,
+							 uint8_t deviceCount);
+
+/** Select the anchors a remote tag positions with out of its device list, switching the tag to
+ *  manual anchor selection
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param anchorIDs network ids of the anchors, each must be in the device list of the tag
+ *  @param anchorCount number of anchors
+ *  @return < 0 for an error, otherwise TRANSMITTED_MESSAGE
+ */
+int remote_set_anchor_ids(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t *anchorIDs, uint8_t anchorCount);
+
 #endif /* INC_WIRELESS_H_ */
@@ -13,13 +13,26 @@
 #include "main.h"
 #include "math.h"
 
+/* Largest text frame sent to the host including its terminator, excluding the zigbee header. A position
+ * frame with every telemetry token at its widest is 107 characters with its line ending */
+#define ZIGBEE_MAX_FRAME 112
+
+/* Starts every frame that is not a crane position, such as statistics and events, so the host does not
+ * store it as a position */
+#define ZIGBEE_STATUS_PREFIX "#"
+
+/* Extra time allowed for a uart transmit on top of the time on the wire, in ms */
+#define ZIGBEE_TX_MARGIN 5
+
 /** Send the given positions, mass and ID of the crane through the zigbee modules
  *  @param huart pointer to uart handle
  *  @param positions struct holding (x, y) positions of crane
  *  @param mass raw adc value of crane load gauge
  *  @param craneID id of crane
+ *  @param telemetry telemetry appended to the frame, may be NULL
  */
-void zigbee_send_data(UART_HandleTypeDef *huart, coordinates_t positions, uint32_t mass, uint8_t craneID);
+void zigbee_send_data(UART_HandleTypeDef *huart, coordinates_t positions, uint32_t mass, uint8_t craneID,
+					  telemetry_t *telemetry);
 
 /** Send through a set data buffer through zigbee
  *  @param huart pointer to uart handlee
@@ -0,0 +1,187 @@
+/*
+**************************************************************************************************************
+* @file     anchors.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Precomputed grid mapping a position to the anchors a tag should position with
+**************************************************************************************************************
+*/
+
+#include "anchors.h"
+
+/** Select the anchors nearest a point in the horizontal plane
+ *  @param grid pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return bit per entry of the anchor table
+ */
+static uint32_t Nearest_Anchors(anchorGrid_t *grid, int32_t posX, int32_t posY) {
+	int64_t distance[ANCHOR_TABLE_MAX];
+	uint32_t mask = 0;
+	uint8_t count = (grid->anchorCount < ANCHORS_PER_ZONE) ? grid->anchorCount : ANCHORS_PER_ZONE;
+
+	for (uint8_t i = 0; i < grid->anchorCount; i++) {
+		int64_t dx = grid->anchors[i].posX - posX;
+		int64_t dy = grid->anchors[i].posY - posY;
+		distance[i] = (dx * dx) + (dy * dy);
+	}
+
+	//Repeatedly take the nearest anchor not yet selected, ties go to the first in the table
+	for (uint8_t n = 0; n < count; n++) {
+		int8_t nearest = -1;
+		for (uint8_t i = 0; i < grid->anchorCount; i++) {
+			if ((mask & (1UL << i)) || ((nearest >= 0) && (distance[i] >= distance[nearest]))) {
+				continue;
+			}
+			nearest = i;
+		}
+		mask |= (1UL << nearest);
+	}
+
+	return mask;
+}
+
+/** Get the cell index of a position, positions beyond the grid map to the nearest edge cell
+ *  @param grid pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return cell index
+ */
+static uint16_t Cell_Index(anchorGrid_t *grid, int32_t posX, int32_t posY) {
+	int32_t column = (posX - grid->originX) / (int32_t) grid->cellSize;
+	int32_t row = (posY - grid->originY) / (int32_t) grid->cellSize;
+
+	if (posX < grid->originX) {
+		column = 0;
+	} else if (column >= grid->columns) {
+		column = grid->columns - 1;
+	}
+	if (posY < grid->originY) {
+		row = 0;
+	} else if (row >= grid->rows) {
+		row = grid->rows - 1;
+	}
+
+	return (row * grid->columns) + column;
+}
+
+/** Build the grid from an anchor table. The grid covers the anchors, positions beyond them map to
+ *  the nearest edge cell
+ *  @param grid pointer to grid
+ *  @param anchors the anchor table, must stay valid while the grid is used
+ *  @param anchorCount number of anchors in the table
+ *  @return ANCHOR_TABLE_ERROR if the table is empty, too long or has too many distinct subsets,
+ *  otherwise GOOD_INIT
+ */
+int anchor_grid_build(anchorGrid_t *grid, const deviceCoords_t *anchors, uint8_t anchorCount) {
+	memset(grid, '\0', sizeof (anchorGrid_t));
+
+	if ((anchorCount == 0) || (anchorCount > ANCHOR_TABLE_MAX)) {
+		return ANCHOR_TABLE_ERROR;
+	}
+
+	grid->anchors = anchors;
+	grid->anchorCount = anchorCount;
+
+	//Bounding box of the anchors
+	int32_t minX = anchors[0].posX, maxX = anchors[0].posX;
+	int32_t minY = anchors[0].posY, maxY = anchors[0].posY;
+	for (uint8_t i = 1; i < anchorCount; i++) {
+		minX = (anchors[i].posX < minX) ? anchors[i].posX : minX;
+		maxX = (anchors[i].posX > maxX) ? anchors[i].posX : maxX;
+		minY = (anchors[i].posY < minY) ? anchors[i].posY : minY;
+		maxY = (anchors[i].posY > maxY) ? anchors[i].posY : maxY;
+	}
+
+	grid->originX = minX;
+	grid->originY = minY;
+	grid->cellSize = ANCHOR_CELL_SIZE;
+	do {
+		grid->columns = ((maxX - minX) / grid->cellSize) + 1;
+		grid->rows = ((maxY - minY) / grid->cellSize) + 1;
+		if (((uint32_t) grid->columns * grid->rows) <= ANCHOR_GRID_CELLS) {
+			break;
+		}
+		grid->cellSize *= 2;
+	} while (1);
+
+	//Find the nearest anchors to the centre of each cell, cells with the same anchors share a zone
+	for (uint16_t row = 0; row < grid->rows; row++) {
+		for (uint16_t column = 0; column < grid->columns; column++) {
+			uint32_t mask = Nearest_Anchors(grid, grid->originX + (column * grid->cellSize) + (grid->cellSize / 2),
+					grid->originY + (row * grid->cellSize) + (grid->cellSize / 2));
+
+			uint8_t zone;
+			for (zone = 0; zone < grid->zoneCount; zone++) {
+				if (grid->zones[zone] == mask) {
+					break;
+				}
+			}
+			if (zone == grid->zoneCount) {
+				if (grid->zoneCount >= ANCHOR_MAX_ZONES) {
+					grid->zoneCount = 0;
+					return ANCHOR_TABLE_ERROR;
+				}
+				grid->zones[grid->zoneCount++] = mask;
+			}
+
+			grid->cells[(row * grid->columns) + column] = zone;
+		}
+	}
+
+	return GOOD_INIT;
+}
+
+/** Get the zone of a position
+ *  @param grid pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return the zone, ANCHOR_ZONE_NONE if the grid has not been built
+ */
+uint8_t anchor_grid_zone(anchorGrid_t *grid, int32_t posX, int32_t posY) {
+	if (grid->zoneCount == 0) {
+		return ANCHOR_ZONE_NONE;
+	}
+
+	return grid->cells[Cell_Index(grid, posX, posY)];
+}
+
+/** Get the zone of a position, staying in the current zone while it still holds a point within
+ *  the hysteresis distance along x or y, so a crane parked on a zone boundary does not switch back and forth
+ *  @param grid pointer to grid
+ *  @param zone the current zone
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @param hysteresis distance past a boundary before leaving a zone, in mm
+ *  @return the zone
+ */
+uint8_t anchor_grid_select(anchorGrid_t *grid, uint8_t zone, int32_t posX, int32_t posY, uint32_t hysteresis) {
+	uint8_t newZone = anchor_grid_zone(grid, posX, posY);
+	int32_t distance = hysteresis;
+
+	if ((newZone == zone) || (zone >= grid->zoneCount)) {
+		return newZone;
+	}
+
+	if ((anchor_grid_zone(grid, posX - distance, posY) == zone) ||
+			(anchor_grid_zone(grid, posX + distance, posY) == zone) ||
+			(anchor_grid_zone(grid, posX, posY - distance) == zone) ||
+			(anchor_grid_zone(grid, posX, posY + distance) == zone)) {
+		return zone;
+	}
+
+	return newZone;
+}
+
+/** Get the anchors of a zone
+ *  @param grid pointer to grid
+ *  @param zone the zone
+ *  @return bit per entry of the anchor table, 0 for ANCHOR_ZONE_NONE
+ */
+uint32_t anchor_grid_mask(anchorGrid_t *grid, uint8_t zone) {
+	if (zone >= grid->zoneCount) {
+		return 0;
+	}
+
+	return grid->zones[zone];
+}
@@ -0,0 +1,44 @@
+/*
+**************************************************************************************************************
+* @file     crc.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Checksums of stored configuration
+**************************************************************************************************************
+*/
+
+#include "crc.h"
+
+/** Update a CRC-16/CCITT with a data buffer, start with CRC16_INIT
+ *  @param crc the CRC so far
+ *  @param data pointer to data buffer
+ *  @param size size of data buffer
+ *  @return the updated CRC
+ */
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t size) {
+	for (uint16_t i = 0; i < size; i++) {
+		crc ^= (uint16_t) data[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+/** Update a CRC-32 (IEEE 802.3, reflected) with a data buffer, start with CRC32_INIT and invert the result
+ *  @param crc the CRC so far
+ *  @param data pointer to data buffer
+ *  @param size size of data buffer
+ *  @return the updated CRC
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t size) {
+	for (uint32_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+		}
+	}
+
+	return crc;
+}
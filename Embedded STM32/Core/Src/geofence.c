@@ -0,0 +1,207 @@
+/*
+**************************************************************************************************************
+* @file     geofence.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Polygon zones of the bay, precomputed into a grid so a position is placed with one lookup
+**************************************************************************************************************
+*/
+
+#include "geofence.h"
+
+/** Check if a point is inside a zone, by counting the edges crossed by a ray along +x
+ *  @param zone the zone
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return 1 if inside, otherwise 0
+ */
+static uint8_t Point_In_Zone(const geofenceZone_t *zone, int32_t posX, int32_t posY) {
+	uint8_t inside = 0;
+
+	for (uint8_t i = 0, j = zone->vertexCount - 1; i < zone->vertexCount; j = i++) {
+		const geofenceVertex_t *a = &zone->vertices[i];
+		const geofenceVertex_t *b = &zone->vertices[j];
+		if ((a->posY > posY) == (b->posY > posY)) {
+			continue;
+		}
+
+		//Left of the point where the edge crosses the ray, compared without dividing
+		int64_t left = (int64_t) (posX - a->posX) * (b->posY - a->posY);
+		int64_t right = (int64_t) (posY - a->posY) * (b->posX - a->posX);
+		if ((b->posY > a->posY) ? (left < right) : (left > right)) {
+			inside ^= 1;
+		}
+	}
+
+	return inside;
+}
+
+/** Check if an edge of a zone passes through a rectangle, separating axis test of the segment and the rectangle
+ *  @param a first end of the edge
+ *  @param b second end of the edge
+ *  @param minX corner of the rectangle in mm
+ *  @param minY
+ *  @param maxX opposite corner of the rectangle in mm
+ *  @param maxY
+ *  @return 1 if the edge touches the rectangle, otherwise 0
+ */
+static uint8_t Edge_Crosses_Cell(const geofenceVertex_t *a, const geofenceVertex_t *b, int32_t minX, int32_t minY,
+		int32_t maxX, int32_t maxY) {
+	if (((a->posX < minX) && (b->posX < minX)) || ((a->posX > maxX) && (b->posX > maxX)) ||
+			((a->posY < minY) && (b->posY < minY)) || ((a->posY > maxY) && (b->posY > maxY))) {
+		return 0;
+	}
+
+	//The edge misses the rectangle if every corner lies on the same side of its line
+	const int32_t cornerX[4] = { minX, maxX, minX, maxX };
+	const int32_t cornerY[4] = { minY, minY, maxY, maxY };
+	uint8_t above = 0, below = 0;
+	for (uint8_t i = 0; i < 4; i++) {
+		int64_t side = ((int64_t) (b->posX - a->posX) * (cornerY[i] - a->posY)) -
+				((int64_t) (b->posY - a->posY) * (cornerX[i] - a->posX));
+		above |= (side >= 0);
+		below |= (side <= 0);
+	}
+
+	return (above && below);
+}
+
+/** Build the grid from a zone table. Positions beyond the corners of the zones are in no zone
+ *  @param geofence pointer to grid
+ *  @param zones the zone table, must stay valid while the grid is used
+ *  @param zoneCount number of zones in the table, may be 0
+ *  @return GEOFENCE_ERROR if the table is too long or a zone has too few or too many vertices,
+ *  otherwise GOOD_INIT
+ */
+int geofence_build(geofence_t *geofence, const geofenceZone_t *zones, uint8_t zoneCount) {
+	memset(geofence, '\0', sizeof (geofence_t));
+
+	if (zoneCount > GEOFENCE_MAX_ZONES) {
+		return GEOFENCE_ERROR;
+	}
+	for (uint8_t zone = 0; zone < zoneCount; zone++) {
+		if ((zones[zone].vertexCount < 3) || (zones[zone].vertexCount > GEOFENCE_MAX_VERTICES)) {
+			return GEOFENCE_ERROR;
+		}
+	}
+	if (zoneCount == 0) {
+		return GOOD_INIT;
+	}
+
+	//Bounding box of the zones
+	int32_t minX = zones[0].vertices[0].posX, maxX = minX;
+	int32_t minY = zones[0].vertices[0].posY, maxY = minY;
+	for (uint8_t zone = 0; zone < zoneCount; zone++) {
+		for (uint8_t i = 0; i < zones[zone].vertexCount; i++) {
+			const geofenceVertex_t *vertex = &zones[zone].vertices[i];
+			minX = (vertex->posX < minX) ? vertex->posX : minX;
+			maxX = (vertex->posX > maxX) ? vertex->posX : maxX;
+			minY = (vertex->posY < minY) ? vertex->posY : minY;
+			maxY = (vertex->posY > maxY) ? vertex->posY : maxY;
+		}
+	}
+
+	geofence->originX = minX;
+	geofence->originY = minY;
+	geofence->limitX = maxX;
+	geofence->limitY = maxY;
+	geofence->cellSize = GEOFENCE_CELL_SIZE;
+	do {
+		geofence->columns = ((maxX - minX) / geofence->cellSize) + 1;
+		geofence->rows = ((maxY - minY) / geofence->cellSize) + 1;
+		if (((uint32_t) geofence->columns * geofence->rows) <= GEOFENCE_GRID_CELLS) {
+			break;
+		}
+		geofence->cellSize *= 2;
+	} while (1);
+
+	//A cell no boundary crosses is wholly inside or outside each zone, decided once at its centre
+	for (uint16_t row = 0; row < geofence->rows; row++) {
+		for (uint16_t column = 0; column < geofence->columns; column++) {
+			geofenceCell_t *cell = &geofence->cells[(row * geofence->columns) + column];
+			int32_t cellX = geofence->originX + (column * geofence->cellSize);
+			int32_t cellY = geofence->originY + (row * geofence->cellSize);
+
+			for (uint8_t zone = 0; zone < zoneCount; zone++) {
+				const geofenceZone_t *polygon = &zones[zone];
+				uint8_t crosses = 0;
+				for (uint8_t i = 0, j = polygon->vertexCount - 1; (i < polygon->vertexCount) && !crosses; j = i++) {
+					crosses = Edge_Crosses_Cell(&polygon->vertices[i], &polygon->vertices[j], cellX, cellY,
+							cellX + geofence->cellSize, cellY + geofence->cellSize);
+				}
+
+				if (crosses) {
+					cell->edges |= (1 << zone);
+				} else if (Point_In_Zone(polygon, cellX + (geofence->cellSize / 2), cellY + (geofence->cellSize / 2))) {
+					cell->inside |= (1 << zone);
+				}
+			}
+		}
+	}
+
+	geofence->zones = zones;
+	geofence->zoneCount = zoneCount;
+
+	return GOOD_INIT;
+}
+
+/** Get the zones a position is in, with one cell lookup and a test against each zone whose boundary
+ *  crosses the cell
+ *  @param geofence pointer to grid
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return bit per zone
+ */
+uint8_t geofence_lookup(geofence_t *geofence, int32_t posX, int32_t posY) {
+	if ((geofence->zoneCount == 0) || (posX < geofence->originX) || (posX > geofence->limitX) ||
+			(posY < geofence->originY) || (posY > geofence->limitY)) {
+		return 0;
+	}
+
+	uint16_t column = (posX - geofence->originX) / geofence->cellSize;
+	uint16_t row = (posY - geofence->originY) / geofence->cellSize;
+	geofenceCell_t *cell = &geofence->cells[(row * geofence->columns) + column];
+
+	uint8_t mask = cell->inside;
+	for (uint8_t zone = 0; cell->edges >> zone; zone++) {
+		if ((cell->edges & (1 << zone)) && Point_In_Zone(&geofence->zones[zone], posX, posY)) {
+			mask |= (1 << zone);
+		}
+	}
+
+	return mask;
+}
+
+/** Place a crane at its latest position and get the zones it has entered or left, once the change
+ *  has been seen in GEOFENCE_CONFIRM consecutive positions
+ *  @param geofence pointer to grid
+ *  @param state zones the crane is in, zeroed before the first position
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @return bit per zone entered or left, the bits set in state->inside were entered
+ */
+uint8_t geofence_update(geofence_t *geofence, geofenceState_t *state, int32_t posX, int32_t posY) {
+	uint8_t mask = geofence_lookup(geofence, posX, posY);
+
+	if (mask == state->inside) {
+		state->count = 0;
+		return 0;
+	}
+
+	//A position flickering across a boundary must settle before the change is reported
+	if ((state->count == 0) || (mask != state->pending)) {
+		state->pending = mask;
+		state->count = 1;
+	} else {
+		state->count++;
+	}
+	if (state->count < GEOFENCE_CONFIRM) {
+		return 0;
+	}
+
+	uint8_t changed = mask ^ state->inside;
+	state->inside = mask;
+	state->count = 0;
+
+	return changed;
+}
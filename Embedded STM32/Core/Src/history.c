@@ -0,0 +1,227 @@
+/*
+**************************************************************************************************************
+* @file     history.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Ring buffer of the recent positions of a crane, one per interval, with running statistics
+**************************************************************************************************************
+*/
+
+#include "history.h"
+
+/* Index of each tracked extreme in history_t.extremes, and the axis and direction it tracks */
+#define EXTREME_MIN_X 0
+#define EXTREME_MAX_X 1
+#define EXTREME_MIN_Y 2
+#define EXTREME_MAX_Y 3
+
+/** Get the value an extreme tracks for a position, negated for a minimum so every extreme is a maximum
+ *  @param history pointer to history
+ *  @param extreme index of the extreme
+ *  @param seq sequence number of the position
+ *  @return the value
+ */
+static int32_t Extreme_Value(history_t *history, uint8_t extreme, uint16_t seq) {
+	historyEntry_t *entry = &history->entries[seq & HISTORY_MASK];
+	int32_t value = (extreme < EXTREME_MIN_Y) ? entry->posX : entry->posY;
+
+	return (extreme & 1) ? value : -value;
+}
+
+/** Get the value of the extreme over the window
+ *  @param history pointer to history
+ *  @param extreme index of the extreme
+ *  @return the value, negated for a minimum
+ */
+static int32_t Extreme_Front(history_t *history, uint8_t extreme) {
+	historyExtreme_t *window = &history->extremes[extreme];
+
+	return Extreme_Value(history, extreme, window->seq[window->first]);
+}
+
+/** Add a position to an extreme, dropping the positions it can never be beaten by
+ *  @param history pointer to history
+ *  @param extreme index of the extreme
+ *  @param seq sequence number of the position, already stored in the history
+ */
+static void Extreme_Push(history_t *history, uint8_t extreme, uint16_t seq) {
+	historyExtreme_t *window = &history->extremes[extreme];
+	int32_t value = Extreme_Value(history, extreme, seq);
+
+	//Older positions no larger than the new one leave the window before it, so can never be the extreme
+	while ((window->count > 0) &&
+			(Extreme_Value(history, extreme, window->seq[(window->first + window->count - 1) & HISTORY_MASK]) <= value)) {
+		window->count--;
+	}
+
+	window->seq[(window->first + window->count) & HISTORY_MASK] = seq;
+	window->count++;
+}
+
+/** Remove a position leaving the window from an extreme
+ *  @param history pointer to history
+ *  @param extreme index of the extreme
+ *  @param seq sequence number of the position leaving
+ */
+static void Extreme_Expire(history_t *history, uint8_t extreme, uint16_t seq) {
+	historyExtreme_t *window = &history->extremes[extreme];
+
+	if ((window->count > 0) && (window->seq[window->first] == seq)) {
+		window->first = (window->first + 1) & HISTORY_MASK;
+		window->count--;
+	}
+}
+
+/** Empty the history
+ *  @param history pointer to history
+ */
+void history_init(history_t *history) {
+	memset(history, '\0', sizeof (history_t));
+}
+
+/** Add an entry to the window, replacing the oldest once the window is full. Constant time, amortised
+ *  for the bounds
+ *  @param history pointer to history
+ *  @param posX x position of the entry in mm
+ *  @param posY y position of the entry in mm
+ */
+static void History_Push(history_t *history, int32_t posX, int32_t posY) {
+	historyEntry_t *entry = &history->entries[history->seq & HISTORY_MASK];
+
+	//The entry about to be overwritten is the oldest position, take it out of the statistics
+	if (history->count == HISTORY_SIZE) {
+		uint16_t oldest = history->seq - HISTORY_SIZE;
+		history->sumX -= entry->posX;
+		history->sumY -= entry->posY;
+		history->sumXX -= (int64_t) entry->posX * entry->posX;
+		history->sumYY -= (int64_t) entry->posY * entry->posY;
+		for (uint8_t i = 0; i < 4; i++) {
+			Extreme_Expire(history, i, oldest);
+		}
+	} else {
+		history->count++;
+	}
+
+	entry->posX = posX;
+	entry->posY = posY;
+	history->sumX += entry->posX;
+	history->sumY += entry->posY;
+	history->sumXX += (int64_t) entry->posX * entry->posX;
+	history->sumYY += (int64_t) entry->posY * entry->posY;
+	for (uint8_t i = 0; i < 4; i++) {
+		Extreme_Push(history, i, history->seq);
+	}
+
+	history->seq++;
+}
+
+/** Add a position to the interval it falls in. The mean of an interval enters the window once a position
+ *  falls in a later one, replacing the oldest entry once the window is full. A window with no position
+ *  for all of HISTORY_SECONDS is emptied
+ *  @param history pointer to history
+ *  @param position the position
+ *  @param tick tick the position was taken
+ */
+void history_add(history_t *history, const coordinates_t *position, uint32_t tick) {
+	uint32_t bucket = tick / HISTORY_BUCKET_MS;
+
+	if ((history->bucketCount > 0) && (bucket != history->bucket)) {
+		uint32_t elapsed = bucket - history->bucket;
+
+		if (elapsed > HISTORY_SIZE) {
+			//Nothing in the window is recent any more
+			history_init(history);
+		} else {
+			int32_t meanX = history->bucketX / history->bucketCount;
+			int32_t meanY = history->bucketY / history->bucketCount;
+
+			//The closed interval, held over the intervals without a position since
+			for (uint32_t i = 0; i < elapsed; i++) {
+				History_Push(history, meanX, meanY);
+			}
+		}
+
+		history->bucketX = 0;
+		history->bucketY = 0;
+		history->bucketCount = 0;
+	}
+
+	history->bucket = bucket;
+	history->bucketX += position->posX;
+	history->bucketY += position->posY;
+	history->bucketCount++;
+}
+
+/** Get the mean position of the window
+ *  @param history pointer to history
+ *  @param mean struct to store the mean, posZ is left as it is
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_mean(history_t *history, coordinates_t *mean) {
+	if (history->count == 0) {
+		return 0;
+	}
+
+	mean->posX = history->sumX / history->count;
+	mean->posY = history->sumY / history->count;
+
+	return 1;
+}
+
+/** Get the variance of the positions in the window along each axis
+ *  @param history pointer to history
+ *  @param varX x variance in mm^2
+ *  @param varY y variance in mm^2
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_variance(history_t *history, uint32_t *varX, uint32_t *varY) {
+	if (history->count == 0) {
+		return 0;
+	}
+
+	//n * sum(x^2) - sum(x)^2 is exact in 64 bits for a bay of any realistic size
+	int64_t n = history->count;
+	int64_t spreadX = (n * history->sumXX) - (history->sumX * history->sumX);
+	int64_t spreadY = (n * history->sumYY) - (history->sumY * history->sumY);
+	uint64_t valueX = spreadX / (n * n);
+	uint64_t valueY = spreadY / (n * n);
+
+	*varX = (valueX > UINT32_MAX) ? UINT32_MAX : valueX;
+	*varY = (valueY > UINT32_MAX) ? UINT32_MAX : valueY;
+
+	return 1;
+}
+
+/** Get the bounding box of the positions in the window
+ *  @param history pointer to history
+ *  @param min struct to store the lower corner, posZ is left as it is
+ *  @param max struct to store the upper corner, posZ is left as it is
+ *  @return 0 if the history is empty, otherwise 1
+ */
+uint8_t history_bounds(history_t *history, coordinates_t *min, coordinates_t *max) {
+	if (history->count == 0) {
+		return 0;
+	}
+
+	min->posX = -Extreme_Front(history, EXTREME_MIN_X);
+	max->posX = Extreme_Front(history, EXTREME_MAX_X);
+	min->posY = -Extreme_Front(history, EXTREME_MIN_Y);
+	max->posY = Extreme_Front(history, EXTREME_MAX_Y);
+
+	return 1;
+}
+
+/** Check if the crane has stayed put over the whole window of HISTORY_SECONDS
+ *  @param history pointer to history
+ *  @param span largest side of the bounding box of a crane that has not moved, in mm
+ *  @return 1 if the window is full and its positions fit in the span, otherwise 0
+ */
+uint8_t history_still(history_t *history, uint32_t span) {
+	coordinates_t min, max;
+
+	if ((history->count < HISTORY_SIZE) || !history_bounds(history, &min, &max)) {
+		return 0;
+	}
+
+	return (((uint32_t) (max.posX - min.posX) < span) && ((uint32_t) (max.posY - min.posY) < span));
+}
@@ -9,65 +9,701 @@
 
 #include "i2c.h"
 
-/** Send an I2C function call to the pozyx master tag
- *  Function will send an I2C containing the slave address, memory address and
- *  given function parameters (txData).
- *  It will then sequentially send a read request.
- *  @param hi2c the i2c handle
+/* State of the i2c transaction queue */
+typedef struct _i2cQueue {
+	i2cTransaction_t *pending[I2C_QUEUE_LENGTH];		//chains waiting for the bus
+	uint8_t pendingHead;
+	uint8_t pendingCount;
+	i2cTransaction_t *completed[I2C_QUEUE_LENGTH];	//chains waiting for their callback
+	uint8_t completedHead;
+	uint8_t completedCount;
+	i2cTransaction_t *chain;		//chain currently being executed
+	i2cTransaction_t *active;		//transaction of the chain to run next, NULL if idle
+	uint8_t onBus;					//1 if a DMA transfer is in flight
+	uint8_t polling;				//1 if the pozyx has NACKed the active transaction
+	uint32_t readyTick;				//tick of the first NACK of the active transaction
+	uint32_t readyCycles;			//cycle count of the first NACK of the active transaction
+	I2C_HandleTypeDef *hi2c;		//handle of the last submitted chain, used for bus recovery
+	volatile uint8_t recover;		//1 if the bus must be recovered before the next transaction
+} i2cQueue_t;
+
+static i2cQueue_t i2cQueue;
+
+/* I2C bus characteristics of a speed profile (UM10204), all times in ns */
+typedef struct _i2cSpeedSpec {
+	uint32_t frequency;		//nominal SCL frequency in Hz
+	uint32_t lowMin;		//minimum SCL low period
+	uint32_t highMin;		//minimum SCL high period
+	uint32_t riseMax;		//maximum rise time
+	uint32_t fallMax;		//maximum fall time
+	uint32_t setupMin;		//minimum data setup time
+	uint32_t holdMin;		//minimum data hold time
+	const char *name;
+} i2cSpeedSpec_t;
+
+static const i2cSpeedSpec_t i2cSpeedSpecs[I2C_SPEED_COUNT] = {
+	{ 100000, 4700, 4000, 1000, 300, 250, 0, "SM" },
+	{ 400000, 1300, 600, 300, 300, 100, 0, "FM" },
+	{ 1000000, 500, 260, 120, 120, 50, 0, "FM+" }
+};
+
+#define I2C_ANALOG_FILTER_MIN 50		//minimum analog filter delay in ns
+#define I2C_ANALOG_FILTER_MAX 260		//maximum analog filter delay in ns
+
+static i2cSpeedProfile_t i2cSpeed = I2C_SPEED_STANDARD;
+static uint32_t i2cFrequency = 100000;
+
+static i2cBusHealth_t i2cBusHealth;
+
+#if I2C_WAIT_STATS
+static i2cWaitStats_t i2cWaitStats;
+#endif
+
+/** The pozyx has accepted the active transaction, stop polling it for readiness
+ */
+static void i2c_ready(void) {
+
+	if (i2cQueue.polling) {
+#if I2C_WAIT_STATS
+		i2cWaitStats.readyCycles += timing_cycles() - i2cQueue.readyCycles;
+#endif
+		i2cQueue.polling = 0;
+	}
+}
+
+/** Make a transaction the active transaction of the queue and start its deadline
+ *  @param transaction pointer to transaction
+ */
+static void i2c_activate(i2cTransaction_t *transaction) {
+
+	i2cQueue.active = transaction;
+	transaction->startTick = HAL_GetTick();
+	transaction->startCycles = timing_cycles();
+	if (transaction->timeout == 0) {
+		transaction->timeout = I2C_TRANSACTION_TIMEOUT;
+	}
+}
+
+/** Start the DMA transfer for the current phase of a transaction
+ *  @param transaction pointer to transaction
+ *  @return HAL status of the transfer request
+ */
+static HAL_StatusTypeDef i2c_issue(i2cTransaction_t *transaction) {
+
+	switch (transaction->operation) {
+		case I2C_OP_WRITE_REG:
+			return HAL_I2C_Mem_Write_DMA(transaction->hi2c, transaction->devAddress << 1,
+					transaction->memAddress, I2C_MEMADD_SIZE_8BIT, transaction->txData, transaction->txSize);
+
+		case I2C_OP_READ_REG:
+			return HAL_I2C_Mem_Read_DMA(transaction->hi2c, transaction->devAddress << 1,
+					transaction->memAddress, I2C_MEMADD_SIZE_8BIT, transaction->rxData, transaction->rxSize);
+
+		case I2C_OP_FUNCTION_CALL:
+			if (transaction->phase == 0) {
+				//Sequentially transmit the mem address and function parameters
+				return HAL_I2C_Master_Seq_Transmit_DMA(transaction->hi2c, transaction->devAddress << 1,
+						transaction->txData, transaction->txSize, I2C_FIRST_FRAME);
+			}
+			//Sequentially read the data from the pozyx device
+			return HAL_I2C_Master_Seq_Receive_DMA(transaction->hi2c, transaction->devAddress << 1,
+					transaction->rxData, transaction->rxSize, I2C_LAST_FRAME);
+
+		default:
+			return HAL_ERROR;
+	}
+}
+
+/** Mark a transaction as done and move the queue on to the next transaction in the chain.
+ *  If the transaction failed the rest of the chain is aborted. Must be called from an interrupt
+ *  or with interrupts disabled
+ *  @param transaction pointer to transaction
+ *  @param status HAL status of the transfer
+ */
+static void i2c_finish(i2cTransaction_t *transaction, HAL_StatusTypeDef status) {
+	i2cTransaction_t *chain = i2cQueue.chain;
+
+	i2cQueue.onBus = 0;
+	i2c_ready();
+
+#if I2C_WAIT_STATS
+	i2cWaitStats.transactions++;
+#endif
+
+	//A function call that returns 0 has failed on the pozyx
+	if ((status == HAL_OK) && transaction->checkResult && (transaction->rxSize > 0) &&
+			(transaction->rxData[0] == POZYX_FAILURE)) {
+		status = HAL_ERROR;
+	}
+
+	if ((status == HAL_OK) && (transaction->next != NULL)) {
+		i2c_activate(transaction->next);
+	} else {
+		i2cQueue.active = NULL;
+		i2cQueue.chain = NULL;
+
+		//Hand the chain over to the main loop for its callback
+		if ((chain->callback != NULL) && (i2cQueue.completedCount < I2C_QUEUE_LENGTH)) {
+			i2cQueue.completed[(i2cQueue.completedHead + i2cQueue.completedCount) % I2C_QUEUE_LENGTH] = chain;
+			i2cQueue.completedCount++;
+		}
+	}
+
+	transaction->status = status;
+	transaction->state = I2C_TRANSACTION_DONE;
+
+	trace_record((traceType_t) (TRACE_I2C_WRITE + transaction->operation), transaction->memAddress,
+			(transaction->operation == I2C_OP_WRITE_REG) ? transaction->txSize : transaction->rxSize,
+			status, transaction->startCycles);
+
+	//Abort the remainder of the chain
+	if (status != HAL_OK) {
+		for (i2cTransaction_t *next = transaction->next; next != NULL; next = next->next) {
+			next->status = HAL_ERROR;
+			next->state = I2C_TRANSACTION_DONE;
+		}
+	}
+}
+
+/** Start the next transaction on the bus if the bus is free. Must be called from an interrupt
+ *  or with interrupts disabled
+ */
+static void i2c_start_next(void) {
+	HAL_StatusTypeDef status;
+	i2cTransaction_t *transaction;
+
+	while (!i2cQueue.onBus && !i2cQueue.recover) {
+
+		//Take the next chain off the queue
+		if (i2cQueue.active == NULL) {
+			if (i2cQueue.pendingCount == 0) {
+				return;
+			}
+			i2cQueue.chain = i2cQueue.pending[i2cQueue.pendingHead];
+			i2cQueue.pendingHead = (i2cQueue.pendingHead + 1) % I2C_QUEUE_LENGTH;
+			i2cQueue.pendingCount--;
+			i2c_activate(i2cQueue.chain);
+		}
+
+		transaction = i2cQueue.active;
+		if (HAL_I2C_GetState(transaction->hi2c) != HAL_I2C_STATE_READY) {
+			return;
+		}
+
+		transaction->state = I2C_TRANSACTION_ACTIVE;
+		i2cQueue.onBus = 1;
+
+		status = i2c_issue(transaction);
+		if (status == HAL_OK) {
+			return;
+		}
+
+		i2cQueue.onBus = 0;
+		if (status == HAL_BUSY) {
+			return;		//try again from I2C_Queue_Process
+		}
+
+		i2c_finish(transaction, status);
+	}
+}
+
+/** Prepare a register write transaction
+ *  @param transaction pointer to transaction
+ *  @param MemAddress memory address of register
+ *  @param txData pointer to data buffer
+ *  @param txSize size of data buffer
+ *  @return HAL_ERROR if the data does not fit in the transaction, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Prepare_Write(i2cTransaction_t *transaction, uint16_t MemAddress, uint8_t *txData, uint16_t txSize) {
+
+	if (txSize > I2C_MAX_TX_SIZE) {
+		return HAL_ERROR;
+	}
+
+	memset(transaction, '\0', sizeof (i2cTransaction_t));
+	transaction->operation = I2C_OP_WRITE_REG;
+	transaction->devAddress = SLAVE_ADDR;
+	transaction->memAddress = MemAddress;
+	memcpy(transaction->txData, txData, txSize);
+	transaction->txSize = txSize;
+
+	return HAL_OK;
+}
+
+/** Prepare a register read transaction
+ *  @param transaction pointer to transaction
+ *  @param MemAddress memory address of register
+ *  @param rxData pointer to data buffer
+ *  @param rxSize size of data buffer
+ *  @return HAL status of the preparation
+ */
+HAL_StatusTypeDef I2C_Prepare_Read(i2cTransaction_t *transaction, uint16_t MemAddress, uint8_t *rxData, uint16_t rxSize) {
+
+	memset(transaction, '\0', sizeof (i2cTransaction_t));
+	transaction->operation = I2C_OP_READ_REG;
+	transaction->devAddress = SLAVE_ADDR;
+	transaction->memAddress = MemAddress;
+	transaction->rxData = rxData;
+	transaction->rxSize = rxSize;
+
+	return HAL_OK;
+}
+
+/** Prepare a function call transaction
+ *  @param transaction pointer to transaction
  *  @param DevAddress the address of the slave
  *  @param MemAddress the address for the register memory
- *  @param MemAddSize the byte size of the memory address
- *  @param txData a pointer to a transmitted data buffer containing the function parameters
+ *  @param txData a pointer to a buffer containing the function parameters
  *  @param txSize the size of txData
- *  @param rxData a pointer to a received data buffer in which the read data will be stored
+ *  @param rxData a pointer to a buffer in which the read data will be stored
  *  @param rxSize the size of rxData
- *  @param Timeout the timeout time in ms for an i2c transaction
- *  @return HAL status of the communication process
+ *  @return HAL_ERROR if the parameters do not fit in the transaction, otherwise HAL_OK
  */
-HAL_StatusTypeDef I2C_Send_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
-		uint16_t MemAddress, uint16_t MemAddSize, uint8_t *txData, uint16_t txSize,
-		uint8_t *rxData, uint16_t rxSize, uint32_t Timeout) {
+HAL_StatusTypeDef I2C_Prepare_Function_Call(i2cTransaction_t *transaction, uint16_t DevAddress, uint16_t MemAddress,
+		uint8_t *txData, uint16_t txSize, uint8_t *rxData, uint16_t rxSize) {
+
+	if ((txSize + 1) > I2C_MAX_TX_SIZE) {
+		return HAL_ERROR;
+	}
 
-	uint8_t txBuffer[MemAddSize + txSize];
-	uint8_t rxBuffer[1];
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
-	memset(txBuffer, '\0', sizeof (txBuffer));
+	memset(transaction, '\0', sizeof (i2cTransaction_t));
+	transaction->operation = I2C_OP_FUNCTION_CALL;
+	transaction->devAddress = DevAddress;
+	transaction->memAddress = MemAddress;
 
 	//Copy the memory address and function parameters to the buffer
-	txBuffer[0] = (uint8_t) MemAddress;
+	transaction->txData[0] = (uint8_t) MemAddress;
 	if (txData != NULL) {
-		memcpy(txBuffer + 1, txData, txSize);
+		memcpy(transaction->txData + 1, txData, txSize);
 	}
+	transaction->txSize = txSize + 1;
+	transaction->rxData = rxData;
+	transaction->rxSize = rxSize;
 
-	while(HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);
+	return HAL_OK;
+}
 
-	do {
-		//Sequentially transmit the mem address and function parameters
-		if (HAL_I2C_Master_Seq_Transmit_IT(hi2c, DevAddress << 1, txBuffer, sizeof (txBuffer), I2C_FIRST_FRAME) != HAL_OK) {
-			return HAL_ERROR;
+/** Place a transaction (or chain of transactions) on the i2c queue. The transfer is run over DMA
+ *  and the function returns immediately
+ *  @param hi2c pointer to i2c handle
+ *  @param transaction the first transaction of the chain
+ *  @return HAL_OK if queued, HAL_BUSY if the queue is full
+ */
+HAL_StatusTypeDef I2C_Queue_Submit(I2C_HandleTypeDef *hi2c, i2cTransaction_t *transaction) {
+
+	i2cQueue.hi2c = hi2c;
+	for (i2cTransaction_t *next = transaction; next != NULL; next = next->next) {
+		next->hi2c = hi2c;
+		next->phase = 0;
+		next->status = HAL_BUSY;
+		next->state = I2C_TRANSACTION_QUEUED;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (i2cQueue.pendingCount >= I2C_QUEUE_LENGTH) {
+		__set_PRIMASK(primask);
+		for (i2cTransaction_t *next = transaction; next != NULL; next = next->next) {
+			next->state = I2C_TRANSACTION_IDLE;
 		}
+		return HAL_BUSY;
+	}
 
-		while(HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);	//wait for i2c to be ready
+	i2cQueue.pending[(i2cQueue.pendingHead + i2cQueue.pendingCount) % I2C_QUEUE_LENGTH] = transaction;
+	i2cQueue.pendingCount++;
+	i2c_start_next();
 
-	} while (HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF);
+	__set_PRIMASK(primask);
 
-	do {
-		//Sequentially read the data from the pozyx device
-		if (HAL_I2C_Master_Seq_Receive_IT(hi2c, DevAddress << 1, rxData, rxSize, I2C_LAST_FRAME) != HAL_OK) {
-			return HAL_ERROR;
+	return HAL_OK;
+}
+
+/** Block until every transaction in a chain is done
+ *  @param transaction the first transaction of the chain
+ *  @return the first non HAL_OK status in the chain, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Queue_Wait(i2cTransaction_t *transaction) {
+	i2cTransaction_t *last = transaction;
+#if I2C_WAIT_STATS
+	uint32_t start = timing_cycles();
+#endif
+
+	//The chain is executed in order so it is done once its last transaction is done
+	while (last->next != NULL) {
+		last = last->next;
+	}
+
+	while (last->state != I2C_TRANSACTION_DONE) {
+		I2C_Queue_Process();
+	}
+
+#if I2C_WAIT_STATS
+	i2cWaitStats.blockedCycles += timing_cycles() - start;
+#endif
+
+	return I2C_Queue_Status(transaction);
+}
+
+/** Get the result of a chain that is done
+ *  @param transaction the first transaction of the chain
+ *  @return the first non HAL_OK status in the chain, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Queue_Status(i2cTransaction_t *transaction) {
+
+	for (i2cTransaction_t *next = transaction; next != NULL; next = next->next) {
+		if (next->status != HAL_OK) {
+			return next->status;
+		}
+	}
+
+	return HAL_OK;
+}
+
+/** Service the i2c queue from the main loop. Starts transactions that could not be started
+ *  from the interrupt, fails transactions past their deadline, recovers the bus after a fault
+ *  and runs the callbacks of completed chains
+ */
+void I2C_Queue_Process(void) {
+	i2cTransaction_t *chain;
+	i2cTransaction_t *transaction;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	//Fail the active transaction if it has passed its deadline, the bus is reset under it
+	transaction = i2cQueue.active;
+	if ((transaction != NULL) && ((HAL_GetTick() - transaction->startTick) >= transaction->timeout)) {
+		HAL_I2C_DeInit(transaction->hi2c);
+		i2cBusHealth.timeouts++;
+		i2cQueue.recover = 1;
+		i2c_finish(transaction, HAL_TIMEOUT);
+	}
+	__set_PRIMASK(primask);
+
+	//Recover from a bus fault before anything else goes on the bus
+	if (i2cQueue.recover && !i2cQueue.onBus && (i2cQueue.hi2c != NULL)) {
+		I2C_Bus_Recover(i2cQueue.hi2c);
+	}
+
+	__disable_irq();
+	i2c_start_next();
+	__set_PRIMASK(primask);
+
+	//Callbacks run with interrupts enabled and may submit the next chain of their operation
+	while (1) {
+		__disable_irq();
+		if (i2cQueue.completedCount == 0) {
+			__set_PRIMASK(primask);
+			return;
 		}
+		chain = i2cQueue.completed[i2cQueue.completedHead];
+		i2cQueue.completedHead = (i2cQueue.completedHead + 1) % I2C_QUEUE_LENGTH;
+		i2cQueue.completedCount--;
+		__set_PRIMASK(primask);
+
+		chain->callback(chain);
+	}
+}
 
-		while (HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);	//wait for i2c to be ready
+/** Check if the i2c queue has any pending or active transactions
+ *  @return 1 if busy, otherwise 0
+ */
+uint8_t I2C_Queue_Busy(void) {
+	return ((i2cQueue.active != NULL) || (i2cQueue.pendingCount > 0));
+}
 
-	} while (HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF);
+/** Get the i2c wait statistics accumulated since the last reset. Only counted when
+ *  I2C_WAIT_STATS is set
+ *  @param stats pointer to struct to copy the statistics to
+ */
+void I2C_Wait_Stats_Get(i2cWaitStats_t *stats) {
+#if I2C_WAIT_STATS
+	*stats = i2cWaitStats;
+#else
+	memset(stats, '\0', sizeof (i2cWaitStats_t));
+#endif
+}
 
-	while(HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);
+/** Reset the i2c wait statistics, typically at the start of a positioning cycle
+ */
+void I2C_Wait_Stats_Reset(void) {
+#if I2C_WAIT_STATS
+	memset(&i2cWaitStats, '\0', sizeof (i2cWaitStats_t));
+#endif
+}
 
-	HAL_Delay(I2C_DELAY);		//small delay between transactions
+/** Get the bus fault counters
+ *  @param health pointer to struct to copy the counters to
+ */
+void I2C_Bus_Health_Get(i2cBusHealth_t *health) {
+	*health = i2cBusHealth;
+}
+
+/** Drive an i2c pin as an open drain GPIO
+ *  @param port GPIO port of the pin
+ *  @param pin GPIO pin
+ */
+static void i2c_pin_release(GPIO_TypeDef *port, uint16_t pin) {
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	HAL_GPIO_WritePin(port, pin, GPIO_PIN_SET);
+	GPIO_InitStruct.Pin = pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+	HAL_GPIO_Init(port, &GPIO_InitStruct);
+}
+
+/** Release SCL and wait for the slave to stop stretching the clock
+ *  @return 1 if SCL went high, 0 if the slave held it low for I2C_STRETCH_TIMEOUT
+ */
+static uint8_t i2c_scl_high(void) {
+	uint32_t start = timing_cycles();
+	uint32_t limit = I2C_STRETCH_TIMEOUT * (SystemCoreClock / 1000000);
+
+	HAL_GPIO_WritePin(I2C_SCL_PORT, I2C_SCL_PIN, GPIO_PIN_SET);
+	while (HAL_GPIO_ReadPin(I2C_SCL_PORT, I2C_SCL_PIN) == GPIO_PIN_RESET) {
+		if ((timing_cycles() - start) >= limit) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/** Configure the i2c peripheral from hi2c->Init and the current speed profile
+ *  @param hi2c pointer to i2c handle
+ *  @return HAL status of the initialisation
+ */
+static HAL_StatusTypeDef i2c_configure(I2C_HandleTypeDef *hi2c) {
+
+	if (HAL_I2C_Init(hi2c) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (HAL_I2CEx_ConfigAnalogFilter(hi2c, I2C_ANALOGFILTER_ENABLE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (HAL_I2CEx_ConfigDigitalFilter(hi2c, 0) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	//Fast-mode Plus needs the higher drive on the bus pins
+	if (i2cSpeed == I2C_SPEED_FAST_PLUS) {
+		HAL_I2CEx_EnableFastModePlus(I2C_FASTMODEPLUS_I2C1);
+	} else {
+		HAL_I2CEx_DisableFastModePlus(I2C_FASTMODEPLUS_I2C1);
+	}
 
 	return HAL_OK;
 }
 
+/** Recover a hung bus. The peripheral is reset, SCL is clocked until the slave releases SDA and
+ *  a STOP is sent before the peripheral is reinitialised at the current speed. Must not be called
+ *  while a transaction is on the bus
+ *  @param hi2c pointer to i2c handle
+ *  @return HAL_ERROR if SDA is still held low, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Bus_Recover(I2C_HandleTypeDef *hi2c) {
+	uint32_t halfPeriod = 500000 / i2cFrequency + 1;	//us
+	uint8_t sclFree = 1;
+
+	i2cBusHealth.recoveries++;
+
+	//Stops the DMA and releases the pins from the peripheral
+	HAL_I2C_DeInit(hi2c);
+	i2c_pin_release(I2C_SCL_PORT, I2C_SCL_PIN);
+	i2c_pin_release(I2C_SDA_PORT, I2C_SDA_PIN);
+	timing_delay_us(halfPeriod);
+
+	//Clock out whatever byte the slave is part way through sending
+	for (int clocks = 0; clocks < I2C_RECOVERY_CLOCKS; clocks++) {
+		if (HAL_GPIO_ReadPin(I2C_SDA_PORT, I2C_SDA_PIN) == GPIO_PIN_SET) {
+			break;
+		}
+		HAL_GPIO_WritePin(I2C_SCL_PORT, I2C_SCL_PIN, GPIO_PIN_RESET);
+		timing_delay_us(halfPeriod);
+		if (!(sclFree = i2c_scl_high())) {
+			break;
+		}
+		timing_delay_us(halfPeriod);
+	}
+
+	//STOP condition, SDA rises while SCL is high
+	HAL_GPIO_WritePin(I2C_SCL_PORT, I2C_SCL_PIN, GPIO_PIN_RESET);
+	timing_delay_us(halfPeriod);
+	HAL_GPIO_WritePin(I2C_SDA_PORT, I2C_SDA_PIN, GPIO_PIN_RESET);
+	timing_delay_us(halfPeriod);
+	sclFree = sclFree && i2c_scl_high();
+	timing_delay_us(halfPeriod);
+	HAL_GPIO_WritePin(I2C_SDA_PORT, I2C_SDA_PIN, GPIO_PIN_SET);
+	timing_delay_us(halfPeriod);
+
+	uint8_t sdaFree = (HAL_GPIO_ReadPin(I2C_SDA_PORT, I2C_SDA_PIN) == GPIO_PIN_SET);
+
+	//MspInit hands the pins and DMA back to the peripheral
+	HAL_StatusTypeDef status = i2c_configure(hi2c);
+	i2cQueue.recover = 0;
+
+	if (!sdaFree || !sclFree) {
+		i2cBusHealth.stuckBus++;
+		return HAL_ERROR;
+	}
+	return status;
+}
+
+/** Compute the TIMINGR value for a speed profile from the i2c kernel clock
+ *  @param i2cClock frequency of the i2c kernel clock in Hz
+ *  @param profile the speed profile
+ *  @param timing pointer to store the TIMINGR value
+ *  @param frequency pointer to store the resulting SCL frequency in Hz, may be NULL
+ *  @return HAL_ERROR if the profile cannot be met with the given clock, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Compute_Timing(uint32_t i2cClock, i2cSpeedProfile_t profile, uint32_t *timing,
+		uint32_t *frequency) {
+
+	if ((profile >= I2C_SPEED_COUNT) || (i2cClock == 0)) {
+		return HAL_ERROR;
+	}
+
+	const i2cSpeedSpec_t *spec = &i2cSpeedSpecs[profile];
+	uint32_t clockPeriod = 1000000000UL / i2cClock;
+
+	//The kernel clock must be fast enough to time the low and high periods (RM0394 I2C timings)
+	if (((4 * clockPeriod) >= (spec->lowMin - I2C_ANALOG_FILTER_MAX)) || (clockPeriod >= spec->highMin)) {
+		return HAL_ERROR;
+	}
+
+	//Edges are delayed by the rise/fall time, the analog filter and the clock synchronisation
+	uint32_t syncTime = spec->riseMax + spec->fallMax + 2 * (I2C_ANALOG_FILTER_MIN + 2 * clockPeriod);
+	uint32_t period = 1000000000UL / spec->frequency;
+
+	for (uint32_t presc = 0; presc < 16; presc++) {
+		uint32_t prescPeriod = (presc + 1) * clockPeriod;
+
+		//Data setup and hold delays
+		uint32_t sclDel = (spec->riseMax + spec->setupMin + prescPeriod - 1) / prescPeriod;
+		sclDel = (sclDel > 0) ? sclDel - 1 : 0;
+
+		uint32_t sdaDel = 0;
+		if ((spec->fallMax + spec->holdMin) > (I2C_ANALOG_FILTER_MIN + 3 * clockPeriod)) {
+			sdaDel = (spec->fallMax + spec->holdMin - I2C_ANALOG_FILTER_MIN - 3 * clockPeriod
+					+ prescPeriod - 1) / prescPeriod;
+		}
+
+		//Minimum low and high periods, then share what is left of the period between them
+		uint32_t sclL = (spec->lowMin + prescPeriod - 1) / prescPeriod;
+		uint32_t sclH = (spec->highMin + prescPeriod - 1) / prescPeriod;
+		if (period > (syncTime + (sclL + sclH) * prescPeriod)) {
+			uint32_t spare = (period - syncTime - (sclL + sclH) * prescPeriod) / prescPeriod;
+			sclL += spare / 2;
+			sclH += spare - (spare / 2);
+		}
+
+		if ((sclDel > 15) || (sdaDel > 15) || (sclL > 256) || (sclH > 256)) {
+			continue;	//try a larger prescaler
+		}
+
+		uint32_t sclFrequency = 1000000000UL / (syncTime + (sclL + sclH) * prescPeriod);
+
+		//Only worth using if it is faster than the next slowest profile
+		if ((profile > I2C_SPEED_STANDARD) && (sclFrequency <= i2cSpeedSpecs[profile - 1].frequency)) {
+			return HAL_ERROR;
+		}
+
+		*timing = (presc << 28) | (sclDel << 20) | (sdaDel << 16) | ((sclH - 1) << 8) | (sclL - 1);
+		if (frequency != NULL) {
+			*frequency = sclFrequency;
+		}
+		return HAL_OK;
+	}
+
+	return HAL_ERROR;
+}
+
+/** Reconfigure the i2c peripheral for a speed profile using the current PCLK1 (derived from SYSCLK)
+ *  @param hi2c pointer to i2c handle
+ *  @param profile the speed profile
+ *  @return HAL_ERROR if the profile cannot be met or the peripheral failed to initialise, otherwise HAL_OK
+ */
+HAL_StatusTypeDef I2C_Set_Speed(I2C_HandleTypeDef *hi2c, i2cSpeedProfile_t profile) {
+	uint32_t timing, frequency;
+
+	//I2C1 is clocked from PCLK1
+	if (I2C_Compute_Timing(HAL_RCC_GetPCLK1Freq(), profile, &timing, &frequency) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	//Wait for the queue to drain before touching the peripheral
+	while (I2C_Queue_Busy()) {
+		I2C_Queue_Process();
+	}
+
+	hi2c->Init.Timing = timing;
+	i2cSpeed = profile;
+	i2cFrequency = frequency;
+
+	return i2c_configure(hi2c);
+}
+
+/** Get the speed profile the bus is currently running at
+ *  @return the speed profile
+ */
+i2cSpeedProfile_t I2C_Get_Speed(void) {
+	return i2cSpeed;
+}
+
+/** Get the SCL frequency the bus is currently running at
+ *  @return SCL frequency in Hz
+ */
+uint32_t I2C_Get_Frequency(void) {
+	return i2cFrequency;
+}
+
+/** Get a short name for a speed profile
+ *  @param profile the speed profile
+ *  @return "SM", "FM" or "FM+"
+ */
+const char *I2C_Speed_Name(i2cSpeedProfile_t profile) {
+	if (profile >= I2C_SPEED_COUNT) {
+		return "?";
+	}
+	return i2cSpeedSpecs[profile].name;
+}
+
+/** Send an I2C function call to the pozyx master tag
+ *  Function will send an I2C containing the slave address, memory address and
+ *  given function parameters (txData).
+ *  It will then sequentially send a read request.
+ *  @param hi2c the i2c handle
+ *  @param DevAddress the address of the slave
+ *  @param MemAddress the address for the register memory
+ *  @param MemAddSize the byte size of the memory address
+ *  @param txData a pointer to a transmitted data buffer containing the function parameters
+ *  @param txSize the size of txData
+ *  @param rxData a pointer to a received data buffer in which the read data will be stored
+ *  @param rxSize the size of rxData
+ *  @param Timeout the timeout time in ms for an i2c transaction
+ *  @return HAL status of the communication process
+ */
+HAL_StatusTypeDef I2C_Send_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+		uint16_t MemAddress, uint16_t MemAddSize, uint8_t *txData, uint16_t txSize,
+		uint8_t *rxData, uint16_t rxSize, uint32_t Timeout) {
+
+	i2cTransaction_t transaction;
+
+	if (I2C_Prepare_Function_Call(&transaction, DevAddress, MemAddress, txData, txSize,
+			rxData, rxSize) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	transaction.timeout = Timeout;
+
+	if (I2C_Queue_Submit(hi2c, &transaction) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	return I2C_Queue_Wait(&transaction);
+}
+
 /** Write a given data buffer to a specified register
  *  @param hi2c pointer to i2c handle
  *  @param MemAddress memory address of register
@@ -77,10 +713,18 @@ HAL_StatusTypeDef I2C_Send_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t DevAd
  */
 HAL_StatusTypeDef I2C_Write_Reg(I2C_HandleTypeDef *hi2c, uint16_t MemAddress,
 		uint8_t *txData, uint16_t txSize) {
-	while(HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);	//wait for I2C to be ready
 
-	return HAL_I2C_Mem_Write(hi2c, SLAVE_ADDR << 1, MemAddress,		//write the given data
-			I2C_MEMADD_SIZE_8BIT, txData, txSize, 10);
+	i2cTransaction_t transaction;
+
+	if (I2C_Prepare_Write(&transaction, MemAddress, txData, txSize) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	if (I2C_Queue_Submit(hi2c, &transaction) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	return I2C_Queue_Wait(&transaction);
 }
 
 /** Read a specified register to a given data buffer
@@ -92,10 +736,116 @@ HAL_StatusTypeDef I2C_Write_Reg(I2C_HandleTypeDef *hi2c, uint16_t MemAddress,
  */
 HAL_StatusTypeDef I2C_Read_Reg(I2C_HandleTypeDef *hi2c, uint16_t MemAddress,
 		uint8_t *rxData, uint16_t rxSize) {
-	while(HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY);	//wait for i2c to be ready
 
-	return HAL_I2C_Mem_Read(hi2c, SLAVE_ADDR << 1, MemAddress,	//write the given data
-			I2C_MEMADD_SIZE_8BIT, rxData, rxSize, 10);
+	i2cTransaction_t transaction;
+
+	I2C_Prepare_Read(&transaction, MemAddress, rxData, rxSize);
+
+	if (I2C_Queue_Submit(hi2c, &transaction) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	return I2C_Queue_Wait(&transaction);
+}
+
+/**
+ * @brief  Master Tx Transfer completed callback.
+ * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+ *                the configuration information for the specified I2C.
+ * @retval None
+ */
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	i2cTransaction_t *transaction = i2cQueue.active;
+	HAL_StatusTypeDef status;
+
+	if (!i2cQueue.onBus || (transaction->hi2c != hi2c)) {
+		return;
+	}
+
+	i2c_ready();
+
+	//Function parameters sent, read back the result with a repeated start
+	transaction->phase = 1;
+	if ((status = i2c_issue(transaction)) != HAL_OK) {
+		i2c_finish(transaction, status);
+		i2c_start_next();
+	}
 }
 
+/**
+ * @brief  Master Rx Transfer completed callback.
+ * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+ *                the configuration information for the specified I2C.
+ * @retval None
+ */
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+
+	if (!i2cQueue.onBus || (i2cQueue.active->hi2c != hi2c)) {
+		return;
+	}
+
+	i2c_finish(i2cQueue.active, HAL_OK);
+	i2c_start_next();
+}
 
+/**
+ * @brief  Memory Tx Transfer completed callback.
+ * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+ *                the configuration information for the specified I2C.
+ * @retval None
+ */
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	HAL_I2C_MasterRxCpltCallback(hi2c);
+}
+
+/**
+ * @brief  Memory Rx Transfer completed callback.
+ * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+ *                the configuration information for the specified I2C.
+ * @retval None
+ */
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	HAL_I2C_MasterRxCpltCallback(hi2c);
+}
+
+/**
+ * @brief  I2C error callback.
+ * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+ *                the configuration information for the specified I2C.
+ * @retval None
+ */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+	i2cTransaction_t *transaction = i2cQueue.active;
+
+	if (!i2cQueue.onBus || (transaction->hi2c != hi2c)) {
+		return;
+	}
+
+	if (HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF) {
+		//The pozyx NACKs while it is busy, poll it until it is ready or the budget runs out
+		if (!i2cQueue.polling) {
+			i2cQueue.polling = 1;
+			i2cQueue.readyTick = HAL_GetTick();
+			i2cQueue.readyCycles = timing_cycles();
+		}
+#if I2C_WAIT_STATS
+		i2cWaitStats.readyPolls++;
+#endif
+
+		if ((HAL_GetTick() - i2cQueue.readyTick) >= I2C_READY_BUDGET) {
+			i2c_finish(transaction, HAL_TIMEOUT);
+		} else {
+			i2cQueue.onBus = 0;
+			transaction->state = I2C_TRANSACTION_QUEUED;
+		}
+	} else {
+		//Bus and arbitration errors leave the bus in an unknown state
+		if (HAL_I2C_GetError(hi2c) & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_TIMEOUT)) {
+			i2cBusHealth.busErrors++;
+			i2cQueue.recover = 1;
+		}
+		i2c_finish(transaction, HAL_ERROR);
+	}
+
+	i2c_start_next();
+}
@@ -0,0 +1,50 @@
+/*
+**************************************************************************************************************
+* @file     imu.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Turns the linear acceleration of a remote tag into the acceleration of the crane in the bay
+**************************************************************************************************************
+*/
+
+#include "imu.h"
+
+/** Initialise the accelerometer of a tag
+ *  @param imu pointer to accelerometer
+ *  @param mount angle in degrees from the x axis of the bay to the x axis of the tag, counter clockwise
+ */
+void imu_init(imu_t *imu, int16_t mount) {
+	memset(imu, '\0', sizeof (imu_t));
+
+	float angle = mount * (float) M_PI / 180;
+	imu->cosMount = cosf(angle);
+	imu->sinMount = sinf(angle);
+}
+
+/** Convert a linear acceleration sample of the tag into the acceleration of the crane in the axes of the
+ *  bay. The sample of a parked crane is taken as bias, and the crane is not accelerating
+ *  @param imu pointer to accelerometer
+ *  @param raw LIA_X and LIA_Y of the tag in mg
+ *  @param parked 1 if the crane is parked
+ *  @param acceleration x and y acceleration to fill in mm/s^2
+ */
+void imu_acceleration(imu_t *imu, const int16_t raw[2], uint8_t parked, float acceleration[2]) {
+	float sample[2] = { raw[0] * IMU_MG, raw[1] * IMU_MG };
+
+	imu->samples++;
+
+	if (parked) {
+		imu->bias[0] += IMU_BIAS_GAIN * (sample[0] - imu->bias[0]);
+		imu->bias[1] += IMU_BIAS_GAIN * (sample[1] - imu->bias[1]);
+		acceleration[0] = 0;
+		acceleration[1] = 0;
+		return;
+	}
+
+	sample[0] -= imu->bias[0];
+	sample[1] -= imu->bias[1];
+
+	//The tag is mounted level, so only its heading on the crane separates its axes from the bay
+	acceleration[0] = (imu->cosMount * sample[0]) - (imu->sinMount * sample[1]);
+	acceleration[1] = (imu->sinMount * sample[0]) + (imu->cosMount * sample[1]);
+}
@@ -0,0 +1,259 @@
+/*
+**************************************************************************************************************
+* @file     kalman.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Constant velocity Kalman filter smoothing the positions of a crane
+**************************************************************************************************************
+*/
+
+#include "kalman.h"
+
+/** Round a velocity to the nearest mm/s, saturating at the range of int16_t
+ *  @param velocity velocity in mm/s
+ *  @return the rounded velocity
+ */
+static int16_t Round_Velocity(float velocity) {
+	if (velocity > INT16_MAX) {
+		return INT16_MAX;
+	}
+	if (velocity < INT16_MIN) {
+		return INT16_MIN;
+	}
+	return lroundf(velocity);
+}
+
+/** Get the covariance of a measured position, floored so a single optimistic position cannot
+ *  collapse the filter
+ *  @param covariance covariance of the position in mm^2, NULL for KALMAN_MEAS_VARIANCE
+ *  @param noise 2x2 covariance to fill
+ */
+static void Measurement_Noise(const covariance_t *covariance, float noise[2][2]) {
+	if (covariance == NULL) {
+		noise[0][0] = KALMAN_MEAS_VARIANCE;
+		noise[1][1] = KALMAN_MEAS_VARIANCE;
+		noise[0][1] = 0;
+		noise[1][0] = 0;
+		return;
+	}
+
+	noise[0][0] = (covariance->errX < KALMAN_MIN_VARIANCE) ? KALMAN_MIN_VARIANCE : covariance->errX;
+	noise[1][1] = (covariance->errY < KALMAN_MIN_VARIANCE) ? KALMAN_MIN_VARIANCE : covariance->errY;
+
+	//Keep the matrix positive definite after the floor
+	float limit = 0.99f * sqrtf(noise[0][0] * noise[1][1]);
+	float cross = covariance->errXY;
+	noise[0][1] = (cross > limit) ? limit : ((cross < -limit) ? -limit : cross);
+	noise[1][0] = noise[0][1];
+}
+
+/** Start the filter at a position, at rest with the velocity uncertain up to the top crane speed
+ *  @param filter pointer to filter
+ *  @param position the position
+ *  @param noise covariance of the position
+ *  @param tick the tick the position was measured at
+ */
+static void Start_Filter(kalman_t *filter, const coordinates_t *position, float noise[2][2], uint32_t tick) {
+	memset(filter->covariance, '\0', sizeof (filter->covariance));
+
+	filter->state[0] = position->posX;
+	filter->state[1] = position->posY;
+	filter->state[2] = 0;
+	filter->state[3] = 0;
+
+	filter->covariance[0][0] = noise[0][0];
+	filter->covariance[0][1] = noise[0][1];
+	filter->covariance[1][0] = noise[1][0];
+	filter->covariance[1][1] = noise[1][1];
+	filter->covariance[2][2] = filter->maxSpeed * filter->maxSpeed;
+	filter->covariance[3][3] = filter->maxSpeed * filter->maxSpeed;
+
+	filter->tick = tick;
+	filter->fixTick = tick;
+	filter->rejects = 0;
+	filter->initialised = 1;
+}
+
+/** Reset the filter, the next position starts it again
+ *  @param filter pointer to filter
+ *  @param maxSpeed fastest the crane travels in mm/s
+ */
+void kalman_init(kalman_t *filter, int32_t maxSpeed) {
+	memset(filter, '\0', sizeof (kalman_t));
+	filter->maxSpeed = maxSpeed;
+}
+
+/** Move the state forward to a tick, at constant velocity or with a measured acceleration
+ *  @param filter pointer to filter
+ *  @param acceleration x and y acceleration in mm/s^2, NULL for constant velocity
+ *  @param sigma standard deviation of the acceleration left unmodelled in mm/s^2
+ *  @param tick the tick to move to
+ */
+static void Propagate(kalman_t *filter, const float *acceleration, float sigma, uint32_t tick) {
+	float predicted[4][4];
+	int32_t elapsed = (int32_t) (tick - filter->tick);
+
+	if (!filter->initialised || (elapsed <= 0)) {
+		return;
+	}
+
+	//The velocity is too stale to carry the crane across a long gap
+	if (elapsed > KALMAN_MAX_GAP) {
+		filter->initialised = 0;
+		return;
+	}
+
+	float dt = elapsed / 1000.0f;
+
+	filter->state[0] += dt * filter->state[2];
+	filter->state[1] += dt * filter->state[3];
+	if (acceleration != NULL) {
+		filter->state[0] += acceleration[0] * dt * dt / 2;
+		filter->state[1] += acceleration[1] * dt * dt / 2;
+		filter->state[2] += acceleration[0] * dt;
+		filter->state[3] += acceleration[1] * dt;
+	}
+
+	//F P F' where F adds dt times the velocity to the position, done as F P then (F P) F'
+	for (uint8_t i = 0; i < 4; i++) {
+		for (uint8_t j = 0; j < 4; j++) {
+			predicted[i][j] = filter->covariance[i][j] + ((i < 2) ? (dt * filter->covariance[i + 2][j]) : 0);
+		}
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		for (uint8_t j = 0; j < 4; j++) {
+			filter->covariance[i][j] = predicted[i][j] + ((j < 2) ? (dt * predicted[i][j + 2]) : 0);
+		}
+	}
+
+	//Process noise of a white noise acceleration on each axis
+	float q = sigma * sigma;
+	for (uint8_t axis = 0; axis < 2; axis++) {
+		filter->covariance[axis][axis] += q * dt * dt * dt * dt / 4;
+		filter->covariance[axis][axis + 2] += q * dt * dt * dt / 2;
+		filter->covariance[axis + 2][axis] += q * dt * dt * dt / 2;
+		filter->covariance[axis + 2][axis + 2] += q * dt * dt;
+	}
+
+	filter->tick = tick;
+}
+
+/** Predict the state forward to a tick, so a missed position widens the covariance the next one is gated with
+ *  @param filter pointer to filter
+ *  @param tick the tick to predict to
+ */
+void kalman_predict(kalman_t *filter, uint32_t tick) {
+	Propagate(filter, NULL, KALMAN_ACCEL_SIGMA, tick);
+}
+
+/** Propagate the state forward to a tick with a measured acceleration of the crane, held since the
+ *  state was last moved on
+ *  @param filter pointer to filter
+ *  @param acceleration x and y acceleration in mm/s^2
+ *  @param tick the tick to propagate to
+ */
+void kalman_propagate(kalman_t *filter, const float acceleration[2], uint32_t tick) {
+	Propagate(filter, acceleration, KALMAN_IMU_SIGMA, tick);
+}
+
+/** Predict the state to a tick and correct it with a position, unless the position is too far from
+ *  the prediction to be believed
+ *  @param filter pointer to filter
+ *  @param position the measured position
+ *  @param covariance covariance of the position in mm^2, NULL for KALMAN_MEAS_VARIANCE
+ *  @param tick the tick the position was measured at
+ *  @return FIX_REJECTED if the position was rejected, otherwise POSITIONS_RETRIEVED
+ */
+int kalman_update(kalman_t *filter, const coordinates_t *position, const covariance_t *covariance, uint32_t tick) {
+	float noise[2][2];
+	float gain[4][2];
+
+	Measurement_Noise(covariance, noise);
+
+	kalman_predict(filter, tick);
+	if (!filter->initialised) {
+		Start_Filter(filter, position, noise, tick);
+		return POSITIONS_RETRIEVED;
+	}
+
+	//Innovation and its covariance S = H P H' + R, H picks the position out of the state
+	float innovation[2] = { position->posX - filter->state[0], position->posY - filter->state[1] };
+	float s00 = filter->covariance[0][0] + noise[0][0];
+	float s01 = filter->covariance[0][1] + noise[0][1];
+	float s11 = filter->covariance[1][1] + noise[1][1];
+	float det = (s00 * s11) - (s01 * s01);
+	if (det <= 0) {
+		Start_Filter(filter, position, noise, tick);
+		return POSITIONS_RETRIEVED;
+	}
+	float inverse[2][2] = { { s11 / det, -s01 / det }, { -s01 / det, s00 / det } };
+
+	//Gate on the squared Mahalanobis distance of the innovation
+	float distance = (innovation[0] * ((inverse[0][0] * innovation[0]) + (inverse[0][1] * innovation[1]))) +
+			(innovation[1] * ((inverse[1][0] * innovation[0]) + (inverse[1][1] * innovation[1])));
+	if (distance > KALMAN_GATE) {
+		filter->rejected++;
+		if (++filter->rejects >= KALMAN_MAX_REJECTS) {
+			filter->initialised = 0;	//the filter has lost the crane, believe the next position
+		}
+		return FIX_REJECTED;
+	}
+	filter->rejects = 0;
+	filter->fixTick = tick;
+
+	//K = P H' S^-1
+	for (uint8_t i = 0; i < 4; i++) {
+		gain[i][0] = (filter->covariance[i][0] * inverse[0][0]) + (filter->covariance[i][1] * inverse[1][0]);
+		gain[i][1] = (filter->covariance[i][0] * inverse[0][1]) + (filter->covariance[i][1] * inverse[1][1]);
+	}
+
+	for (uint8_t i = 0; i < 4; i++) {
+		filter->state[i] += (gain[i][0] * innovation[0]) + (gain[i][1] * innovation[1]);
+	}
+
+	//P = P - K H P, H P is the first two rows of P
+	float rows[2][4];
+	memcpy(rows, filter->covariance, sizeof (rows));
+	for (uint8_t i = 0; i < 4; i++) {
+		for (uint8_t j = 0; j < 4; j++) {
+			filter->covariance[i][j] -= (gain[i][0] * rows[0][j]) + (gain[i][1] * rows[1][j]);
+		}
+	}
+
+	//Keep the covariance symmetric against rounding
+	for (uint8_t i = 0; i < 4; i++) {
+		for (uint8_t j = i + 1; j < 4; j++) {
+			float mean = (filter->covariance[i][j] + filter->covariance[j][i]) / 2;
+			filter->covariance[i][j] = mean;
+			filter->covariance[j][i] = mean;
+		}
+	}
+
+	return POSITIONS_RETRIEVED;
+}
+
+/** Get the smoothed position and velocity
+ *  @param filter pointer to filter
+ *  @param position struct to store the position, posZ is left as it is
+ *  @param velX x velocity in mm/s, may be NULL
+ *  @param velY y velocity in mm/s, may be NULL
+ */
+void kalman_state(kalman_t *filter, coordinates_t *position, int16_t *velX, int16_t *velY) {
+	position->posX = lroundf(filter->state[0]);
+	position->posY = lroundf(filter->state[1]);
+
+	if (velX != NULL) {
+		*velX = Round_Velocity(filter->state[2]);
+	}
+	if (velY != NULL) {
+		*velY = Round_Velocity(filter->state[3]);
+	}
+}
+
+/** Get the smoothed speed
+ *  @param filter pointer to filter
+ *  @return speed in mm/s
+ */
+uint32_t kalman_speed(kalman_t *filter) {
+	return lroundf(sqrtf((filter->state[2] * filter->state[2]) + (filter->state[3] * filter->state[3])));
+}
@@ -21,6 +21,9 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "scheduler.h"
+#include "anchors.h"
+#include "siteconfig.h"
 
 /* USER CODE END Includes */
 
@@ -42,6 +45,8 @@
 ADC_HandleTypeDef hadc1;
 
 I2C_HandleTypeDef hi2c1;
+DMA_HandleTypeDef hdma_i2c1_rx;
+DMA_HandleTypeDef hdma_i2c1_tx;
 
 UART_HandleTypeDef huart1;
 
@@ -52,17 +57,24 @@ UART_HandleTypeDef huart1;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_ADC1_Init(void);
 static void MX_NVIC_Init(void);
 /* USER CODE BEGIN PFP */
-void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
-void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c);
 void add_device_parameters(uint16_t networkID, uint8_t flag, uint32_t posX, uint32_t posY, uint32_t posZ, deviceCoords_t *device);
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
-void reassign_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t a1, deviceCoords_t a2, deviceCoords_t a3, deviceCoords_t a4,
-                      deviceCoords_t a5, deviceCoords_t a6, uint16_t networkID);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+void start_remote_tag(I2C_HandleTypeDef *hi2c, UART_HandleTypeDef *huart, craneTag_t *tag);
+int reassign_anchors(I2C_HandleTypeDef *hi2c, craneTag_t *tag, anchorGrid_t *grid, uint8_t zone);
+void send_zone_switch(UART_HandleTypeDef *huart, craneTag_t *tag, int uploaded, uint32_t switchTime);
+void send_geofence_events(UART_HandleTypeDef *huart, craneTag_t *tag, uint8_t changed, uint32_t mass);
+void store_site_config(UART_HandleTypeDef *huart);
+#if I2C_WAIT_STATS
+void send_wait_stats(UART_HandleTypeDef *huart, uint32_t worstCycle);
+#endif
 
 #define ADD_ANCHOR(networkID, posX, posY, posZ, device) add_device_parameters(networkID, ANCHOR_FLAG, posX, posY, posZ, device)
 #define ADD_TAG(networkID, posX, posY, posZ, device) add_device_parameters(networkID, TAG_FLAG, posX, posY, posZ, device)
@@ -71,7 +83,15 @@ void reassign_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t a1, deviceCoords_t
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-volatile int interruptFlag = 0;
+volatile uint8_t traceRequest = 0;     // 1 if a trace dump has been requested over zigbee
+volatile uint8_t schedulerRequest = 0; // 1 if the scheduler statistics have been requested over zigbee
+volatile uint8_t configReceiving = 0;  // 1 while a configuration upload is being received over zigbee
+volatile uint8_t configRequest = 0;    // 1 once a configuration upload has been received
+volatile uint32_t configTick = 0;      // tick the configuration upload started
+static siteConfig_t configUpload;      // configuration being uploaded, stored once it is checked
+
+static anchorGrid_t anchorGrid; // position to anchor zone lookup, built at start up
+static geofence_t geofence;     // position to geofence zone lookup, built at start up
 
 uint8_t uartbuf[1] = {0};
 uint8_t buffer[50] = {0};
@@ -111,6 +131,7 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_USART1_UART_Init();
   MX_I2C1_Init();
   MX_ADC1_Init();
@@ -119,19 +140,45 @@ int main(void)
   MX_NVIC_Init();
   /* USER CODE BEGIN 2 */
 
-  HAL_Delay(10000); // wait 4 seconds
+  timing_init(); // enable the cycle counter for i2c timing
 
-  uint32_t prevTime = 0;  // last time since position request
-  uint32_t prevTime2 = 0; // time of last successful position calculation
+  pozyx_wait_ready(SLAVE_ADDR, &hi2c1, POZYX_BOOT_TIMEOUT); // wait for the master tag to power up
 
-  uint8_t readSinceLastPos = 1; // number of reads since last successful positioning
+#if REMOTE_CONTINUOUS
+  uint32_t prevTime = 0;  // time continuous positioning was last started
+#endif
+  uint32_t prevTime2 = 0; // time of last successful position calculation
 
   uint32_t adcResult = 0; // holds ADC strain of load gauge
 
-  uint8_t readsSinceMovement = 0; // indicates how many reads since crane last moved
-
   uint8_t errorFlag = 0; // 1 if an error occurred in the last read, 0 if else
 
+  uint32_t worstCycle = 0; // longest positioning cycle in core clock cycles
+
+  uint32_t retryReportTime = 0; // time the retry counters were last reported
+
+  static scheduler_t scheduler; // remote tags sharing the master tag, static as their histories are large
+  scheduler_init(&scheduler);
+  craneTag_t *slotTag = NULL;        // tag holding the UWB slot, NULL if the slot is free
+  craneTag_t *fixTag = NULL;         // tag the collected position belongs to
+  uint32_t requestCycles = 0;        // cycle count the outstanding position was requested
+  int positioningStatus = 0;         // result of the last collected position
+  uint8_t positionReady = 0;         // 1 if a collected position is waiting to be gated and sent
+  craneTag_t *offlineTag = NULL;     // offline tag a start up is attempted on while the slot is free
+#if REMOTE_IMU
+  craneTag_t *imuTag = NULL; // tag the accelerometer is sampled on while the slot is free
+#endif
+
+  telemetry_t telemetry; // per fix telemetry sent with the position
+  memset(&telemetry, '\0', sizeof(telemetry));
+
+  covariance_t covariance; // error covariance of the collected position, weights it in the filter
+#if REMOTE_CONTINUOUS
+  covariance_t *fixCovariance = NULL; // not sent by the tag in continuous positioning
+#else
+  covariance_t *fixCovariance = &covariance;
+#endif
+
   // 1byte buffers for sending/receiving data
   uint8_t rxBuffer[50];
   uint8_t txBuffer[50];
@@ -139,240 +186,371 @@ int main(void)
   memset(txBuffer, '\0', sizeof(txBuffer));
 
   // Initialise anchor positions to zero
-  deviceCoords_t anchor1, anchor2, anchor3, anchor4, anchor5, anchor6, anchor7, anchor8, tag1;
-  coordinates_t realTimePositions, prevPositions, outOfBoundsPos, errorPos;
+  deviceCoords_t masterDevices[MAX_ANCHORS_IN_LIST];
+  uint8_t masterDeviceCount = 0;
+  coordinates_t realTimePositions, outOfBoundsPos, errorPos;
 
-  coordinates_t positionArr[10];
-  uint8_t positionArrayIndex = 0;
+  // Load the bay, anchors and cranes of this site from flash
+  int configStatus = site_config_load();
 
   // Initialise anchor network id and positions locally
-  ADD_ANCHOR(0x1172, 100, 100, 5000, &anchor1);
-  ADD_ANCHOR(0x1114, 21860, 0, 5000, &anchor2);
-  ADD_ANCHOR(0x1103, 0, 15200, 5000, &anchor3);
-  ADD_ANCHOR(0x1131, 21860, 15200, 5000, &anchor4);
-  ADD_ANCHOR(0x6830, 0, 30400, 5000, &anchor5);
-  ADD_ANCHOR(0x1152, 21860, 30400, 5000, &anchor6);
-  ADD_ANCHOR(0x6846, 0, 45600, 5000, &anchor7);
-  ADD_ANCHOR(0x6842, 21860, 45600, 5000, &anchor8);
-  ADD_TAG(0x6875, 0, 0, 0, &tag1);
+  // Precompute the anchors to position with across the bay
+  anchor_grid_build(&anchorGrid, siteConfig.anchors, siteConfig.anchorCount);
+
+  // Precompute the geofence zones the cranes are placed in
+  int fenceStatus = geofence_build(&geofence, siteConfig.fences, siteConfig.fenceCount);
+
+  // Add the remote tags to the scheduler
+  for (uint8_t i = 0; i < siteConfig.tagCount; i++)
+  {
+    craneTag_t *tag = scheduler_add(&scheduler, siteConfig.tags[i].networkID, siteConfig.tags[i].craneID, siteConfig.tags[i].period);
+    if (tag != NULL)
+    {
+      kalman_init(&tag->filter, siteConfig.maxCraneSpeed);
+      imu_init(&tag->imu, siteConfig.tags[i].imuMount);
+    }
+  }
+
+  // Run the master tag bus at the fastest speed it responds to
+  int busSpeed = probe_bus_speed(SLAVE_ADDR, &hi2c1);
 
   // TEST RESPONSE //
-  uint8_t remoteInitOk2[] = {'B', 'E', 'G', 'I', 'N', ' ', 'I', 'N', 'I', 'T', '\n'};
-  zigbee_send_other_data(&huart1, remoteInitOk2, sizeof(remoteInitOk2));
+  char initArr[80]; // longer than txBuffer, the init line carries every start up warning
+  int initLength = snprintf(initArr, sizeof(initArr), "BEGIN INIT %s %lukHz%s%s%s\n",
+                            I2C_Speed_Name(I2C_Get_Speed()), (unsigned long)(I2C_Get_Frequency() / 1000),
+                            (busSpeed < 0) ? " NO TAG" : "", (configStatus == SITE_CONFIG_DEFAULT) ? " DEFAULT CONFIG" : "",
+                            (fenceStatus < 0) ? " NO FENCES" : "");
+  zigbee_send_other_data(&huart1, (uint8_t *)initArr, initLength);
   // TEST RESPONSE //
 
   // Initialize mater tag
   master_tag_init(SLAVE_ADDR, &hi2c1);
 
-  HAL_Delay(150); // wait 150ms
-
-  // Add anchors into master tag memory
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor1);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor2);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor3);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor4);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor5);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor6);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor7);
-  add_anchors(SLAVE_ADDR, &hi2c1, anchor8);
-  add_anchors(SLAVE_ADDR, &hi2c1, tag1);
-
-  HAL_Delay(150); // wait 150ms
+  // Add anchors and remote tags into master tag memory, kept if the master tag already holds them
+  for (uint8_t i = 0; (i < siteConfig.anchorCount) && (masterDeviceCount < (MAX_ANCHORS_IN_LIST - scheduler.count)); i++)
+  {
+    masterDevices[masterDeviceCount++] = siteConfig.anchors[i];
+  }
+  for (uint8_t i = 0; i < scheduler.count; i++)
+  {
+    ADD_TAG(scheduler.tags[i].networkID, 0, 0, 0, &masterDevices[masterDeviceCount++]);
+  }
+  master_provision_devices(SLAVE_ADDR, &hi2c1, masterDevices, masterDeviceCount);
 
   // Set number of anchors on master tag
-  memset(txBuffer, '\0', sizeof(txBuffer));
-  txBuffer[0] = (NUM_ANCHORS | (1 << 7));
-  I2C_Write_Reg(&hi2c1, POZYX_POS_NUM_ANCHORS, txBuffer, BYTE_SIZE_1);
+  configEntry_t masterAnchors = {POZYX_POS_NUM_ANCHORS, (siteConfig.numAnchors | (1 << 7))};
+  shadow_sync_master(&hi2c1, SLAVE_ADDR, &masterAnchors, 1);
 
   // TEST RESPONSE //
   uint8_t remoteInitOk3[] = {'I', 'N', 'I', 'T', ' ', 'O', 'K', '\r', '\n'};
   zigbee_send_other_data(&huart1, remoteInitOk3, sizeof(remoteInitOk3));
   // TEST RESPONSE //
 
-  HAL_Delay(1000); // wait 1000ms
-
   // TEST RESPONSE //
   uint8_t remoteInitOk1[] = {'B', 'E', 'G', 'I', 'N', ' ', 'I', 'N', 'I', 'T', '\n'};
   zigbee_send_other_data(&huart1, remoteInitOk1, sizeof(remoteInitOk1));
   // TEST RESPONSE //
 
-  // Initialise remote tag
-  while (remote_tag_init(&hi2c1, tag1.networkID) != GOOD_INIT)
-    ;
-
-  memset(txBuffer, '\0', sizeof(txBuffer));
-
-  // TEST RESPONSE //
-  uint8_t remoteInitOk[] = {'I', 'N', 'I', 'T', ' ', 'O', 'K', '\r', '\n'};
-  zigbee_send_other_data(&huart1, remoteInitOk, sizeof(remoteInitOk));
-  // TEST RESPONSE //
+  for (uint8_t i = 0; i < scheduler.count; i++)
+  {
+    craneTag_t *tag = &scheduler.tags[i];
 
-  // Add anchors into remote tag memory
-  remote_add_anchors(&hi2c1, anchor1, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor2, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor3, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor4, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor5, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor6, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor7, tag1.networkID);
-  remote_add_anchors(&hi2c1, anchor8, tag1.networkID);
+    // Initialise remote tag once, a tag that does not start is retried by the scheduler at a low rate
+    if (remote_tag_init(&hi2c1, tag->networkID, REMOTE_BOOT_TIMEOUT) != GOOD_INIT)
+    {
+      // TEST RESPONSE //
+      uint8_t remoteInitFail[] = {'I', 'N', 'I', 'T', ' ', 'F', 'A', 'I', 'L', '\r', '\n'};
+      zigbee_send_other_data(&huart1, remoteInitFail, sizeof(remoteInitFail));
+      // TEST RESPONSE //
+      scheduler_set_offline(tag);
+      continue;
+    }
+    tag->online = 1;
 
-  remote_save_device_list(&hi2c1, tag1.networkID); // flash device list into remote tag memory
+    start_remote_tag(&hi2c1, &huart1, tag);
+  }
 
-  // TEST RESPONSE
-  uint8_t anchorsOk[] = {'A', 'N', 'C', 'H', 'O', 'R', 'S', ' ', 'O', 'K', '\r', '\n'};
-  zigbee_send_other_data(&huart1, anchorsOk, sizeof(anchorsOk));
-  // TEST RESPONSE
+  // Listen for commands over zigbee
+  HAL_UART_Receive_IT(&huart1, uartbuf, sizeof(uartbuf));
 
-  // Set number of anchors on remote tag
-  txBuffer[0] = (POZYX_ANCHOR_SEL_AUTO << 7) + NUM_ANCHORS;
-  Remote_Write_Reg_Read(&hi2c1, tag1.networkID, POZYX_POS_NUM_ANCHORS, txBuffer,
-                        BYTE_SIZE_1, rxBuffer, BYTE_SIZE_2);
-  memset(txBuffer, '\0', sizeof(txBuffer));
+  /* USER CODE END 2 */
 
-  // flash number of anchors into remote tag memory
-  remote_flash_register(&hi2c1, tag1.networkID, POZYX_POS_NUM_ANCHORS);
+  /* Infinite loop */
+  /* USER CODE BEGIN WHILE */
+  while (1)
+  {
 
-  // Get start up position & send data
-  remote_positioning(&hi2c1, tag1.networkID, &realTimePositions);
-  zigbee_send_data(&huart1, realTimePositions, 1000, CRANE_ID);
+    // Start queued i2c transactions and fail any past their deadline
+    I2C_Queue_Process();
 
-  prevPositions.posX = realTimePositions.posX;
-  prevPositions.posY = realTimePositions.posY;
+    // Send the i2c/UWB trace if requested
+    if (traceRequest)
+    {
+      trace_dump(&huart1);
+      traceRequest = 0;
+    }
 
-  positionArr[0] = realTimePositions;
-  positionArrayIndex++;
+    // Send the scheduler statistics if requested
+    if (schedulerRequest)
+    {
+      scheduler_dump(&scheduler, &huart1);
+      schedulerRequest = 0;
+    }
 
-  uint8_t testFlag = 0x01;
+    // Give up on a configuration upload that stopped part way, and listen for commands again
+    HAL_NVIC_DisableIRQ(USART1_IRQn);
+    if (configReceiving && ((HAL_GetTick() - configTick) >= SITE_CONFIG_RX_TIMEOUT))
+    {
+      HAL_UART_AbortReceive(&huart1);
+      configReceiving = 0;
+      HAL_UART_Receive_IT(&huart1, uartbuf, sizeof(uartbuf));
+    }
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
 
-  /* USER CODE END 2 */
+    // Store an uploaded configuration, restarting with it
+    if (configRequest)
+    {
+      store_site_config(&huart1);
+      configRequest = 0;
+    }
 
-  /* Infinite loop */
-  /* USER CODE BEGIN WHILE */
-  while (1)
-  {
+    // Report the remote operation retry counters
+    if ((HAL_GetTick() - retryReportTime) >= RETRY_REPORT_PERIOD)
+    {
+      retry_report(&huart1);
+      retryReportTime = HAL_GetTick();
+    }
 
-    // Check for an interrupt
-    if (interruptFlag)
+    // Check for an interrupt, skipped while a tag holds the UWB slot as reading the interrupt
+    // status would clear the flag its position arrives with
+    if ((slotTag == NULL) && pozyx_int_pending())
     {
-      I2C_Read_Reg(&hi2c1, POZYX_INT_STATUS, rxBuffer, BYTE_SIZE_1);
-      if ((rxBuffer[0] & POZYX_INT_STATUS_ERR) == POZYX_INT_STATUS_ERR)
+      if (wait_for_interrupt(SLAVE_ADDR, &hi2c1, POZYX_INT_STATUS_ERR, 0, rxBuffer) == INTERRUPT)
       { // an error has occurred
       }
-      interruptFlag = 0;
     }
 
-    // Update positions and mass at 3.5Hz
-    if ((HAL_GetTick() - prevTime) >= 200)
+#if REMOTE_CONTINUOUS
+    // Drain the position the tag has sent by itself
+    if ((slotTag != NULL) && slotTag->request.pending && pozyx_int_pending() &&
+        ((positioningStatus = remote_continuous_collect(&hi2c1, &slotTag->request, &realTimePositions, &telemetry)) != POSITIONS_NOT_READY))
+    {
+      scheduler_complete(&scheduler, slotTag, positioningStatus, &telemetry);
+      fixTag = slotTag;
+#elif REMOTE_RANGING
+    // Range the tag holding the slot to the anchors of its zone and solve its position, freeing the slot
+    if (slotTag != NULL)
     {
+      uint32_t anchorMask = anchor_grid_mask(&anchorGrid, slotTag->anchorSet);
+      realTimePositions = slotTag->prevPositions; // solved from the last gated position
+      positioningStatus = remote_ranging_position(&hi2c1, slotTag->networkID, siteConfig.anchors, siteConfig.anchorCount,
+                                                  (anchorMask != 0) ? anchorMask : slotTag->deviceList,
+                                                  &realTimePositions, &covariance, &telemetry);
+      scheduler_complete(&scheduler, slotTag, positioningStatus, &telemetry);
+      fixTag = slotTag;
+      slotTag = NULL;
+#else
+    // Collect the position of the tag holding the slot once it has sent it back, freeing the slot
+    if ((slotTag != NULL) && remote_positioning_ready(&slotTag->request))
+    {
+      positioningStatus = remote_positioning_collect(&hi2c1, &slotTag->request, &realTimePositions, &covariance, &telemetry);
+      scheduler_complete(&scheduler, slotTag, positioningStatus, &telemetry);
+      fixTag = slotTag;
+      slotTag = NULL;
+#endif
+      if ((timing_cycles() - requestCycles) > worstCycle)
+      {
+        worstCycle = timing_cycles() - requestCycles;
+      }
+      trace_record(TRACE_POSITIONING, 0, 0, positioningStatus, requestCycles);
 
-      // Poll ADC
-      HAL_ADC_Start(&hadc1);
+      // Collect ADC result, converted while the tag was ranging
       HAL_ADC_PollForConversion(&hadc1, 100);
       adcResult = HAL_ADC_GetValue(&hadc1);
 
-      // perform remote positioning of tag 1. takes approx 140ms
-      if (remote_positioning(&hi2c1, tag1.networkID, &realTimePositions) != POSITIONS_RETRIEVED)
-      {
-        // error in positioning
-        prevTime = HAL_GetTick();
-        continue;
-      }
+#if I2C_WAIT_STATS
+      send_wait_stats(&huart1, worstCycle);
+#endif
 
-      uint32_t distanceChangeX, distanceChangeY;
+#if REMOTE_CONTINUOUS
+      // The next conversion and cycle run until the tag sends its next position
+      I2C_Wait_Stats_Reset();
+      HAL_ADC_Start(&hadc1);
+      requestCycles = timing_cycles();
+#endif
 
-      // Check if the tag has moved at least 0.35m in any direction and check for any errors
-      if (((distanceChangeX = labs(realTimePositions.posX - prevPositions.posX)) >= 350) |
-          ((distanceChangeY = labs(realTimePositions.posY - prevPositions.posY)) >= 350))
-      {
+      positionReady = 1;
+    }
 
-        if ((distanceChangeX < 400) & (distanceChangeY < 400))
-        {
-          if (readsSinceMovement < 200)
-          {
-            readsSinceMovement++;
-          }
-        }
-        else
+#if REMOTE_CONTINUOUS
+    // Restart continuous positioning of the first tag if it is not running, has stalled or the anchors
+    // need reassigning
+    if (((slotTag == NULL) || !slotTag->request.pending || (slotTag->anchorSet != slotTag->anchorTarget) ||
+         ((HAL_GetTick() - slotTag->request.requestTick) >= (REMOTE_POS_INTERVAL + REMOTE_POS_TIMEOUT))) &&
+        scheduler.tags[0].online && ((HAL_GetTick() - prevTime) >= FIX_PERIOD))
+    {
+      if ((slotTag != NULL) && slotTag->request.pending)
+      {
+        remote_continuous_stop(&hi2c1, &slotTag->request);
+      }
+      slotTag = &scheduler.tags[0];
+#else
+    // Give the free slot to the next tag due so it ranges while this position is gated and sent
+    if ((slotTag == NULL) && ((slotTag = scheduler_next(&scheduler)) != NULL))
+    {
+#endif
+#if REMOTE_RANGING
+      // The anchors to range to are picked from the zone on each fix, nothing is uploaded to the tag
+      slotTag->anchorSet = slotTag->anchorTarget;
+#else
+      // No other remote operation may overlap the ranging, so reassign anchors before the request
+      if (slotTag->anchorSet != slotTag->anchorTarget)
+      {
+        uint32_t switchStart = HAL_GetTick();
+        int uploaded = reassign_anchors(&hi2c1, slotTag, &anchorGrid, slotTag->anchorTarget);
+        if (uploaded >= 0)
         {
-          readsSinceMovement = 0;
+          slotTag->anchorSet = slotTag->anchorTarget;
         }
+        send_zone_switch(&huart1, slotTag, uploaded, HAL_GetTick() - switchStart);
+      }
+#endif
 
-        // Do the positions suggest crane is travelling faster than possible?
-        if ((distanceChangeX > (MAX_DISTANCE_TRAVELLED * readSinceLastPos)) | (distanceChangeY > (MAX_DISTANCE_TRAVELLED * readSinceLastPos)))
-        {
-          readSinceLastPos++;
-          prevTime = HAL_GetTick();
-          continue;
-        }
+      I2C_Wait_Stats_Reset();
 
-        // Are the calculated positions beyond the boundaries?
-        if ((realTimePositions.posX > (BAY_WIDTH_MAX + OFFSET)) || (realTimePositions.posX < (BAY_WIDTH_MIN - OFFSET)) ||
-            (realTimePositions.posY > (BAY_LENGTH_MAX + OFFSET)) || (realTimePositions.posY < (BAY_LENGTH_MIN - OFFSET)))
-        {
+      // Start the ADC conversion so it runs while the tag is ranging
+      HAL_ADC_Start(&hadc1);
 
-          readSinceLastPos++;
+      requestCycles = timing_cycles();
+#if REMOTE_CONTINUOUS
+      remote_continuous_start(&hi2c1, slotTag->networkID, REMOTE_POS_INTERVAL, &slotTag->request);
+      prevTime = HAL_GetTick();
+#elif REMOTE_RANGING
+      slotTag->request.requestTick = HAL_GetTick(); // ranged on the next pass through the loop
+#else
+      slotTag->request.timeout = scheduler_slot_length(slotTag);
+      if (remote_positioning_request(&hi2c1, slotTag->networkID, &slotTag->request) != POSITIONS_REQUESTED)
+      {
+        scheduler_complete(&scheduler, slotTag, BAD_FUNCTION_CALL, NULL);
+        slotTag = NULL;
+      }
+#endif
+    }
 
-          // Update prevPositions
-          prevPositions.posX = realTimePositions.posX;
-          prevPositions.posY = realTimePositions.posY;
+    // Try to start a tag that was offline while no tag needs the slot, one attempt per pass paced by the
+    // scheduler so the loop is only held for a single start up attempt
+    if ((slotTag == NULL) && ((offlineTag = scheduler_next_offline(&scheduler)) != NULL))
+    {
+      int initStatus = remote_tag_init(&hi2c1, offlineTag->networkID, 0);
+      if (scheduler_init_result(offlineTag, initStatus))
+      {
+        start_remote_tag(&hi2c1, &huart1, offlineTag);
+      }
+    }
 
-          prevTime = HAL_GetTick();
-          continue;
-        }
+#if REMOTE_IMU
+    // Carry a moving crane forward on its accelerometer while no tag needs the slot, corrected by its next position
+    if ((slotTag == NULL) && ((imuTag = scheduler_next_imu(&scheduler)) != NULL))
+    {
+      int16_t rawAcceleration[2];
+      float acceleration[2];
+      if (remote_read_acceleration(&hi2c1, imuTag->networkID, rawAcceleration) != GOOD_READ)
+      {
+        imuTag->imu.failures++;
       }
       else
       {
-        if (readsSinceMovement < 200)
+        uint8_t parked = (imuTag->motion == MOTION_PARKED);
+        imu_acceleration(&imuTag->imu, rawAcceleration, parked, acceleration);
+
+        // A parked crane is only sampled to learn the bias, it is still reported by its okay message
+        if (!parked)
         {
-          readsSinceMovement++; // Crane hasn't moved minimum distance
+          telemetry_t coastTelemetry;
+          memset(&coastTelemetry, '\0', sizeof(coastTelemetry));
+          coordinates_t coastPosition = imuTag->prevPositions;
+
+          kalman_propagate(&imuTag->filter, acceleration, HAL_GetTick());
+          kalman_state(&imuTag->filter, &coastPosition, &coastTelemetry.velX, &coastTelemetry.velY);
+          coastTelemetry.quality = QUALITY_UNKNOWN;
+          coastTelemetry.motion = imuTag->motion;
+          coastTelemetry.coasted = HAL_GetTick() - imuTag->filter.fixTick;
+          zigbee_send_data(&huart1, coastPosition, adcResult, imuTag->craneID, &coastTelemetry);
         }
       }
+    }
+#endif
+
+    // Filter and send the collected position
+    if (positionReady)
+    {
+      positionReady = 0;
 
-      // Reassign anchors if tag has moved past threshold
-      if ((realTimePositions.posY >= 30400) & !testFlag)
+      if (positioningStatus != POSITIONS_RETRIEVED)
       {
-        reassign_anchors(&hi2c1, anchor3, anchor4, anchor5, anchor6, anchor7, anchor8, tag1.networkID);
-        testFlag = 1;
+        // error in positioning, carry the filter forward so the next position is gated against where the crane should be
+        kalman_predict(&fixTag->filter, HAL_GetTick());
+        continue;
       }
-      else if ((realTimePositions.posY < 30400) & testFlag)
+
+      // Are the calculated positions beyond the boundaries?
+      if ((realTimePositions.posX > (siteConfig.bayWidthMax + siteConfig.bayMargin)) ||
+          (realTimePositions.posX < (siteConfig.bayWidthMin - siteConfig.bayMargin)) ||
+          (realTimePositions.posY > (siteConfig.bayLengthMax + siteConfig.bayMargin)) ||
+          (realTimePositions.posY < (siteConfig.bayLengthMin - siteConfig.bayMargin)))
       {
-        reassign_anchors(&hi2c1, anchor1, anchor2, anchor3, anchor4, anchor5, anchor6, tag1.networkID);
-        testFlag = 0;
+        fixTag->dropped++;
+        kalman_predict(&fixTag->filter, HAL_GetTick());
+        continue;
       }
 
-      // Check if the crane has moved in the last minute by at least 0.35m
-      if (readsSinceMovement >= 200)
+      // Score the position from its covariance, the poorest are dropped and the rest sent with their score
+      telemetry.quality = quality_score(fixCovariance);
+      if (telemetry.quality < QUALITY_REJECT)
       {
-        zigbee_send_okay(&huart1, CRANE_ID);
+        fixTag->dropped++;
+        kalman_predict(&fixTag->filter, HAL_GetTick());
+        continue;
       }
-      else
+
+      // Positions too far from where the filter expects the crane are dropped
+      if (kalman_update(&fixTag->filter, &realTimePositions, fixCovariance, HAL_GetTick()) != POSITIONS_RETRIEVED)
       {
-        zigbee_send_data(&huart1, realTimePositions, adcResult, CRANE_ID);
+        fixTag->dropped++;
+        continue;
       }
+      kalman_state(&fixTag->filter, &realTimePositions, &telemetry.velX, &telemetry.velY);
 
-      // Update prevPositions
-      prevPositions.posX = realTimePositions.posX;
-      prevPositions.posY = realTimePositions.posY;
+      // Keep the smoothed position in the window the stationary decision is made over
+      history_add(&fixTag->history, &realTimePositions, HAL_GetTick());
+
+      // Report the geofence zones the crane has entered or left
+      uint8_t fenceChanges = geofence_update(&geofence, &fixTag->fences, realTimePositions.posX, realTimePositions.posY);
+      if (fenceChanges != 0)
+      {
+        send_geofence_events(&huart1, fixTag, fenceChanges, adcResult);
+      }
+
+      // Reassign anchors if tag has moved clear of the zone boundary, done before the next request
+      fixTag->anchorTarget = anchor_grid_select(&anchorGrid, fixTag->anchorTarget, realTimePositions.posX,
+                                                realTimePositions.posY, ZONE_HYSTERESIS);
+
+      // Position the crane less often while it is parked, freeing UWB time for the other tags
+      telemetry.motion = scheduler_update_motion(fixTag);
 
-      // Update buffer with positions
-      if (positionArrayIndex < 10)
+      // Check if the crane has moved over the history window
+      if (telemetry.motion == MOTION_PARKED)
       {
-        positionArr[positionArrayIndex] = realTimePositions;
-        positionArrayIndex++;
+        zigbee_send_okay(&huart1, fixTag->craneID);
       }
       else
       {
-        for (int i = 0; i < positionArrayIndex; i++)
-        {
-          positionArr[9 - i] = positionArr[8 - i];
-        }
-        positionArr[0] = realTimePositions;
+        zigbee_send_data(&huart1, realTimePositions, adcResult, fixTag->craneID, &telemetry);
       }
 
-      readSinceLastPos = 1;
-
-      prevTime = HAL_GetTick();
+      // Update prevPositions
+      fixTag->prevPositions.posX = realTimePositions.posX;
+      fixTag->prevPositions.posY = realTimePositions.posY;
     }
     /* USER CODE END WHILE */
 
@@ -582,6 +760,24 @@ static void MX_USART1_UART_Init(void)
   /* USER CODE END USART1_Init 2 */
 }
 
+/**
+ * Enable DMA controller clock
+ */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 10, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 10, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+}
+
 /**
  * @brief GPIO Initialization Function
  * @param None
@@ -605,65 +801,216 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
-void reassign_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t a1, deviceCoords_t a2, deviceCoords_t a3, deviceCoords_t a4,
-                      deviceCoords_t a5, deviceCoords_t a6, uint16_t networkID)
+/** Bring a remote tag that has just started into the schedule, provisioning its anchors and sending its
+ *  start up position
+ *  @param hi2c pointer to i2c handle
+ *  @param huart pointer to uart handle
+ *  @param tag the remote tag
+ */
+void start_remote_tag(I2C_HandleTypeDef *hi2c, UART_HandleTypeDef *huart, craneTag_t *tag)
 {
+  coordinates_t startPosition;
+  memset(&startPosition, '\0', sizeof(startPosition));
+
+  // TEST RESPONSE //
+  uint8_t remoteInitOk[] = {'I', 'N', 'I', 'T', ' ', 'O', 'K', '\r', '\n'};
+  zigbee_send_other_data(huart, remoteInitOk, sizeof(remoteInitOk));
+  // TEST RESPONSE //
 
+  // Add anchors into remote tag memory and flash them, skipped if the tag already holds them
+  uint8_t remoteDeviceCount = (siteConfig.anchorCount < MAX_ANCHORS_IN_LIST) ? siteConfig.anchorCount : MAX_ANCHORS_IN_LIST;
+  int provisionStatus = remote_provision_devices(hi2c, tag->networkID, siteConfig.anchors, remoteDeviceCount);
+  if (provisionStatus > 0)
+  {
+    tag->deviceList = (remoteDeviceCount >= 32) ? 0xFFFFFFFF : ((1UL << remoteDeviceCount) - 1);
+  }
+
+  // TEST RESPONSE
+  uint8_t anchorsOk[] = {'A', 'N', 'C', 'H', 'O', 'R', 'S', ' ', 'O', 'K', '\r', '\n'};
+  uint8_t anchorsWarm[] = {'A', 'N', 'C', 'H', 'O', 'R', 'S', ' ', 'W', 'A', 'R', 'M', '\r', '\n'};
+  if (provisionStatus == DEVICES_MATCHED)
+  {
+    zigbee_send_other_data(huart, anchorsWarm, sizeof(anchorsWarm));
+  }
+  else
+  {
+    zigbee_send_other_data(huart, anchorsOk, sizeof(anchorsOk));
+  }
+  // TEST RESPONSE
+
+  // Set number of anchors on remote tag and flash it into remote tag memory, skipped if already set
+  configEntry_t remoteAnchors = {POZYX_POS_NUM_ANCHORS, (POZYX_ANCHOR_SEL_AUTO << 7) + siteConfig.numAnchors};
+  shadow_sync_remote(hi2c, tag->networkID, &remoteAnchors, 1, 1);
+
+  // Get start up position & send data
+  remote_positioning(hi2c, tag->networkID, &startPosition, NULL, NULL);
+  zigbee_send_data(huart, startPosition, 1000, tag->craneID, NULL);
+
+  tag->prevPositions.posX = startPosition.posX;
+  tag->prevPositions.posY = startPosition.posY;
+
+  history_add(&tag->history, &startPosition, HAL_GetTick());
+
+  // Positioned with every anchor until the first request selects the zone
+  tag->anchorTarget = anchor_grid_zone(&anchorGrid, startPosition.posX, startPosition.posY);
+  tag->anchorSet = ANCHOR_ZONE_NONE;
+}
+
+/** Switch the anchors a remote tag positions with to those of a zone. Only the anchors missing from
+ *  the device list of the tag are uploaded, the zone is then selected with a single function call
+ *  @param hi2c pointer to i2c handle
+ *  @param tag the remote tag
+ *  @param grid the anchor grid
+ *  @param zone the zone
+ *  @return < 0 for an error, otherwise the number of anchors uploaded
+ */
+int reassign_anchors(I2C_HandleTypeDef *hi2c, craneTag_t *tag, anchorGrid_t *grid, uint8_t zone)
+{
   uint8_t rxBuffer[10];
+  uint16_t anchorIDs[ANCHORS_PER_ZONE];
+  uint8_t anchorCount = 0;
+  uint32_t zoneMask = anchor_grid_mask(grid, zone);
+  int uploaded = 0;
+
   memset(rxBuffer, 0, sizeof(rxBuffer));
 
-  // Clear devices list
-  if (Remote_Function_Call_Read(hi2c, networkID, POZYX_DEVICES_CLEAR, NULL,
-                                0, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE)
+  // Start the device list again if it cannot hold the zone alongside the anchors already in it
+  if (__builtin_popcount(tag->deviceList | zoneMask) > MAX_ANCHORS_IN_LIST)
   {
-    return BAD_FUNCTION_CALL;
+    if (Remote_Function_Call_Read(hi2c, tag->networkID, POZYX_DEVICES_CLEAR, NULL,
+                                  0, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE)
+    {
+      return BAD_FUNCTION_CALL;
+    }
+    if (rxBuffer[1] != 0x01)
+    {
+      return BAD_FUNCTION_CALL;
+    }
+    tag->deviceList = 0;
+  }
+
+  for (uint8_t i = 0; (i < grid->anchorCount) && (anchorCount < ANCHORS_PER_ZONE); i++)
+  {
+    if (!(zoneMask & (1UL << i)))
+    {
+      continue;
+    }
+
+    // Add anchors into remote tag memory, only if not already there
+    if (!(tag->deviceList & (1UL << i)))
+    {
+      if (remote_add_anchors(hi2c, grid->anchors[i], tag->networkID) != DEVICE_ADDED)
+      {
+        return BAD_FUNCTION_CALL;
+      }
+      tag->deviceList |= (1UL << i);
+      uploaded++;
+    }
+    anchorIDs[anchorCount++] = grid->anchors[i].networkID;
   }
-  if (rxBuffer[1] != 0x01)
+
+  if (remote_set_anchor_ids(hi2c, tag->networkID, anchorIDs, anchorCount) != TRANSMITTED_MESSAGE)
   {
     return BAD_FUNCTION_CALL;
   }
 
-  // Add anchors into remote tag memory
-  remote_add_anchors(hi2c, a1, networkID);
-  remote_add_anchors(hi2c, a2, networkID);
-  remote_add_anchors(hi2c, a3, networkID);
-  remote_add_anchors(hi2c, a4, networkID);
-  remote_add_anchors(hi2c, a5, networkID);
-  remote_add_anchors(hi2c, a6, networkID);
+  return uploaded;
 }
 
-/**
- * @brief  Master Tx Transfer completed callback.
- * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
- *                the configuration information for the specified I2C.
- * @retval None
+/** Send the outcome of an anchor zone switch
+ *  @param huart pointer to uart handle
+ *  @param tag the remote tag
+ *  @param uploaded number of anchors uploaded, < 0 if the switch failed
+ *  @param switchTime time the switch took in ms
  */
-void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+void send_zone_switch(UART_HandleTypeDef *huart, craneTag_t *tag, int uploaded, uint32_t switchTime)
 {
-  /* Prevent unused argument(s) compilation warning */
-  UNUSED(hi2c);
+  char zoneArr[40];
 
-  /* NOTE : This function should not be modified, when the callback is needed,
-            the HAL_I2C_MasterTxCpltCallback could be implemented in the user file
-   */
+  // z = zone, c = crane, n = anchors uploaded or error, d = ms positioning was stalled
+  int zoneSize = snprintf(zoneArr, sizeof(zoneArr), ZIGBEE_STATUS_PREFIX "z%u c%u n%d d%lu\r\n", tag->anchorTarget, tag->craneID,
+                          uploaded, (unsigned long)switchTime);
+
+  zigbee_send_other_data(huart, (uint8_t *)zoneArr, zoneSize);
 }
 
-/**
- * @brief  Master Rx Transfer completed callback.
- * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
- *                the configuration information for the specified I2C.
- * @retval None
+/** Send an event for each geofence zone a crane has entered or left, as
+ *  "#g<zone> c<crane> e<1 entered, 0 left> k<kind of zone> l<load>"
+ *  @param huart pointer to uart handle
+ *  @param tag the tag of the crane
+ *  @param changed bit per zone entered or left
+ *  @param mass ADC strain of the load gauge
  */
-void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+void send_geofence_events(UART_HandleTypeDef *huart, craneTag_t *tag, uint8_t changed, uint32_t mass)
 {
-  /* Prevent unused argument(s) compilation warning */
-  UNUSED(hi2c);
+  char eventArr[40];
 
-  /* NOTE : This function should not be modified, when the callback is needed,
-            the HAL_I2C_MasterRxCpltCallback could be implemented in the user file
-   */
+  for (uint8_t zone = 0; zone < geofence.zoneCount; zone++)
+  {
+    if (!(changed & (1 << zone)))
+    {
+      continue;
+    }
+
+    // g = geofence zone, c = crane, e = 1 entered or 0 left, k = kind of zone, l = load, sent as a status
+    // frame so the host does not take the load for the mass of a position
+    int eventSize = snprintf(eventArr, sizeof(eventArr), ZIGBEE_STATUS_PREFIX "g%u c%u e%u k%u l%lu\r\n", zone, tag->craneID,
+                             (tag->fences.inside & (1 << zone)) ? 1 : 0, geofence.zones[zone].type, (unsigned long)mass);
+
+    zigbee_send_other_data(huart, (uint8_t *)eventArr, eventSize);
+  }
 }
 
+/** Check an uploaded configuration and store it in flash, sending the result as "#c<status>". The
+ *  board restarts once it is stored so every table is built from it again
+ *  @param huart pointer to uart handle
+ */
+void store_site_config(UART_HandleTypeDef *huart)
+{
+  char resultArr[16];
+  int status = INCORRECT_VALUE_ERROR;
+
+  // A block for another layout or with a bad CRC is never written over the stored one
+  if (site_config_valid(&configUpload))
+  {
+    status = site_config_save(&configUpload);
+  }
+
+  int resultSize = snprintf(resultArr, sizeof(resultArr), ZIGBEE_STATUS_PREFIX "c%d\r\n", status);
+  zigbee_send_other_data(huart, (uint8_t *)resultArr, resultSize);
+
+  if (status == GOOD_INIT)
+  {
+    NVIC_SystemReset();
+  }
+}
+
+#if I2C_WAIT_STATS
+/** Send the time the last positioning cycle spent waiting on the i2c bus
+ *  @param huart pointer to uart handle
+ */
+void send_wait_stats(UART_HandleTypeDef *huart, uint32_t worstCycle)
+{
+  i2cWaitStats_t stats;
+  i2cBusHealth_t health;
+  char statsArr[96];
+
+  I2C_Wait_Stats_Get(&stats);
+  I2C_Bus_Health_Get(&health);
+
+  // w = us blocked on the bus, r = us the pozyx was busy, p = busy polls, n = transactions,
+  // c = worst positioning cycle in us, t = transaction timeouts, v = bus recoveries
+  int statsSize = snprintf(statsArr, sizeof(statsArr), ZIGBEE_STATUS_PREFIX "w%lu r%lu p%lu n%lu c%lu t%lu v%lu\r\n",
+                           (unsigned long)timing_cycles_to_us(stats.blockedCycles),
+                           (unsigned long)timing_cycles_to_us(stats.readyCycles),
+                           (unsigned long)stats.readyPolls, (unsigned long)stats.transactions,
+                           (unsigned long)timing_cycles_to_us(worstCycle),
+                           (unsigned long)health.timeouts, (unsigned long)health.recoveries);
+
+  zigbee_send_other_data(huart, (uint8_t *)statsArr, statsSize);
+}
+#endif
+
 /** Set the appropriate parameters for a pozyx device
  *  @param networkID the networkID of the device
  *  @param flag the pozyx flag for the device indicating if it is an anchor or tag
@@ -690,7 +1037,51 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
   // Check if interrupt triggered is on appropriate pin
   if (GPIO_Pin == INT_PIN)
   {
-    interruptFlag = 1;
+    pozyx_int_callback();
+  }
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+
+  if (huart->Instance == USART1)
+  {
+    if (configReceiving)
+    {
+      // The whole configuration block has arrived
+      configReceiving = 0;
+      configRequest = 1;
+    }
+    else if (uartbuf[0] == TRACE_DUMP_COMMAND)
+    {
+      traceRequest = 1;
+    }
+    else if (uartbuf[0] == SCHED_DUMP_COMMAND)
+    {
+      schedulerRequest = 1;
+    }
+    else if ((uartbuf[0] == SITE_CONFIG_COMMAND) && !configRequest)
+    {
+      // The configuration block follows the command
+      configReceiving = 1;
+      configTick = HAL_GetTick();
+      HAL_UART_Receive_IT(huart, (uint8_t *)&configUpload, sizeof(configUpload));
+      return;
+    }
+    HAL_UART_Receive_IT(huart, uartbuf, sizeof(uartbuf)); // wait for the next command
+  }
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+
+  if (huart->Instance == USART1)
+  {
+    // An overrun or framing error aborts the reception, clear it and listen for commands again
+    configReceiving = 0;
+    __HAL_UART_CLEAR_FLAG(huart, UART_CLEAR_OREF | UART_CLEAR_NEF | UART_CLEAR_FEF | UART_CLEAR_PEF);
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    HAL_UART_Receive_IT(&huart1, uartbuf, sizeof(uartbuf));
   }
 }
 
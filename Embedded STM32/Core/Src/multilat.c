@@ -0,0 +1,217 @@
+/*
+**************************************************************************************************************
+* @file     multilat.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Solves the position of a tag from its ranges to the anchors
+**************************************************************************************************************
+*/
+
+#include "multilat.h"
+
+/** Get the weight of a range, the inverse of its variance
+ *  @param range the range
+ *  @return weight in 1/mm^2
+ */
+static float Range_Weight(const rangeMeasurement_t *range) {
+	float sigma = MULTILAT_SIGMA;
+
+	if (range->rss < MULTILAT_RSS_GOOD) {
+		sigma += (float) (MULTILAT_RSS_GOOD - range->rss) * MULTILAT_SIGMA_PER_DB;
+	}
+
+	return 1.0f / (sigma * sigma);
+}
+
+/** Get the residual of a range at a position, positive when the range is longer than the geometry
+ *  @param range the range
+ *  @param posX x position in mm
+ *  @param posY y position in mm
+ *  @param posZ z position in mm
+ *  @return residual in mm
+ */
+static float Range_Residual(const rangeMeasurement_t *range, float posX, float posY, float posZ) {
+	float dx = posX - range->posX;
+	float dy = posY - range->posY;
+	float dz = posZ - range->posZ;
+
+	return (float) range->distance - sqrtf((dx * dx) + (dy * dy) + (dz * dz));
+}
+
+/** Round a covariance entry to the nearest mm^2, saturating at the range of the POS_ERR registers
+ *  @param value covariance in mm^2
+ *  @return the rounded covariance
+ */
+static int16_t Covariance_Entry(float value) {
+	if (value > INT16_MAX) {
+		return INT16_MAX;
+	}
+	if (value < INT16_MIN) {
+		return INT16_MIN;
+	}
+	return lroundf(value);
+}
+
+/** Weighted Gauss-Newton least squares over the used ranges, moving x and y at a fixed z
+ *  @param ranges the ranges
+ *  @param rangeCount number of ranges
+ *  @param used bit per range to solve from
+ *  @param weight weight of each range
+ *  @param posX x position in mm, updated
+ *  @param posY y position in mm, updated
+ *  @param posZ z position in mm
+ *  @param information J'WJ of the last iteration as xx, xy, yy, the inverse of the position covariance
+ *  @return iterations taken, 0 if the anchors are in a line and do not fix a position
+ */
+static uint8_t Gauss_Newton(const rangeMeasurement_t *ranges, uint8_t rangeCount, uint32_t used,
+		const float *weight, float *posX, float *posY, float posZ, float information[3]) {
+
+	for (uint8_t iteration = 1; iteration <= MULTILAT_MAX_ITERATIONS; iteration++) {
+		//Normal equations (J'WJ) step = J'Wr, J'WJ is symmetric 2x2
+		float a11 = 0, a12 = 0, a22 = 0, b1 = 0, b2 = 0;
+
+		for (uint8_t i = 0; i < rangeCount; i++) {
+			if (!(used & (1UL << i))) {
+				continue;
+			}
+
+			float dx = *posX - ranges[i].posX;
+			float dy = *posY - ranges[i].posY;
+			float dz = posZ - ranges[i].posZ;
+			float distance = sqrtf((dx * dx) + (dy * dy) + (dz * dz));
+			if (distance < 1.0f) {
+				distance = 1.0f;		//on top of the anchor, any direction will do
+			}
+
+			float jx = dx / distance;
+			float jy = dy / distance;
+			float residual = (float) ranges[i].distance - distance;
+
+			a11 += weight[i] * jx * jx;
+			a12 += weight[i] * jx * jy;
+			a22 += weight[i] * jy * jy;
+			b1 += weight[i] * jx * residual;
+			b2 += weight[i] * jy * residual;
+		}
+
+		//Nearly singular when the anchors seen from the tag are in a line
+		float det = (a11 * a22) - (a12 * a12);
+		if (det <= (a11 * a22 * 1e-4f)) {
+			return 0;
+		}
+
+		information[0] = a11;
+		information[1] = a12;
+		information[2] = a22;
+
+		float stepX = ((a22 * b1) - (a12 * b2)) / det;
+		float stepY = ((a11 * b2) - (a12 * b1)) / det;
+		*posX += stepX;
+		*posY += stepY;
+
+		if (((stepX * stepX) + (stepY * stepY)) < (MULTILAT_CONVERGED * MULTILAT_CONVERGED)) {
+			return iteration;
+		}
+	}
+
+	return MULTILAT_MAX_ITERATIONS;
+}
+
+/** Solve the horizontal position of a tag from its ranges, at the fixed height of the starting position.
+ *  The ranges are weighted by their signal strength and the worst range is rejected while its residual
+ *  is an outlier and enough ranges remain
+ *  @param ranges the ranges, a distance of 0 marks a failed range
+ *  @param rangeCount number of ranges
+ *  @param position the starting position, set to the solved position
+ *  @param result struct to store the outcome, may be NULL
+ *  @return RANGING_ERROR if too few ranges or the anchors do not fix a position, otherwise POSITIONS_RETRIEVED
+ */
+int multilat_solve(const rangeMeasurement_t *ranges, uint8_t rangeCount, coordinates_t *position,
+		multilatResult_t *result) {
+	float weight[MULTILAT_MAX_RANGES];
+	float information[3];
+	uint32_t used = 0;
+	uint8_t usedCount = 0;
+	multilatResult_t outcome;
+	int errCode = POSITIONS_RETRIEVED;
+
+	memset(&outcome, '\0', sizeof (outcome));
+	if (rangeCount > MULTILAT_MAX_RANGES) {
+		rangeCount = MULTILAT_MAX_RANGES;
+	}
+
+	for (uint8_t i = 0; i < rangeCount; i++) {
+		if (ranges[i].distance == 0) {
+			continue;
+		}
+		weight[i] = Range_Weight(&ranges[i]);
+		used |= (1UL << i);
+		usedCount++;
+	}
+
+	float posX = position->posX;
+	float posY = position->posY;
+	float posZ = position->posZ;
+
+	while (1) {
+		if (usedCount < MULTILAT_MIN_RANGES) {
+			errCode = RANGING_ERROR;
+			break;
+		}
+
+		float solvedX = posX, solvedY = posY;
+		outcome.iterations = Gauss_Newton(ranges, rangeCount, used, weight, &solvedX, &solvedY, posZ, information);
+		if (outcome.iterations == 0) {
+			errCode = RANGING_ERROR;
+			break;
+		}
+
+		//Find the range furthest from the solution in standard deviations, non line of sight ranges run long
+		int8_t worst = -1;
+		float worstScore = 0, sumSquares = 0, sumScores = 0;
+		for (uint8_t i = 0; i < rangeCount; i++) {
+			if (!(used & (1UL << i))) {
+				continue;
+			}
+			float residual = Range_Residual(&ranges[i], solvedX, solvedY, posZ);
+			float score = residual * residual * weight[i];
+			sumSquares += residual * residual;
+			sumScores += score;
+			if (score > worstScore) {
+				worst = i;
+				worstScore = score;
+			}
+		}
+
+		if ((worst >= 0) && (worstScore > (MULTILAT_OUTLIER * MULTILAT_OUTLIER)) &&
+				(usedCount > MULTILAT_MIN_RANGES)) {
+			used &= ~(1UL << worst);
+			usedCount--;
+			outcome.rejectedMask |= (1UL << worst);
+			outcome.rejected++;
+			continue;		//solve again from the same start without the outlier
+		}
+
+		position->posX = lroundf(solvedX);
+		position->posY = lroundf(solvedY);
+		outcome.used = usedCount;
+		float rms = sqrtf(sumSquares / usedCount);
+		outcome.residual = (rms > 0xFFFF) ? 0xFFFF : lroundf(rms);
+
+		//Covariance of the position is the inverse of J'WJ, scaled up when the residuals show the ranges
+		//were noisier than their weights claimed
+		float variance = sumScores / (usedCount - 2);
+		float det = (information[0] * information[2]) - (information[1] * information[1]);
+		det /= (variance > 1.0f) ? variance : 1.0f;
+		outcome.covariance.errX = Covariance_Entry(information[2] / det);
+		outcome.covariance.errY = Covariance_Entry(information[0] / det);
+		outcome.covariance.errXY = Covariance_Entry(-information[1] / det);
+		break;
+	}
+
+	if (result != NULL) {
+		*result = outcome;
+	}
+
+	return errCode;
+}
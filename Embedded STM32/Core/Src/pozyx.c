@@ -9,142 +9,368 @@
 
 #include "pozyx.h"
 
-/** Initialise the master tag for operation
+static volatile uint8_t intPending;		//set by the EXTI callback when the INT line rises
+
+/* Configuration of the master tag, written through the register shadow */
+static const configEntry_t masterConfig[] = {
+	{ POZYX_INT_CONFIG, ((0x01) | (1 << 4) | (1 << 5)) },	//pin 9, push-pull, latch on and active high
+	{ POZYX_INT_MASK, ((1 << 0) | (1 << 1) | (1 << 3)) },	//new position, error and uwb data received
+	{ POZYX_POS_INTERVAL, 0x00 },							//continuous positioning off
+	{ POZYX_POS_INTERVAL + 1, 0x00 },
+	{ POZYX_POS_ALG, (POZYX_POS_ALG_UWB_ONLY | (POZYX_2D << 4)) },	//UWB only
+	{ POZYX_SENSORS_MODE, 0x00 },							//onboard sensors off
+	{ POZYX_POS_FILTER, (0x03 | (10 << 4)) },				//moving average filter with a strength of 3
+	{ POZYX_UWB_CHANNEL, 0x05 },							//UWB channel 5
+	{ POZYX_UWB_RATES, (0x00 | (0x02 << 6)) }				//100kbit/s and a PRF of 64MHz
+};
+
+/** Notify the driver that the pozyx INT line has been raised, call from the EXTI callback
+ */
+void pozyx_int_callback(void) {
+	intPending = 1;
+}
+
+/** Check if the pozyx INT line has been raised since the interrupt status was last read
+ *  @return 1 if an interrupt is pending, otherwise 0
+ */
+uint8_t pozyx_int_pending(void) {
+
+	//The line is latched high until INT_STATUS is read, so an edge missed while masked still shows
+	return (intPending || (HAL_GPIO_ReadPin(INT_PORT, INT_PIN) == GPIO_PIN_SET));
+}
+
+/** Clear the pending interrupt before INT_STATUS is read without wait_for_interrupt, so an edge during
+ *  the read is not lost
+ */
+void pozyx_int_acknowledge(void) {
+	intPending = 0;
+}
+
+/** Wait for the pozyx to raise one of the given interrupts. INT_STATUS is only read once the
+ *  INT line has been raised, reading it clears the line
  *  @param slaveAddr the address of the slave - this is typically 0x4B
  *  @param hi2c the i2c handle for master tag communication
- *  @return for an error in communication < 0, otherwise 1
+ *  @param mask the POZYX_INT_STATUS bits to wait for
+ *  @param timeout time to wait in ms, 0 to only check a pending interrupt
+ *  @param intStatus pointer to store the last INT_STATUS read, may be NULL
+ *  @return INTERRUPT if an interrupt in mask was raised, INT_ERR if the pozyx raised an error instead,
+ *  INT_TIMEOUT_ERROR if neither was raised in time, BAD_READ_ERROR for an error in communication
  */
-int master_tag_init(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c) {
-	HAL_StatusTypeDef errCode;
+int wait_for_interrupt(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint8_t mask, uint32_t timeout,
+		uint8_t *intStatus) {
+	uint32_t start = HAL_GetTick();
 	uint8_t buffer[1];
-	uint8_t rxBuffer[50];
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
 
-	HAL_Delay(500);	//wait for tag to power up
+	do {
+		if (!pozyx_int_pending()) {
+			I2C_Queue_Process();	//keep the i2c queue moving while waiting
+			continue;
+		}
 
-	//Check status registers
-	uint8_t statusRegErrCode = check_status_registers(slaveAddr, hi2c);
-	if (statusRegErrCode != GOOD_READ) {
-		return statusRegErrCode;
+		//Clear the flag before the read so an edge during the read is not lost
+		intPending = 0;
+		buffer[0] = 0x00;
+		if (I2C_Read_Reg(hi2c, POZYX_INT_STATUS, buffer, sizeof (buffer)) != HAL_OK) {
+			return BAD_READ_ERROR;
+		}
+		if (intStatus != NULL) {
+			*intStatus = buffer[0];
+		}
+
+		if (buffer[0] & mask) {
+			return INTERRUPT;
+		}
+		if (buffer[0] & POZYX_INT_STATUS_ERR) {
+			return INT_ERR;
+		}
+	} while ((HAL_GetTick() - start) < timeout);
+
+	return INT_TIMEOUT_ERROR;
+}
+
+/** Probe the master tag at the fastest i2c speed profile the clock allows, falling back to
+ *  slower profiles on NACKs or a bad WHO_AM_I
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @return the speed profile in use, or BAD_READ_ERROR if the tag does not respond at any speed
+ */
+int probe_bus_speed(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c) {
+	uint8_t buffer[1];
+
+	for (int profile = I2C_SPEED_COUNT - 1; profile >= I2C_SPEED_STANDARD; profile--) {
+		if (I2C_Set_Speed(hi2c, (i2cSpeedProfile_t) profile) != HAL_OK) {
+			continue;	//clock too slow for this profile
+		}
+
+		int reads;
+		for (reads = 0; reads < SPEED_PROBE_READS; reads++) {
+			memset(buffer, '\0', sizeof (buffer));
+			if ((I2C_Read_Reg(hi2c, POZYX_WHO_AM_I, buffer, sizeof (buffer)) != HAL_OK) ||
+					(buffer[0] != 0x43)) {
+				break;
+			}
+		}
+
+		if (reads == SPEED_PROBE_READS) {
+			return profile;
+		}
 	}
 
-	//Clear devices list
-	if ((errCode = I2C_Send_Function_Call(hi2c, slaveAddr, POZYX_DEVICES_CLEAR,
-			I2C_MEMADD_SIZE_8BIT, NULL, 0, rxBuffer, sizeof (rxBuffer), 10)) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
+	//Leave the bus at the slowest speed
+	I2C_Set_Speed(hi2c, I2C_SPEED_STANDARD);
+	return BAD_READ_ERROR;
+}
+
+/** Wait for the master tag to answer WHO_AM_I after power up
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param timeout longest to wait in ms
+ *  @return BAD_READ_ERROR if the tag did not answer in time, otherwise GOOD_READ
+ */
+int pozyx_wait_ready(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint32_t timeout) {
+	uint32_t start = HAL_GetTick();
+	uint8_t buffer[1];
+
+	do {
+		buffer[0] = 0x00;
+		if ((I2C_Read_Reg(hi2c, POZYX_WHO_AM_I, buffer, sizeof (buffer)) == HAL_OK) && (buffer[0] == 0x43)) {
+			return GOOD_READ;
+		}
+		HAL_Delay(POZYX_READY_POLL);
+	} while ((HAL_GetTick() - start) < timeout);
+
+	return BAD_READ_ERROR;
+}
+
+/** Add a device to the checksum of a device list, its network id then its coordinates
+ *  @param crc checksum so far, CRC16_INIT for the first device
+ *  @param device the device
+ *  @return updated checksum
+ */
+uint16_t device_crc_update(uint16_t crc, const deviceCoords_t *device) {
+	int32_t coordinates[3] = { device->posX, device->posY, device->posZ };
+	uint8_t record[2 + sizeof (coordinates)];
+
+	//Little endian, as the ids and coordinates are read back from the pozyx
+	record[0] = device->networkID & 0xFF;
+	record[1] = device->networkID >> 8;
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = 0; j < 4; j++) {
+			record[2 + (4 * i) + j] = ((uint32_t) coordinates[i] >> (8 * j)) & 0xFF;
+		}
 	}
 
-	//Configure interrupts to pin 9 on pozyx, push-pull, latch on and active high
-	buffer[0] = ((0x01) | (1 << 4) | (1 << 5));
-	if (I2C_Write_Reg(hi2c, POZYX_INT_CONFIG, buffer, sizeof (buffer)) != HAL_OK) {
-			return BAD_WRITE_ERROR;
+	return crc16_update(crc, record, sizeof (record));
+}
+
+/** Get the checksum of the network ids and coordinates of a device list, in the order the devices
+ *  are added
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return CRC-16 of the network ids and coordinates
+ */
+uint16_t device_list_crc(const deviceCoords_t *devices, uint8_t deviceCount) {
+	uint16_t crc = CRC16_INIT;
+
+	for (uint8_t i = 0; i < deviceCount; i++) {
+		crc = device_crc_update(crc, &devices[i]);
 	}
 
-	//Enable interrupts if a new position update is available, if error occurred or if data has been received via uwb
-	buffer[0] = ((1 << 0) | (1 << 1) | (1 << 3));
-	if (I2C_Write_Reg(hi2c, POZYX_INT_MASK, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	return crc;
+}
+
+/** Build a device read back from a pozyx out of its little endian network id and coordinates
+ *  @param networkID network id as read from DEVICES_GETIDS
+ *  @param coordinates x, y and z as read from DEVICE_GETCOORDS
+ *  @return the device, its flag is not stored by the pozyx and left 0
+ */
+deviceCoords_t stored_device(const uint8_t *networkID, const uint8_t *coordinates) {
+	deviceCoords_t device;
+	int32_t position[3];
+
+	for (uint8_t i = 0; i < 3; i++) {
+		position[i] = (int32_t) (coordinates[4 * i] | (coordinates[(4 * i) + 1] << 8) |
+				(coordinates[(4 * i) + 2] << 16) | ((uint32_t) coordinates[(4 * i) + 3] << 24));
 	}
 
-	//Turn off continuous positioning
-	buffer[0] = 0x00;
-	if (I2C_Write_Reg(hi2c, POZYX_POS_INTERVAL, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	device.networkID = networkID[0] | (networkID[1] << 8);
+	device.flag = 0;
+	device.posX = position[0];
+	device.posY = position[1];
+	device.posZ = position[2];
+
+	return device;
+}
+
+/** Make sure the device list of the master tag holds the given devices. The stored list is read
+ *  back and left as it is if it already matches, otherwise it is cleared and the devices are added
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return DEVICES_MATCHED if the list was kept, DEVICE_ADDED if it was rebuilt, < 0 for an error
+ */
+int master_provision_devices(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, const deviceCoords_t *devices,
+		uint8_t deviceCount) {
+	uint8_t rxBuffer[1 + (2 * MAX_ANCHORS_IN_LIST)];
+	uint8_t txBuffer[2];
+
+	if (deviceCount > MAX_ANCHORS_IN_LIST) {
+		return BAD_FUNCTION_CALL;
 	}
-	buffer[0] = 0x00;
-	if (I2C_Write_Reg(hi2c, POZYX_POS_INTERVAL + 1,	buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+
+	//Compare the number of devices and the checksum of their ids and coordinates with the expected list
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	if (I2C_Read_Reg(hi2c, POZYX_DEVICE_LIST_SIZE, rxBuffer, 1) != HAL_OK) {
+		return BAD_READ_ERROR;
+	}
+	if ((rxBuffer[0] == deviceCount) && (deviceCount > 0)) {
+		txBuffer[0] = 0;				//offset
+		txBuffer[1] = deviceCount;		//number of ids
+		if (I2C_Send_Function_Call(hi2c, slaveAddr, POZYX_DEVICES_GETIDS, I2C_MEMADD_SIZE_8BIT, txBuffer,
+				sizeof (txBuffer), rxBuffer, 1 + (2 * deviceCount), 10) != HAL_OK) {
+			return BAD_FUNCTION_CALL;
+		}
+		if (rxBuffer[0] == POZYX_SUCCESS) {
+			uint16_t crc = CRC16_INIT;
+			uint8_t i;
+
+			//Read back the coordinates stored for each id
+			for (i = 0; i < deviceCount; i++) {
+				uint8_t coordinates[1 + 12];
+				deviceCoords_t stored;
+
+				if (I2C_Send_Function_Call(hi2c, slaveAddr, POZYX_DEVICE_GETCOORDS, I2C_MEMADD_SIZE_8BIT,
+						rxBuffer + 1 + (2 * i), 2, coordinates, sizeof (coordinates), 10) != HAL_OK) {
+					return BAD_FUNCTION_CALL;
+				}
+				if (coordinates[0] != POZYX_SUCCESS) {
+					break;
+				}
+				stored = stored_device(rxBuffer + 1 + (2 * i), coordinates + 1);
+				crc = device_crc_update(crc, &stored);
+			}
+
+			if ((i == deviceCount) && (crc == device_list_crc(devices, deviceCount))) {
+				return DEVICES_MATCHED;
+			}
+		}
 	}
 
-	//Set position algorithm to UWB only
-	buffer[0] = (POZYX_POS_ALG_UWB_ONLY | (POZYX_2D << 4));
-	if (I2C_Write_Reg(hi2c, POZYX_POS_ALG, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	//Clear devices list
+	if (I2C_Send_Function_Call(hi2c, slaveAddr, POZYX_DEVICES_CLEAR, I2C_MEMADD_SIZE_8BIT, NULL, 0,
+			rxBuffer, 1, 10) != HAL_OK) {
+		return BAD_FUNCTION_CALL;
 	}
 
-	//Turn off onboard sensors
-	buffer[0] = 0x00;
-	if (I2C_Write_Reg(hi2c, POZYX_SENSORS_MODE, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	for (uint8_t i = 0; i < deviceCount; i++) {
+		if (add_anchors(slaveAddr, hi2c, devices[i]) != DEVICE_ADDED) {
+			return BAD_FUNCTION_CALL;
+		}
 	}
 
-	//Set moving average filter to a strength of 3
-	buffer[0] = (0x03 | (10 << 4));
-	if (I2C_Write_Reg(hi2c, POZYX_POS_FILTER, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	return DEVICE_ADDED;
+}
+
+/** Initialise the master tag for operation
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @return for an error in communication < 0, otherwise 1
+ */
+int master_tag_init(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c) {
+	//Wait for tag to power up
+	if (pozyx_wait_ready(slaveAddr, hi2c, 500) != GOOD_READ) {
+		return BAD_READ_ERROR;
 	}
 
-	//Set UWB channel to 0x05
-	buffer[0] = 0x05;
-	if (I2C_Write_Reg(hi2c, POZYX_UWB_CHANNEL, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	//Check status registers
+	uint8_t statusRegErrCode = check_status_registers(slaveAddr, hi2c);
+	if (statusRegErrCode != GOOD_READ) {
+		return statusRegErrCode;
 	}
 
-	//Set UWB bitrates to 100kbit/s and set PRF to 64MHz
-	buffer[0] = (0x00 | (0x02 << 6));
-	if (I2C_Write_Reg(hi2c, POZYX_UWB_RATES, buffer, sizeof (buffer)) != HAL_OK) {
-		return BAD_WRITE_ERROR;
+	//Write only the configuration registers that differ from the desired config
+	int configErrCode = shadow_sync_master(hi2c, slaveAddr, masterConfig,
+			sizeof (masterConfig) / sizeof (masterConfig[0]));
+	if (configErrCode < 0) {
+		return configErrCode;
 	}
 
 	return GOOD_INIT;
 }
 
-/** Retrieve the positions after a positioning command from the appropriate
- *  pozyx tag registers
- *  @param slaveAddr the address of the slav - this is typically 0x4B
+/** Read a block of consecutive registers from the master tag in a single i2c transaction
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
  *  @param hi2c the i2c handle for master tag communication
- *  @param coordinates a pointer to the coordinates struct to store the positions
+ *  @param firstReg the first register of the block
+ *  @param lastReg the last register of the block
+ *  @param rxData buffer to store the register values
+ *  @param rxSize size of rxData
  *  @return for an error < 0, otherwise > 0
  */
-int get_positions(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, coordinates_t *coordinates) {
-
-	uint8_t rxBufferX[4];
-	uint8_t rxBufferY[4];
-	uint8_t rxBufferZ[4];
-	uint8_t rxBuffer[1];
-
-	memset(rxBufferX, '\0', sizeof (rxBufferX));
-	memset(rxBufferY, '\0', sizeof (rxBufferY));
-	memset(rxBufferZ, '\0', sizeof (rxBufferZ));
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
-
-	for (int i = 1; i <= 4; i++) {
+int read_register_block(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, uint16_t firstReg, uint16_t lastReg,
+		uint8_t *rxData, uint16_t rxSize) {
 
-		//Get x positions
-		if (I2C_Read_Reg(hi2c, (POZYX_POS_X + (i - 1)),	rxBuffer, sizeof (rxBuffer)) != HAL_OK) {
+	//Check the block fits in the buffer and every register in it can be read
+	if ((lastReg < firstReg) || ((lastReg - firstReg + 1) > rxSize)) {
+		return BAD_READ_ERROR;
+	}
+	for (uint16_t reg = firstReg; reg <= lastReg; reg++) {
+		if (!IS_REG_READABLE(reg)) {
 			return BAD_READ_ERROR;
 		}
-		rxBufferX[i - 1] = rxBuffer[0];
-		memset(rxBuffer, '\0', sizeof (rxBuffer));
+	}
 
-		//Get y positions
-		if (I2C_Read_Reg(hi2c, (POZYX_POS_Y + (i - 1)),	rxBuffer, sizeof (rxBuffer)) != HAL_OK) {
-			return BAD_READ_ERROR;
-		}
-		rxBufferY[i - 1] = rxBuffer[0];
-		memset(rxBuffer, '\0', sizeof (rxBuffer));
+	//The pozyx auto increments the register address so the block is read in one go
+	HAL_StatusTypeDef status = I2C_Read_Reg(hi2c, firstReg, rxData, lastReg - firstReg + 1);
+	if (status == HAL_TIMEOUT) {
+		return BUS_TIMEOUT_ERROR;
+	} else if (status != HAL_OK) {
+		return BAD_READ_ERROR;
+	}
 
-		//Get z positions
-		if (I2C_Read_Reg(hi2c, (POZYX_POS_Z + (i - 1)), rxBuffer, sizeof (rxBuffer)) != HAL_OK) {
-			return BAD_READ_ERROR;
-		}
-		rxBufferZ[i - 1] = rxBuffer[0];
-		memset(rxBuffer, '\0', sizeof (rxBuffer));
+	return GOOD_READ;
+}
+
+/** Decode the positioning register block (POZYX_POS_X to POZYX_POS_ERR_YZ)
+ *  @param data the raw register block of POSITION_BLOCK_SIZE bytes
+ *  @param coordinates a pointer to the coordinates struct to store the positions
+ *  @param covariance a pointer to the covariance struct to store the errors, may be NULL
+ */
+void decode_position_block(uint8_t *data, coordinates_t *coordinates, covariance_t *covariance) {
 
+	//Registers are little endian, positions are 4 bytes and covariances 2 bytes
+	memcpy(&coordinates->posX, data + (POZYX_POS_X - POZYX_POS_X), sizeof (int32_t));
+	memcpy(&coordinates->posY, data + (POZYX_POS_Y - POZYX_POS_X), sizeof (int32_t));
+	memcpy(&coordinates->posZ, data + (POZYX_POS_Z - POZYX_POS_X), sizeof (int32_t));
+
+	if (covariance != NULL) {
+		memcpy(covariance, data + (POZYX_POS_ERR_X - POZYX_POS_X), sizeof (covariance_t));
 	}
+}
+
+/** Retrieve the positions after a positioning command from the appropriate
+ *  pozyx tag registers
+ *  @param slaveAddr the address of the slav - this is typically 0x4B
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param coordinates a pointer to the coordinates struct to store the positions
+ *  @param covariance a pointer to the covariance struct to store the errors, may be NULL
+ *  @return for an error < 0, otherwise > 0
+ */
+int get_positions(uint8_t slaveAddr, I2C_HandleTypeDef *hi2c, coordinates_t *coordinates, covariance_t *covariance) {
 
-	//Clear previous positions
-	coordinates->posX &= 0;
-	coordinates->posY &= 0;
-	coordinates->posZ &= 0;
+	uint8_t rxBuffer[POSITION_BLOCK_SIZE];
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
 
-	//write positions to struct
-	for (int j = 0; j < 4; j++) {
-		coordinates->posX |= (rxBufferX[j] << (j * 8));
-		coordinates->posY |= (rxBufferY[j] << (j * 8));
-		coordinates->posZ |= (rxBufferZ[j] << (j * 8));
+	//Read POS_X through POS_ERR_YZ in a single transaction
+	int errCode = read_register_block(slaveAddr, hi2c, POZYX_POS_X, POZYX_POS_ERR_YZ + 1,
+			rxBuffer, sizeof (rxBuffer));
+	if (errCode != GOOD_READ) {
+		return errCode;
 	}
 
+	decode_position_block(rxBuffer, coordinates, covariance);
+
 	return POSITIONS_RETRIEVED;
 }
 
@@ -0,0 +1,35 @@
+/*
+**************************************************************************************************************
+* @file     quality.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Scores the quality of a position from its error covariance
+**************************************************************************************************************
+*/
+
+#include "quality.h"
+
+/** Score a position from its error covariance, by its horizontal rms error sqrt(errX + errY)
+ *  @param covariance covariance of the position in mm^2, may be NULL
+ *  @return 0 for the worst to 100 for the best, QUALITY_UNKNOWN if the covariance is NULL or all zero
+ */
+uint8_t quality_score(const covariance_t *covariance) {
+	if ((covariance == NULL) || ((covariance->errX == 0) && (covariance->errY == 0))) {
+		return QUALITY_UNKNOWN;
+	}
+
+	//A negative variance means the pozyx could not estimate the error
+	if ((covariance->errX < 0) || (covariance->errY < 0)) {
+		return 0;
+	}
+
+	uint32_t error = lroundf(sqrtf((float) covariance->errX + covariance->errY));
+	if (error <= QUALITY_BEST_ERROR) {
+		return 100;
+	}
+	if (error >= QUALITY_WORST_ERROR) {
+		return 0;
+	}
+
+	return (100 * (QUALITY_WORST_ERROR - error)) / (QUALITY_WORST_ERROR - QUALITY_BEST_ERROR);
+}
@@ -0,0 +1,185 @@
+/*
+**************************************************************************************************************
+* @file     retry.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Bounded retry with backoff for remote UWB operations
+**************************************************************************************************************
+*/
+
+#include "retry.h"
+
+/* Retry policy of each retryOperation_t. A lost UWB packet is retried within a few ms, a tag that
+ * does not start is given time to power up */
+static const retryPolicy_t retryPolicies[RETRY_OP_COUNT] = {
+	{ 3, 5, 40 },			//RETRY_REMOTE_READ
+	{ 3, 5, 40 },			//RETRY_REMOTE_WRITE
+	{ 3, 5, 40 },			//RETRY_REMOTE_FUNCTION
+	{ 5, 500, 4000 }		//RETRY_REMOTE_INIT
+};
+
+/* Report character for each retryOperation_t */
+static const char retryOps[RETRY_OP_COUNT] = { 'r', 'w', 'f', 's' };
+
+/* Counters of a remote tag */
+typedef struct _retryRemote {
+	uint16_t networkAddr;
+	uint8_t used;
+	retryCounters_t counters[RETRY_OP_COUNT];
+} retryRemote_t;
+
+static retryRemote_t retryRemotes[RETRY_MAX_REMOTES];
+
+/** Find the counters of a remote tag, claiming a free entry if it has none
+ *  @param networkAddr network address of the remote tag
+ *  @param create 1 to claim a free entry if the tag has none
+ *  @return pointer to counters, NULL if not found or the table is full
+ */
+static retryRemote_t *Find_Remote(uint16_t networkAddr, uint8_t create) {
+	retryRemote_t *free = NULL;
+
+	for (uint8_t i = 0; i < RETRY_MAX_REMOTES; i++) {
+		if (retryRemotes[i].used && (retryRemotes[i].networkAddr == networkAddr)) {
+			return &retryRemotes[i];
+		}
+		if (!retryRemotes[i].used && (free == NULL)) {
+			free = &retryRemotes[i];
+		}
+	}
+
+	if (!create || (free == NULL)) {
+		return NULL;
+	}
+
+	memset(free, '\0', sizeof (retryRemote_t));
+	free->networkAddr = networkAddr;
+	free->used = 1;
+
+	return free;
+}
+
+/** Start an operation
+ *  @param state pointer to retry state
+ *  @param operation the operation
+ *  @param networkAddr network address of the remote tag
+ */
+void retry_start(retryState_t *state, retryOperation_t operation, uint16_t networkAddr) {
+	state->operation = operation;
+	state->networkAddr = networkAddr;
+	state->attempt = 0;
+	state->backoff = retryPolicies[operation].backoff;
+}
+
+/** Record the result of an attempt and decide whether to try again, without waiting out the backoff
+ *  @param state pointer to retry state
+ *  @param status result of the attempt, > 0 for success
+ *  @param wait pointer to the time to wait before the next attempt in ms, set if it should be attempted again
+ *  @return 1 if the operation should be attempted again, otherwise 0
+ */
+uint8_t retry_schedule(retryState_t *state, int status, uint32_t *wait) {
+	const retryPolicy_t *policy = &retryPolicies[state->operation];
+	retryRemote_t *remote = Find_Remote(state->networkAddr, 1);
+	retryCounters_t *counters = (remote != NULL) ? &remote->counters[state->operation] : NULL;
+
+	state->attempt++;
+
+	if (status > 0) {
+		if (counters != NULL) {
+			counters->successes++;
+		}
+		return 0;
+	}
+
+	if (state->attempt >= policy->attempts) {
+		if (counters != NULL) {
+			counters->failures++;
+		}
+		return 0;
+	}
+
+	if (counters != NULL) {
+		counters->retries++;
+	}
+
+	//Up to half the backoff again from the cycle counter, so tags that lost a packet together
+	//do not retry together
+	*wait = state->backoff + (timing_cycles() % ((state->backoff / 2) + 1));
+
+	state->backoff = ((state->backoff * 2) > policy->maxBackoff) ? policy->maxBackoff : (state->backoff * 2);
+
+	return 1;
+}
+
+/** Record the result of an attempt and decide whether to try again, waiting out the backoff if so
+ *  @param state pointer to retry state
+ *  @param status result of the attempt, > 0 for success
+ *  @return 1 if the operation should be attempted again, otherwise 0
+ */
+uint8_t retry_again(retryState_t *state, int status) {
+	uint32_t wait;
+
+	if (!retry_schedule(state, status, &wait)) {
+		return 0;
+	}
+
+	uint32_t start = HAL_GetTick();
+	while ((HAL_GetTick() - start) < wait) {
+		I2C_Queue_Process();	//keep the i2c queue moving while waiting
+	}
+
+	return 1;
+}
+
+/** Get the counters of an operation on a remote tag
+ *  @param networkAddr network address of the remote tag
+ *  @param operation the operation
+ *  @param counters pointer to struct to copy the counters to, zeroed if the tag has none
+ */
+void retry_get_counters(uint16_t networkAddr, retryOperation_t operation, retryCounters_t *counters) {
+	retryRemote_t *remote = Find_Remote(networkAddr, 0);
+
+	if (remote == NULL) {
+		memset(counters, '\0', sizeof (retryCounters_t));
+		return;
+	}
+
+	*counters = remote->counters[operation];
+}
+
+/** Reset the counters of every remote tag
+ */
+void retry_reset_counters(void) {
+	for (uint8_t i = 0; i < RETRY_MAX_REMOTES; i++) {
+		memset(retryRemotes[i].counters, '\0', sizeof (retryRemotes[i].counters));
+	}
+}
+
+/** Send the counters through zigbee, one frame per remote tag and operation that has been used,
+ *  as "#r<network address> o<operation> n<successes> a<retries> f<failures>" where the operation
+ *  is r/w/f/s for read, write, function and start up. The counters are reset once sent
+ *  @param huart pointer to uart handle
+ */
+void retry_report(UART_HandleTypeDef *huart) {
+	char frame[64];
+	int frameSize;
+
+	for (uint8_t i = 0; i < RETRY_MAX_REMOTES; i++) {
+		if (!retryRemotes[i].used) {
+			continue;
+		}
+
+		for (uint8_t op = 0; op < RETRY_OP_COUNT; op++) {
+			retryCounters_t *counters = &retryRemotes[i].counters[op];
+			if ((counters->successes + counters->retries + counters->failures) == 0) {
+				continue;
+			}
+
+			frameSize = snprintf(frame, sizeof (frame), ZIGBEE_STATUS_PREFIX "r%04x o%c n%lu a%lu f%lu\r\n",
+					retryRemotes[i].networkAddr, retryOps[op], (unsigned long) counters->successes,
+					(unsigned long) counters->retries, (unsigned long) counters->failures);
+			zigbee_send_other_data(huart, (uint8_t *) frame, frameSize);
+		}
+	}
+
+	retry_reset_counters();
+}
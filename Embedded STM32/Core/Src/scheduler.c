@@ -0,0 +1,373 @@
+/*
+**************************************************************************************************************
+* @file     scheduler.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Time slices UWB positioning between the remote tags of several cranes
+**************************************************************************************************************
+*/
+
+#include "scheduler.h"
+
+//Every tag keeps its own history, the window must stay small enough for all of them
+_Static_assert((SCHED_MAX_TAGS * sizeof (history_t)) <= HISTORY_RAM_BUDGET, "history of every tag exceeds HISTORY_RAM_BUDGET");
+
+/** Initialise an empty scheduler
+ *  @param scheduler pointer to scheduler
+ */
+void scheduler_init(scheduler_t *scheduler) {
+	memset(scheduler, '\0', sizeof (scheduler_t));
+	scheduler->statsTick = HAL_GetTick();
+}
+
+/** Add a remote tag to the scheduler
+ *  @param scheduler pointer to scheduler
+ *  @param networkID network address of the remote tag
+ *  @param craneID crane the tag is mounted on
+ *  @param period target time between positions in ms
+ *  @return the added tag, NULL if the table is full
+ */
+craneTag_t *scheduler_add(scheduler_t *scheduler, uint16_t networkID, uint8_t craneID, uint16_t period) {
+	if (scheduler->count >= SCHED_MAX_TAGS) {
+		return NULL;
+	}
+
+	craneTag_t *tag = &scheduler->tags[scheduler->count++];
+	memset(tag, '\0', sizeof (craneTag_t));
+	tag->networkID = networkID;
+	tag->craneID = craneID;
+	tag->period = period;
+	tag->travelPeriod = period;
+	tag->motion = MOTION_TRAVELLING;		//positioned at full rate until it is seen to be parked
+	tag->nextDue = HAL_GetTick();
+	tag->rangingTime = REMOTE_POS_TIMEOUT / SCHED_SLOT_MARGIN;		//nothing measured yet
+	kalman_init(&tag->filter, MAX_CRANE_SPEED);
+	history_init(&tag->history);
+	imu_init(&tag->imu, 0);
+
+	return tag;
+}
+
+/** Pick the tag to give the UWB slot to, earliest deadline first among the tags that are due
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next(scheduler_t *scheduler) {
+	uint32_t now = HAL_GetTick();
+	craneTag_t *next = NULL;
+	uint32_t nextLateness = 0;
+
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		craneTag_t *tag = &scheduler->tags[i];
+		if (!tag->online) {
+			continue;
+		}
+
+		//Signed difference so the comparison survives the tick wrapping
+		int32_t lateness = (int32_t) (now - tag->nextDue);
+		if (lateness < 0) {
+			continue;
+		}
+		if ((next == NULL) || ((uint32_t) lateness > nextLateness)) {
+			next = tag;
+			nextLateness = lateness;
+		}
+	}
+
+	if (next == NULL) {
+		return NULL;
+	}
+
+	if (nextLateness > next->worstLateness) {
+		next->worstLateness = nextLateness;
+	}
+
+	//Keep the cadence unless a whole period has been missed
+	if (nextLateness >= next->period) {
+		next->late++;
+		next->nextDue = now + next->period;
+	} else {
+		next->nextDue += next->period;
+	}
+
+	return next;
+}
+
+/** Pick the tag to sample the accelerometer of while the UWB slot is free, the longest waiting among the
+ *  tags being tracked. A moving crane is sampled every REMOTE_IMU_PERIOD until IMU_MAX_COAST after its
+ *  last position, a parked crane every IMU_BIAS_PERIOD
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next_imu(scheduler_t *scheduler) {
+	uint32_t now = HAL_GetTick();
+	craneTag_t *next = NULL;
+	uint32_t nextWait = 0;
+
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		craneTag_t *tag = &scheduler->tags[i];
+		if (!tag->online || !tag->filter.initialised) {
+			continue;
+		}
+
+		uint32_t sinceFix = now - tag->filter.fixTick;
+		if ((tag->motion != MOTION_PARKED) && (sinceFix > IMU_MAX_COAST)) {
+			continue;
+		}
+
+		//A position is as fresh as a sample, so wait a full period after either
+		uint32_t wait = now - tag->imu.tick;
+		if (sinceFix < wait) {
+			wait = sinceFix;
+		}
+		if (wait < ((tag->motion == MOTION_PARKED) ? IMU_BIAS_PERIOD : REMOTE_IMU_PERIOD)) {
+			continue;
+		}
+		if ((next == NULL) || (wait > nextWait)) {
+			next = tag;
+			nextWait = wait;
+		}
+	}
+
+	if (next != NULL) {
+		next->imu.tick = now;
+	}
+
+	return next;
+}
+
+/** Take a tag out of the schedule after it failed to start, the next round of start up attempts is
+ *  due SCHED_OFFLINE_PERIOD later
+ *  @param tag the tag
+ */
+void scheduler_set_offline(craneTag_t *tag) {
+	tag->online = 0;
+	tag->initDue = HAL_GetTick() + SCHED_OFFLINE_PERIOD;
+	retry_start(&tag->initRetry, RETRY_REMOTE_INIT, tag->networkID);
+}
+
+/** Pick the offline tag to attempt to start while the UWB slot is free, the longest overdue among the
+ *  tags due a start up attempt
+ *  @param scheduler pointer to scheduler
+ *  @return the tag, NULL if no tag is due
+ */
+craneTag_t *scheduler_next_offline(scheduler_t *scheduler) {
+	uint32_t now = HAL_GetTick();
+	craneTag_t *next = NULL;
+	uint32_t nextLateness = 0;
+
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		craneTag_t *tag = &scheduler->tags[i];
+		if (tag->online) {
+			continue;
+		}
+
+		//Signed difference so the comparison survives the tick wrapping
+		int32_t lateness = (int32_t) (now - tag->initDue);
+		if (lateness < 0) {
+			continue;
+		}
+		if ((next == NULL) || ((uint32_t) lateness > nextLateness)) {
+			next = tag;
+			nextLateness = lateness;
+		}
+	}
+
+	return next;
+}
+
+/** Record the result of a start up attempt of an offline tag. A tag that started is scheduled straight
+ *  away, otherwise the next attempt is set by the RETRY_REMOTE_INIT policy, starting a new round
+ *  SCHED_OFFLINE_PERIOD later once the attempts of the policy are used up
+ *  @param tag the tag
+ *  @param status result of the start up attempt
+ *  @return 1 if the tag is online, otherwise 0
+ */
+uint8_t scheduler_init_result(craneTag_t *tag, int status) {
+	uint32_t wait;
+
+	if (retry_schedule(&tag->initRetry, status, &wait)) {
+		tag->initDue = HAL_GetTick() + wait;
+		return 0;
+	}
+
+	if (status <= 0) {
+		scheduler_set_offline(tag);
+		return 0;
+	}
+
+	tag->online = 1;
+	tag->nextDue = HAL_GetTick();
+
+	return 1;
+}
+
+/** Get the time a tag is given to send back its position, adapted to its measured ranging time
+ *  @param tag the tag
+ *  @return slot length in ms
+ */
+uint32_t scheduler_slot_length(craneTag_t *tag) {
+	uint32_t slot = tag->rangingTime * SCHED_SLOT_MARGIN;
+
+	if (slot < SCHED_MIN_SLOT) {
+		return SCHED_MIN_SLOT;
+	}
+	if (slot > REMOTE_POS_TIMEOUT) {
+		return REMOTE_POS_TIMEOUT;
+	}
+	return slot;
+}
+
+/** Release the UWB slot held by a tag and update its statistics
+ *  @param scheduler pointer to scheduler
+ *  @param tag the tag
+ *  @param status result of the positioning
+ *  @param telemetry telemetry of the positioning, may be NULL
+ */
+void scheduler_complete(scheduler_t *scheduler, craneTag_t *tag, int status, telemetry_t *telemetry) {
+	scheduler->busyTime += HAL_GetTick() - tag->request.requestTick;
+
+	if ((status == POSITIONS_RETRIEVED) && (telemetry != NULL)) {
+		tag->fixes++;
+		tag->rangingTime += ((int32_t) (telemetry->positioningTime - tag->rangingTime)) >> SCHED_RANGING_SHIFT;
+		return;
+	}
+
+	if (status == POSITIONS_RETRIEVED) {
+		tag->fixes++;
+		return;
+	}
+
+	tag->failures++;
+
+	//A slot that ran out may have been too short, widen it for the next attempt
+	if (status == POSITIONS_NOT_READY) {
+		tag->rangingTime = scheduler_slot_length(tag);
+	}
+}
+
+/** Update the motion state of a crane from its latest position and set the period it is positioned at,
+ *  slowing down to SCHED_PARKED_PERIOD once parked
+ *  @param tag the tag
+ *  @return the motion state
+ */
+motionState_t scheduler_update_motion(craneTag_t *tag) {
+	uint32_t speed = kalman_speed(&tag->filter);
+	motionState_t motion = tag->motion;
+
+	if (speed >= SCHED_TRAVEL_SPEED) {
+		motion = MOTION_TRAVELLING;
+	} else if (history_still(&tag->history, STILL_SPAN)) {
+		motion = MOTION_PARKED;
+	} else if ((motion != MOTION_TRAVELLING) || (speed < (SCHED_TRAVEL_SPEED / 2))) {
+		motion = MOTION_CREEPING;
+	}
+
+	if (motion == tag->motion) {
+		return motion;
+	}
+
+	tag->motion = motion;
+	tag->motionChanges++;
+
+	switch (motion) {
+		case MOTION_PARKED:
+			tag->period = SCHED_PARKED_PERIOD;
+			break;
+		case MOTION_CREEPING:
+			tag->period = (tag->travelPeriod > SCHED_CREEPING_PERIOD) ? tag->travelPeriod : SCHED_CREEPING_PERIOD;
+			break;
+		default:
+			tag->period = tag->travelPeriod;
+			break;
+	}
+
+	//A crane that has started moving is due at its new period, not the slow one it was scheduled with
+	uint32_t due = HAL_GetTick() + tag->period;
+	if ((int32_t) (tag->nextDue - due) > 0) {
+		tag->nextDue = due;
+	}
+
+	return motion;
+}
+
+/** Estimate how many tags the master tag can sustain at a given period from the slots measured so far
+ *  @param scheduler pointer to scheduler
+ *  @param period target time between positions of each tag in ms
+ *  @return number of tags
+ */
+uint8_t scheduler_capacity(scheduler_t *scheduler, uint16_t period) {
+	uint32_t slots = 0;
+	uint32_t slotTime = 0;
+
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		slots += scheduler->tags[i].fixes + scheduler->tags[i].failures;
+		slotTime += scheduler->tags[i].rangingTime;
+	}
+
+	//Average slot held so far, the running ranging time until a slot has completed
+	if (slots > 0) {
+		slotTime = scheduler->busyTime / slots;
+	} else if (scheduler->count > 0) {
+		slotTime /= scheduler->count;
+	}
+
+	if (slotTime == 0) {
+		return SCHED_MAX_TAGS;
+	}
+	return ((period / slotTime) > 0xFF) ? 0xFF : (period / slotTime);
+}
+
+/** Reset the statistics of the scheduler and every tag
+ *  @param scheduler pointer to scheduler
+ */
+void scheduler_reset_stats(scheduler_t *scheduler) {
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		craneTag_t *tag = &scheduler->tags[i];
+		tag->fixes = 0;
+		tag->failures = 0;
+		tag->dropped = 0;
+		tag->late = 0;
+		tag->motionChanges = 0;
+		tag->worstLateness = 0;
+	}
+
+	scheduler->busyTime = 0;
+	scheduler->statsTick = HAL_GetTick();
+}
+
+/** Send the scheduler statistics through zigbee. The first frame is
+ *  "#sn<tags> u<utilisation permille> a<capacity at SCHED_DEFAULT_PERIOD>", then each tag is sent as
+ *  "#s<index> c<crane> p<period> r<rate mHz> g<ranging ms> n<fixes> f<failures> d<dropped> l<late>
+ *  w<worst lateness ms> o<motion state> h<motion changes>".
+ *  The statistics are reset once sent
+ *  @param scheduler pointer to scheduler
+ *  @param huart pointer to uart handle
+ */
+void scheduler_dump(scheduler_t *scheduler, UART_HandleTypeDef *huart) {
+	char frame[128];
+	int frameSize;
+	uint32_t elapsed = HAL_GetTick() - scheduler->statsTick;
+
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+
+	frameSize = snprintf(frame, sizeof (frame), ZIGBEE_STATUS_PREFIX "sn%u u%lu a%u\r\n", scheduler->count,
+			(unsigned long) ((scheduler->busyTime * 1000) / elapsed),
+			scheduler_capacity(scheduler, SCHED_DEFAULT_PERIOD));
+	zigbee_send_other_data(huart, (uint8_t *) frame, frameSize);
+
+	for (uint8_t i = 0; i < scheduler->count; i++) {
+		craneTag_t *tag = &scheduler->tags[i];
+
+		frameSize = snprintf(frame, sizeof (frame), ZIGBEE_STATUS_PREFIX "s%u c%u p%u r%lu g%lu n%lu f%lu d%lu l%lu w%lu o%u h%lu\r\n",
+				i, tag->craneID, tag->period, (unsigned long) (((uint64_t) tag->fixes * 1000000) / elapsed),
+				(unsigned long) tag->rangingTime, (unsigned long) tag->fixes,
+				(unsigned long) tag->failures, (unsigned long) tag->dropped, (unsigned long) tag->late,
+				(unsigned long) tag->worstLateness, tag->motion, (unsigned long) tag->motionChanges);
+		zigbee_send_other_data(huart, (uint8_t *) frame, frameSize);
+	}
+
+	scheduler_reset_stats(scheduler);
+}
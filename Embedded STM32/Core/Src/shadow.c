@@ -0,0 +1,241 @@
+/*
+**************************************************************************************************************
+* @file     shadow.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Shadow cache of the Pozyx configuration registers
+**************************************************************************************************************
+*/
+
+#include "shadow.h"
+
+#define SHADOW_BIT(reg) (1UL << ((reg) - SHADOW_FIRST_REG))
+
+static configShadow_t masterShadow;
+static configShadow_t remoteShadows[SHADOW_MAX_REMOTES];
+static uint8_t remoteShadowCount;
+
+/** Read the master tag configuration registers into its shadow. INT_CONFIG and POS_FILTER are
+ *  not adjacent so the registers are read in two bursts
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param slaveAddr the address of the slave
+ *  @return for an error < 0, otherwise > 0
+ */
+static int shadow_read_master(I2C_HandleTypeDef *hi2c, uint8_t slaveAddr) {
+	int errCode;
+
+	if ((errCode = read_register_block(slaveAddr, hi2c, POZYX_INT_MASK, POZYX_INT_CONFIG,
+			masterShadow.regs, POZYX_INT_CONFIG - SHADOW_FIRST_REG + 1)) != GOOD_READ) {
+		return errCode;
+	}
+	if ((errCode = read_register_block(slaveAddr, hi2c, POZYX_POS_FILTER, SHADOW_LAST_REG,
+			masterShadow.regs + (POZYX_POS_FILTER - SHADOW_FIRST_REG),
+			SHADOW_LAST_REG - POZYX_POS_FILTER + 1)) != GOOD_READ) {
+		return errCode;
+	}
+
+	masterShadow.known = (SHADOW_BIT(POZYX_INT_MASK) | SHADOW_BIT(POZYX_INT_CONFIG));
+	for (uint8_t reg = POZYX_POS_FILTER; reg <= SHADOW_LAST_REG; reg++) {
+		masterShadow.known |= SHADOW_BIT(reg);
+	}
+
+	return GOOD_READ;
+}
+
+/** Read the remote tag configuration registers into its shadow in one UWB message
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param shadow the shadow of the remote tag
+ *  @return for an error < 0, otherwise > 0
+ */
+static int shadow_read_remote(I2C_HandleTypeDef *hi2c, configShadow_t *shadow) {
+	uint8_t rxBuffer[SHADOW_LAST_REG - SHADOW_REMOTE_FIRST_REG + 2];
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
+
+	//rxBuffer[0] holds the result of the remote read
+	if (Remote_Read_Reg_Read(hi2c, shadow->networkAddr, SHADOW_REMOTE_FIRST_REG, rxBuffer,
+			sizeof (rxBuffer), sizeof (rxBuffer) - 1) != TRANSMITTED_MESSAGE) {
+		return BAD_READ_ERROR;
+	}
+	if (rxBuffer[0] == POZYX_FAILURE) {
+		return BAD_READ_ERROR;
+	}
+
+	memcpy(shadow->regs + (SHADOW_REMOTE_FIRST_REG - SHADOW_FIRST_REG), rxBuffer + 1, sizeof (rxBuffer) - 1);
+	for (uint8_t reg = SHADOW_REMOTE_FIRST_REG; reg <= SHADOW_LAST_REG; reg++) {
+		shadow->known |= SHADOW_BIT(reg);
+	}
+
+	return GOOD_READ;
+}
+
+/** Work out which registers of a shadow need to be written to reach the given config
+ *  @param shadow the shadow of the tag
+ *  @param config desired register values
+ *  @param configSize number of entries in config
+ *  @param desired buffer of SHADOW_SIZE to store the desired register values
+ *  @param dirty bit per register that must be written
+ *  @return BAD_WRITE_ERROR if an entry is outside the shadow or not writable, otherwise GOOD_READ
+ */
+static int shadow_dirty(configShadow_t *shadow, const configEntry_t *config, uint8_t configSize,
+		uint8_t *desired, uint32_t *dirty) {
+	*dirty = 0;
+
+	memcpy(desired, shadow->regs, SHADOW_SIZE);
+	for (uint8_t i = 0; i < configSize; i++) {
+		if ((config[i].reg < SHADOW_FIRST_REG) || (config[i].reg > SHADOW_LAST_REG) ||
+				!IS_REG_WRITABLE(config[i].reg)) {
+			return BAD_WRITE_ERROR;
+		}
+
+		desired[config[i].reg - SHADOW_FIRST_REG] = config[i].value;
+		if (!(shadow->known & SHADOW_BIT(config[i].reg)) ||
+				(shadow->regs[config[i].reg - SHADOW_FIRST_REG] != config[i].value)) {
+			*dirty |= SHADOW_BIT(config[i].reg);
+		}
+	}
+
+	return GOOD_READ;
+}
+
+/** Get the length of the run of dirty registers starting at a register
+ *  @param dirty bit per register that must be written
+ *  @param first the first register of the run
+ *  @return number of consecutive dirty registers
+ */
+static uint8_t shadow_run(uint32_t dirty, uint8_t first) {
+	uint8_t length = 0;
+
+	while (((first + length) <= SHADOW_LAST_REG) && (dirty & SHADOW_BIT(first + length))) {
+		length++;
+	}
+	return length;
+}
+
+/** Bring the configuration registers of the master tag in line with the given config. The
+ *  registers are read back in bursts the first time, then only registers that differ are
+ *  written, consecutive registers in a single transaction
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param slaveAddr the address of the slave - this is typically 0x4B
+ *  @param config desired register values
+ *  @param configSize number of entries in config
+ *  @return for an error < 0, otherwise the number of registers written
+ */
+int shadow_sync_master(I2C_HandleTypeDef *hi2c, uint8_t slaveAddr, const configEntry_t *config, uint8_t configSize) {
+	uint8_t desired[SHADOW_SIZE];
+	uint32_t dirty;
+	int errCode, written = 0;
+
+	if (masterShadow.known == 0) {
+		if ((errCode = shadow_read_master(hi2c, slaveAddr)) != GOOD_READ) {
+			return errCode;
+		}
+	}
+
+	if ((errCode = shadow_dirty(&masterShadow, config, configSize, desired, &dirty)) != GOOD_READ) {
+		return errCode;
+	}
+
+	for (uint8_t reg = SHADOW_FIRST_REG; reg <= SHADOW_LAST_REG; reg++) {
+		uint8_t length = shadow_run(dirty, reg);
+		if (length == 0) {
+			continue;
+		}
+
+		if (I2C_Write_Reg(hi2c, reg, desired + (reg - SHADOW_FIRST_REG), length) != HAL_OK) {
+			masterShadow.known = 0;		//unknown how much of the write landed
+			return BAD_WRITE_ERROR;
+		}
+
+		memcpy(masterShadow.regs + (reg - SHADOW_FIRST_REG), desired + (reg - SHADOW_FIRST_REG), length);
+		written += length;
+		reg += length;
+	}
+
+	return written;
+}
+
+/** Bring the configuration registers of a remote tag in line with the given config. The
+ *  registers are read back in one UWB message the first time, then only registers that differ
+ *  are written and flashed
+ *  @param hi2c the i2c handle for master tag communication
+ *  @param networkAddr network address of the remote tag
+ *  @param config desired register values
+ *  @param configSize number of entries in config
+ *  @param flash 1 to save the written registers to the flash of the remote tag
+ *  @return for an error < 0, otherwise the number of registers written
+ */
+int shadow_sync_remote(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const configEntry_t *config,
+		uint8_t configSize, uint8_t flash) {
+	configShadow_t *shadow = NULL;
+	uint8_t desired[SHADOW_SIZE];
+	uint8_t flashRegs[SHADOW_SIZE];
+	uint8_t rxBuffer[2];
+	uint32_t dirty;
+	int errCode, written = 0;
+
+	//Find the shadow of the tag, or start a new one
+	for (uint8_t i = 0; i < remoteShadowCount; i++) {
+		if (remoteShadows[i].networkAddr == networkAddr) {
+			shadow = &remoteShadows[i];
+		}
+	}
+	if (shadow == NULL) {
+		if (remoteShadowCount >= SHADOW_MAX_REMOTES) {
+			return BAD_READ_ERROR;
+		}
+		shadow = &remoteShadows[remoteShadowCount++];
+		memset(shadow, '\0', sizeof (configShadow_t));
+		shadow->networkAddr = networkAddr;
+	}
+
+	if (shadow->known == 0) {
+		if ((errCode = shadow_read_remote(hi2c, shadow)) != GOOD_READ) {
+			return errCode;
+		}
+	}
+
+	if ((errCode = shadow_dirty(shadow, config, configSize, desired, &dirty)) != GOOD_READ) {
+		return errCode;
+	}
+
+	for (uint8_t reg = SHADOW_FIRST_REG; reg <= SHADOW_LAST_REG; reg++) {
+		uint8_t length = shadow_run(dirty, reg);
+		if (length == 0) {
+			continue;
+		}
+
+		memset(rxBuffer, '\0', sizeof (rxBuffer));
+		if ((Remote_Write_Reg_Read(hi2c, networkAddr, reg, desired + (reg - SHADOW_FIRST_REG), length,
+				rxBuffer, sizeof (rxBuffer)) != TRANSMITTED_MESSAGE) || (rxBuffer[0] == POZYX_FAILURE)) {
+			shadow->known = 0;
+			return BAD_WRITE_ERROR;
+		}
+
+		memcpy(shadow->regs + (reg - SHADOW_FIRST_REG), desired + (reg - SHADOW_FIRST_REG), length);
+		for (uint8_t i = 0; i < length; i++) {
+			flashRegs[written++] = reg + i;
+		}
+		reg += length;
+	}
+
+	//Save every written register in a single flash operation
+	if (flash && (written > 0)) {
+		if (remote_flash_registers(hi2c, networkAddr, flashRegs, written) != GOOD_READ) {
+			return BAD_FUNCTION_CALL;
+		}
+	}
+
+	return written;
+}
+
+/** Forget the shadowed registers of a remote tag that may have been reset, so they are read back
+ *  on the next sync
+ *  @param networkAddr network address of the remote tag
+ */
+void shadow_invalidate_remote(uint16_t networkAddr) {
+	for (uint8_t i = 0; i < remoteShadowCount; i++) {
+		if (remoteShadows[i].networkAddr == networkAddr) {
+			remoteShadows[i].known = 0;
+		}
+	}
+}
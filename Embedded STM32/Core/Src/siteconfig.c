@@ -0,0 +1,141 @@
+/*
+**************************************************************************************************************
+* @file     siteconfig.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Configuration of the bay, anchors and cranes, stored in its own flash page
+**************************************************************************************************************
+*/
+
+#include "siteconfig.h"
+
+siteConfig_t siteConfig;
+
+//The zone table makes the block large, it must still fit the one page erased for it
+_Static_assert(sizeof (siteConfig_t) <= FLASH_PAGE_SIZE, "siteConfig_t does not fit in its flash page");
+
+/* Built in anchors, used until a configuration is stored */
+static const deviceCoords_t defaultAnchors[] = {
+	// network id, flag, x, y, z in mm
+	{ 0x1172, ANCHOR_FLAG, 100, 100, 5000 },
+	{ 0x1114, ANCHOR_FLAG, 21860, 0, 5000 },
+	{ 0x1103, ANCHOR_FLAG, 0, 15200, 5000 },
+	{ 0x1131, ANCHOR_FLAG, 21860, 15200, 5000 },
+	{ 0x6830, ANCHOR_FLAG, 0, 30400, 5000 },
+	{ 0x1152, ANCHOR_FLAG, 21860, 30400, 5000 },
+	{ 0x6846, ANCHOR_FLAG, 0, 45600, 5000 },
+	{ 0x6842, ANCHOR_FLAG, 21860, 45600, 5000 },
+};
+
+/* Built in remote tags */
+static const craneTagConfig_t defaultTags[] = {
+	{ 0x6875, CRANE_ID, FIX_PERIOD, 0 },
+};
+
+/** Get the CRC of a configuration
+ *  @param config pointer to configuration
+ *  @return CRC-32 of every byte before the crc field
+ */
+static uint32_t Config_Crc(const siteConfig_t *config) {
+	return ~crc32_update(CRC32_INIT, (const uint8_t *) config, offsetof(siteConfig_t, crc));
+}
+
+/** Check a configuration can be used, its header and CRC match this firmware and its tables fit
+ *  @param config pointer to configuration
+ *  @return 1 if valid, otherwise 0
+ */
+uint8_t site_config_valid(const siteConfig_t *config) {
+	return ((config->magic == SITE_CONFIG_MAGIC) && (config->version == SITE_CONFIG_VERSION) &&
+			(config->size == sizeof (siteConfig_t)) && (config->crc == Config_Crc(config)) &&
+			(config->anchorCount <= ANCHOR_TABLE_MAX) && (config->tagCount <= SCHED_MAX_TAGS) &&
+			(config->fenceCount <= GEOFENCE_MAX_ZONES));
+}
+
+/** Fill a configuration with the built in defaults
+ *  @param config pointer to configuration
+ */
+void site_config_defaults(siteConfig_t *config) {
+	memset(config, '\0', sizeof (siteConfig_t));
+
+	config->bayWidthMin = BAY_WIDTH_MIN;
+	config->bayWidthMax = BAY_WIDTH_MAX;
+	config->bayLengthMin = BAY_LENGTH_MIN;
+	config->bayLengthMax = BAY_LENGTH_MAX;
+	config->bayMargin = OFFSET;
+	config->maxCraneSpeed = MAX_CRANE_SPEED;
+
+	config->numAnchors = NUM_ANCHORS;
+	config->anchorCount = sizeof (defaultAnchors) / sizeof (defaultAnchors[0]);
+	memcpy(config->anchors, defaultAnchors, sizeof (defaultAnchors));
+	config->tagCount = sizeof (defaultTags) / sizeof (defaultTags[0]);
+	memcpy(config->tags, defaultTags, sizeof (defaultTags));
+	config->fenceCount = 0;					//no zones until the surveyed ones are uploaded with SITE_CONFIG_COMMAND
+
+	config->magic = SITE_CONFIG_MAGIC;
+	config->version = SITE_CONFIG_VERSION;
+	config->size = sizeof (siteConfig_t);
+	config->crc = Config_Crc(config);
+}
+
+/** Store a configuration in flash, setting its header and CRC
+ *  @param config pointer to configuration
+ *  @return BAD_WRITE_ERROR if the page could not be erased or programmed, otherwise GOOD_INIT
+ */
+int site_config_save(siteConfig_t *config) {
+	FLASH_EraseInitTypeDef erase;
+	uint32_t pageError;
+	uint64_t doubleWord;
+	int errCode = GOOD_INIT;
+
+	config->magic = SITE_CONFIG_MAGIC;
+	config->version = SITE_CONFIG_VERSION;
+	config->size = sizeof (siteConfig_t);
+	config->crc = Config_Crc(config);
+
+	if (HAL_FLASH_Unlock() != HAL_OK) {
+		return BAD_WRITE_ERROR;
+	}
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Banks = FLASH_BANK_1;
+	erase.Page = SITE_CONFIG_PAGE;
+	erase.NbPages = 1;
+	if (HAL_FLASHEx_Erase(&erase, &pageError) != HAL_OK) {
+		errCode = BAD_WRITE_ERROR;
+	}
+
+	//Flash is programmed a double word at a time, the struct is padded to a whole number of them
+	for (uint32_t offset = 0; (errCode == GOOD_INIT) && (offset < sizeof (siteConfig_t)); offset += sizeof (doubleWord)) {
+		memcpy(&doubleWord, (uint8_t *) config + offset, sizeof (doubleWord));
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, SITE_CONFIG_ADDR + offset, doubleWord) != HAL_OK) {
+			errCode = BAD_WRITE_ERROR;
+		}
+	}
+
+	HAL_FLASH_Lock();
+
+	return errCode;
+}
+
+/** Load the configuration from flash into siteConfig, falling back to the built in defaults if the
+ *  stored block is missing, of another version or corrupt. The defaults are stored if the page is blank
+ *  @return SITE_CONFIG_STORED if read from flash, otherwise SITE_CONFIG_DEFAULT
+ */
+int site_config_load(void) {
+	const siteConfig_t *stored = (const siteConfig_t *) SITE_CONFIG_ADDR;
+
+	if (site_config_valid(stored)) {
+		memcpy(&siteConfig, stored, sizeof (siteConfig_t));
+		return SITE_CONFIG_STORED;
+	}
+
+	site_config_defaults(&siteConfig);
+
+	//Only a blank page is written, a block of another version may still be wanted by another firmware
+	if (stored->magic == 0xFFFFFFFF) {
+		site_config_save(&siteConfig);
+	}
+
+	return SITE_CONFIG_DEFAULT;
+}
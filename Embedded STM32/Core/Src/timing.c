@@ -0,0 +1,43 @@
+/*
+**************************************************************************************************************
+* @file     timing.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Cycle accurate timing using the DWT cycle counter
+**************************************************************************************************************
+*/
+
+#include "timing.h"
+
+/** Enable the DWT cycle counter
+ */
+void timing_init(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;		//enable trace so the DWT can run
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/** Get the current value of the DWT cycle counter
+ *  @return number of core clock cycles since the counter was enabled (wraps)
+ */
+uint32_t timing_cycles(void) {
+	return DWT->CYCCNT;
+}
+
+/** Convert a number of core clock cycles to microseconds
+ *  @param cycles number of cycles
+ *  @return time in microseconds
+ */
+uint32_t timing_cycles_to_us(uint32_t cycles) {
+	return (uint32_t) (((uint64_t) cycles * 1000000) / SystemCoreClock);
+}
+
+/** Busy wait for a number of microseconds using the cycle counter
+ *  @param us time to wait in microseconds
+ */
+void timing_delay_us(uint32_t us) {
+	uint32_t start = timing_cycles();
+	uint32_t cycles = us * (SystemCoreClock / 1000000);
+
+	while ((timing_cycles() - start) < cycles);
+}
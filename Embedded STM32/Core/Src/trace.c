@@ -0,0 +1,96 @@
+/*
+**************************************************************************************************************
+* @file     trace.c
+* @author   Ryan Lederhose
+* @date     07/02/2023
+* @brief    Ring buffer trace of i2c and remote UWB operations
+**************************************************************************************************************
+*/
+
+#include "trace.h"
+
+#if TRACE_ENABLED
+static traceRecord_t traceBuffer[TRACE_LENGTH];
+static uint32_t traceHead;			//total number of records written, wraps
+static uint32_t traceTail;			//total number of records dumped or cleared
+
+/* Dump character for each traceType_t */
+static const char traceOps[] = { 'w', 'r', 'f', 'W', 'R', 'F', 'P' };
+#endif
+
+/** Add a record to the trace buffer, overwriting the oldest record when full. Safe to call
+ *  from an interrupt
+ *  @param type the traced operation
+ *  @param reg register address
+ *  @param size number of bytes transferred
+ *  @param status HAL status or driver error code of the operation
+ *  @param start DWT cycle count at the start of the operation
+ */
+void trace_record(traceType_t type, uint16_t reg, uint16_t size, int status, uint32_t start) {
+#if TRACE_ENABLED
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	traceRecord_t *record = &traceBuffer[traceHead & (TRACE_LENGTH - 1)];
+	record->start = start;
+	record->end = timing_cycles();
+	record->reg = reg;
+	record->size = size;
+	record->type = type;
+	record->status = status;
+	traceHead++;
+
+	__set_PRIMASK(primask);
+#endif
+}
+
+/** Discard every record in the trace buffer
+ */
+void trace_clear(void) {
+#if TRACE_ENABLED
+	traceTail = traceHead;
+#endif
+}
+
+/** Send the trace buffer through zigbee, oldest record first, one frame per record.
+ *  The first frame is "#tn<records> o<overwritten>", then each record is sent as
+ *  "#t<seq> <op><reg> n<size> s<status> a<start us> d<duration us>" where op is
+ *  w/r/f for the master tag, W/R/F for a remote tag and P for a positioning cycle.
+ *  The buffer is cleared once sent
+ *  @param huart pointer to uart handle
+ */
+void trace_dump(UART_HandleTypeDef *huart) {
+#if TRACE_ENABLED
+	traceRecord_t record;
+	char frame[64];
+	int frameSize;
+	uint32_t lost = 0;
+	uint32_t head = traceHead;
+
+	//Records older than the buffer length have been overwritten
+	if ((head - traceTail) > TRACE_LENGTH) {
+		lost = head - traceTail - TRACE_LENGTH;
+		traceTail = head - TRACE_LENGTH;
+	}
+
+	frameSize = snprintf(frame, sizeof (frame), ZIGBEE_STATUS_PREFIX "tn%lu o%lu\r\n", (unsigned long) (head - traceTail),
+			(unsigned long) lost);
+	zigbee_send_other_data(huart, (uint8_t *) frame, frameSize);
+
+	//Start times are sent relative to the oldest record to keep the frames short
+	uint32_t origin = traceBuffer[traceTail & (TRACE_LENGTH - 1)].start;
+
+	for (uint32_t seq = 0; traceTail != head; seq++, traceTail++) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		record = traceBuffer[traceTail & (TRACE_LENGTH - 1)];
+		__set_PRIMASK(primask);
+
+		frameSize = snprintf(frame, sizeof (frame), ZIGBEE_STATUS_PREFIX "t%lu %c%02x n%u s%d a%lu d%lu\r\n",
+				(unsigned long) seq, traceOps[record.type], record.reg, record.size, record.status,
+				(unsigned long) timing_cycles_to_us(record.start - origin),
+				(unsigned long) timing_cycles_to_us(record.end - record.start));
+		zigbee_send_other_data(huart, (uint8_t *) frame, frameSize);
+	}
+#endif
+}
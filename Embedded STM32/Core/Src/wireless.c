@@ -9,113 +9,287 @@
 
 #include "wireless.h"
 
-/** Remotely connect to a tag specified by the given network address and write to  a register at the given
- *  memory address
+/* Configuration of the remote tag, written and flashed through the register shadow */
+static const configEntry_t remoteConfig[] = {
+	{ POZYX_POS_ALG, (POZYX_POS_ALG_UWB_ONLY | (DIMENSION << 4)) },	//UWB only
+	{ POZYX_SENSORS_MODE, REMOTE_SENSORS_MODE },			//on board sensors off unless dead reckoning
+	{ POZYX_POS_FILTER, (0x04 | (10 << 4)) }				//moving average filter with a strength of 10
+};
+
+/* Steps of a remote operation */
+typedef enum {
+	REMOTE_OP_IDLE,
+	REMOTE_OP_SENDING,			//TX_DATA, INT_STATUS clear and TX_SEND chain queued
+	REMOTE_OP_WAITING,			//waiting for the INT line to signal the reply
+	REMOTE_OP_CHECKING,			//INT_STATUS read queued
+	REMOTE_OP_READING,			//RX_DATA read queued
+	REMOTE_OP_DONE
+} remoteOpState_t;
+
+/* A message sent to a remote tag over UWB and its reply read back. Each step is queued from the
+ * completion callback of the last, so the caller only blocks if it waits on the operation. The struct
+ * and the reply buffer must stay valid until the operation is done */
+typedef struct _remoteOp {
+	I2C_HandleTypeDef *hi2c;
+	uint16_t networkAddr;		//network address of the tag
+	remoteOpState_t state;
+	int status;					//result once done, TRANSMITTED_MESSAGE or < 0 for an error
+	uint8_t operation;			//0x02 read, 0x04 write or 0x08 function call, 0 to only read a reply
+	uint8_t traceRegister;		//remote register and size for the trace
+	uint16_t traceSize;
+	uint8_t *rxData;			//buffer the reply is read into, NULL to not wait for a reply
+	uint16_t rxSize;
+	uint32_t waitTick;			//tick the wait for the reply started
+	uint32_t startCycles;		//cycle count the operation started
+	uint8_t results[3];			//TX_DATA result, INT_STATUS and TX_SEND result
+	i2cTransaction_t transactions[3];
+} remoteOp_t;
+
+/* Positioning command of the outstanding positioning request, only the tag holding the UWB slot
+ * is positioning */
+typedef struct _positioningCommand {
+	remoteOp_t op;
+	uint8_t reply[2];			//reply of the positioning command
+	retryState_t retry;			//attempts of the positioning command
+} positioningCommand_t;
+
+static positioningCommand_t positioningCommand;
+
+/** Finish a remote operation
+ *  @param op the remote operation
+ *  @param status result of the operation
+ */
+static void Remote_Op_Finish(remoteOp_t *op, int status) {
+	op->status = status;
+	op->state = REMOTE_OP_DONE;
+}
+
+static void Remote_Op_Complete(i2cTransaction_t *transaction);
+
+/** Queue the next step of a remote operation, its completion moves the operation on
+ *  @param op the remote operation
+ *  @param state the step being queued
+ */
+static void Remote_Op_Submit(remoteOp_t *op, remoteOpState_t state) {
+	op->state = state;
+	op->transactions[0].callback = Remote_Op_Complete;
+	op->transactions[0].context = op;
+
+	if (I2C_Queue_Submit(op->hi2c, &op->transactions[0]) != HAL_OK) {
+		Remote_Op_Finish(op, BAD_FUNCTION_CALL);
+	}
+}
+
+/** Called from I2C_Queue_Process once a step of a remote operation is off the bus
+ *  @param transaction the first transaction of the step
+ */
+static void Remote_Op_Complete(i2cTransaction_t *transaction) {
+	remoteOp_t *op = (remoteOp_t *) transaction->context;
+	HAL_StatusTypeDef status = I2C_Queue_Status(transaction);
+
+	switch (op->state) {
+		case REMOTE_OP_SENDING:
+			//A read sends the number of bytes, writes and function calls their data
+			trace_record((op->operation == 0x02) ? TRACE_REMOTE_READ :
+					((op->operation == 0x04) ? TRACE_REMOTE_WRITE : TRACE_REMOTE_FUNCTION),
+					op->traceRegister, op->traceSize, status, op->startCycles);
+
+			if (status == HAL_TIMEOUT) {
+				Remote_Op_Finish(op, BUS_TIMEOUT_ERROR);
+			} else if (status != HAL_OK) {
+				Remote_Op_Finish(op, BAD_FUNCTION_CALL);
+			} else if (op->rxData == NULL) {
+				Remote_Op_Finish(op, TRANSMITTED_MESSAGE);
+			} else {
+				op->waitTick = HAL_GetTick();
+				op->state = REMOTE_OP_WAITING;
+			}
+			break;
+
+		case REMOTE_OP_CHECKING:
+			if (status != HAL_OK) {
+				Remote_Op_Finish(op, BAD_READ_ERROR);
+			} else if (op->results[1] & POZYX_INT_STATUS_RX_DATA) {
+				//The reply has arrived, read it out of RX_DATA from the start of the buffer
+				uint8_t offset[1] = { 0x00 };
+				I2C_Prepare_Function_Call(&op->transactions[0], SLAVE_ADDR, POZYX_RX_DATA, offset,
+						sizeof (offset), op->rxData, op->rxSize);
+				op->transactions[0].timeout = 10;
+				Remote_Op_Submit(op, REMOTE_OP_READING);
+			} else if (op->results[1] & POZYX_INT_STATUS_ERR) {
+				Remote_Op_Finish(op, INT_ERR);
+			} else {
+				op->state = REMOTE_OP_WAITING;
+			}
+			break;
+
+		case REMOTE_OP_READING:
+			Remote_Op_Finish(op, (status == HAL_OK) ? TRANSMITTED_MESSAGE : BAD_FUNCTION_CALL);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/** Start loading a data buffer into TX_DATA on the master tag and sending it over UWB to a remote tag.
+ *  The TX_DATA call, clearing of the interrupt status register and the TX_SEND call are queued as
+ *  one i2c chain so they run back to back, the reply is then read once the INT line signals it
+ *  @param op the remote operation
  *  @param hi2c pointer to i2c handle
  *  @param networkAddr network address of the tag
- *  @param MemAddress memory address of regiter
- *  @param txData data to be written to register
+ *  @param txData data to load into TX_DATA, including the buffer offset
  *  @param txSize size of txData
+ *  @param operation remote operation to perform with the data
+ *  @param rxData buffer to read the reply into, NULL to finish once the message is sent
+ *  @param rxSize size of rxData
  */
-int Remote_Write_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint8_t *txData, uint16_t txSize) {
+static void Remote_Op_Start(remoteOp_t *op, I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint8_t *txData,
+		uint16_t txSize, uint8_t operation, uint8_t *rxData, uint16_t rxSize) {
+	uint8_t txBuffer[3];
 
-	uint8_t rxData[1];
-	uint8_t txBuffer[3 + txSize];
-	memset(txBuffer, '\0', sizeof (txBuffer));
+	op->hi2c = hi2c;
+	op->networkAddr = networkAddr;
+	op->operation = operation;
+	op->rxData = rxData;
+	op->rxSize = rxSize;
+	op->startCycles = timing_cycles();
 
-	txBuffer[0] = 0x00;
-	txBuffer[1] = MemAddress;
-	if (txData != NULL) {
-		memcpy(txBuffer + 2, txData, txSize);
-	}
+	//txData holds the buffer offset then the remote register, a read sends the number of bytes
+	op->traceRegister = txData[1];
+	op->traceSize = (operation == 0x02) ? txData[2] : (txSize - 2);
 
-	//Clear interrupt status register
-	I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxData, sizeof (rxData));
-	memset(rxData, '\0', sizeof (rxData));
+	txBuffer[0] = (networkAddr & 0xFF);
+	txBuffer[1] = ((networkAddr & (0xFF << 8)) >> 8);
+	txBuffer[2] = operation;
 
 	//Populate data buffer TX_DATA in master tag
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_DATA,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, BYTE_SIZE_2, rxData, sizeof (rxData), 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
+	if (I2C_Prepare_Function_Call(&op->transactions[0], SLAVE_ADDR, POZYX_TX_DATA, txData, txSize,
+			&op->results[0], 1) != HAL_OK) {
+		Remote_Op_Finish(op, BAD_FUNCTION_CALL);
+		return;
 	}
+	op->transactions[0].checkResult = 1;
 
-	//Check for error in function
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
-	}
+	//Clear interrupt status register
+	I2C_Prepare_Read(&op->transactions[1], POZYX_INT_STATUS, &op->results[1], 1);
 
-	memset(txBuffer, '\0', sizeof (txBuffer));
-	txBuffer[0] = (networkAddr & 0xFF);
-	txBuffer[1] = ((networkAddr & (0xFF << 8)) >> 8);
-	txBuffer[2] = 0x04;
+	//Send data remotely to given network address
+	I2C_Prepare_Function_Call(&op->transactions[2], SLAVE_ADDR, POZYX_TX_SEND, txBuffer, sizeof (txBuffer),
+			&op->results[2], 1);
+	op->transactions[2].checkResult = 1;
 
-	//Send data remotely to give network address
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_SEND,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, BYTE_SIZE_3, rxData, sizeof (rxData), 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
+	op->transactions[0].next = &op->transactions[1];
+	op->transactions[1].next = &op->transactions[2];
+
+	Remote_Op_Submit(op, REMOTE_OP_SENDING);
+}
+
+/** Start waiting for a reply from a remote tag, it is read out of RX_DATA once the INT line signals it
+ *  @param op the remote operation
+ *  @param hi2c pointer to i2c handle
+ *  @param rxData buffer to read the reply into
+ *  @param rxSize size of rxData
+ */
+static void Remote_Op_Receive(remoteOp_t *op, I2C_HandleTypeDef *hi2c, uint8_t *rxData, uint16_t rxSize) {
+	op->hi2c = hi2c;
+	op->operation = 0;
+	op->rxData = rxData;
+	op->rxSize = rxSize;
+	op->startCycles = timing_cycles();
+	op->waitTick = HAL_GetTick();
+	op->state = REMOTE_OP_WAITING;
+}
+
+/** Advance a remote operation waiting on the INT line, failing it if the reply has not arrived within
+ *  REMOTE_RX_TIMEOUT. The i2c steps are advanced by I2C_Queue_Process
+ *  @param op the remote operation
+ *  @return 1 once the operation is done, otherwise 0
+ */
+static uint8_t Remote_Op_Poll(remoteOp_t *op) {
+
+	if (op->state == REMOTE_OP_WAITING) {
+		if (pozyx_int_pending()) {
+			//Reading INT_STATUS clears the line, the completion checks what was raised
+			pozyx_int_acknowledge();
+			I2C_Prepare_Read(&op->transactions[0], POZYX_INT_STATUS, &op->results[1], 1);
+			Remote_Op_Submit(op, REMOTE_OP_CHECKING);
+		} else if ((HAL_GetTick() - op->waitTick) >= REMOTE_RX_TIMEOUT) {
+			Remote_Op_Finish(op, INT_TIMEOUT_ERROR);
+		}
 	}
 
-	//Check for error
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
+	return (op->state == REMOTE_OP_DONE);
+}
+
+/** Block until a remote operation is done, for start up and configuration
+ *  @param op the remote operation
+ *  @return result of the operation
+ */
+static int Remote_Op_Wait(remoteOp_t *op) {
+	while (!Remote_Op_Poll(op)) {
+		I2C_Queue_Process();
 	}
 
-	return TRANSMITTED_MESSAGE;
+	return op->status;
 }
 
-/** Remotely connect to a tag specified by the given network address and read a register at the given
+/** Load a data buffer into TX_DATA on the master tag and send it over UWB to a remote tag, waiting
+ *  until it is sent
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr network address of the tag
+ *  @param txData data to load into TX_DATA, including the buffer offset
+ *  @param txSize size of txData
+ *  @param operation remote operation to perform with the data
+ *  @return < 0 for an error, otherwise > 0
+ */
+static int Remote_Transmit(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint8_t *txData,
+		uint16_t txSize, uint8_t operation) {
+	remoteOp_t op;
+
+	Remote_Op_Start(&op, hi2c, networkAddr, txData, txSize, operation, NULL, 0);
+
+	return Remote_Op_Wait(&op);
+}
+
+/** Remotely connect to a tag specified by the given network address and write to  a register at the given
  *  memory address
  *  @param hi2c pointer to i2c handle
  *  @param networkAddr network address of the tag
  *  @param MemAddress memory address of regiter
- *  @param regSize register size to read
+ *  @param txData data to be written to register
+ *  @param txSize size of txData
  */
-int Remote_Read_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint16_t regSize) {
-
-	uint8_t rxData[1];
-	uint8_t txBuffer[3];
+int Remote_Write_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint8_t *txData, uint16_t txSize) {
 
-	memset(rxData, '\0', sizeof (rxData));
+	uint8_t txBuffer[2 + txSize];
 	memset(txBuffer, '\0', sizeof (txBuffer));
 
 	txBuffer[0] = 0x00;
 	txBuffer[1] = MemAddress;
-	txBuffer[2] = regSize;
-
-	//Populate data buffer TX_DATA in master tag
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_DATA,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, sizeof (txBuffer), rxData, sizeof (rxData), 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
-
-	//Check for error in function
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
+	if (txData != NULL) {
+		memcpy(txBuffer + 2, txData, txSize);
 	}
 
-	memset(txBuffer, '\0', sizeof (txBuffer));
-	memset(rxData, '\0', sizeof (rxData));
-
-	//Clear int status register
-	I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxData, sizeof (rxData));
-	memset(rxData, '\0', sizeof (rxData));
+	return Remote_Transmit(hi2c, networkAddr, txBuffer, sizeof (txBuffer), 0x04);
+}
 
-	txBuffer[0] = (networkAddr & 0xFF);
-	txBuffer[1] = ((networkAddr & (0xFF << 8)) >> 8);
-	txBuffer[2] = 0x02;
+/** Remotely connect to a tag specified by the given network address and read a register at the given
+ *  memory address
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr network address of the tag
+ *  @param MemAddress memory address of regiter
+ *  @param regSize register size to read
+ */
+int Remote_Read_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint16_t regSize) {
 
-	//Send data remotely to give network address
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_SEND,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, sizeof (txBuffer), rxData, sizeof (rxData), 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
+	uint8_t txBuffer[3];
 
-	//Check for error
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
-	}
+	txBuffer[0] = 0x00;
+	txBuffer[1] = MemAddress;
+	txBuffer[2] = regSize;
 
-	return TRANSMITTED_MESSAGE;
+	return Remote_Transmit(hi2c, networkAddr, txBuffer, sizeof (txBuffer), 0x02);
 }
 
 /** Remotely connect to a tag specified by the given network address and perform a function call at the
@@ -128,9 +302,6 @@ int Remote_Read_Reg(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemA
  */
 int Remote_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress, uint8_t *txData, uint16_t txSize) {
 
-	uint8_t rxData[1];
-	uint16_t rxSize = sizeof (rxData);
-
 	uint8_t txBuffer[txSize + I2C_MEMADD_SIZE_8BIT + 1];
 	txBuffer[0] = 0x00;
 	txBuffer[1] = MemAddress;
@@ -138,66 +309,117 @@ int Remote_Function_Call(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t
 		memcpy(txBuffer + 2, txData, txSize);
 	}
 
-	//Clear int status register
-	I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxData, sizeof (rxData));
-	memset(rxData, '\0', sizeof (rxData));
-
-	//Populate data buffer TX_DATA in master tag
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_DATA,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, sizeof (txBuffer), rxData, rxSize, 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
-
-	//Check for error in function
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
-	}
-
-	memset(txBuffer, '\0', sizeof (txBuffer));
-	txBuffer[0] = (networkAddr & 0xFF);
-	txBuffer[1] = ((networkAddr & (0xFF << 8)) >> 8);
-	txBuffer[2] = 0x08;
+	return Remote_Transmit(hi2c, networkAddr, txBuffer, sizeof (txBuffer), 0x08);
+}
 
-	//Clear int status register
-	I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxData, sizeof (rxData));
-	memset(rxData, '\0', sizeof (rxData));
+/** Read the Rx buffer on the pozyx master tag without waiting for data to arrive
+ *  @param hi2c pointer to a i2c handle
+ *  @param rxData data buffer to store received data
+ *  @param rxSize size of rxData
+ *  @return HAL status of the read
+ */
+static HAL_StatusTypeDef Read_Rx_Data(I2C_HandleTypeDef *hi2c, uint8_t *rxData, uint16_t rxSize) {
 
-	//Send data remotely to give network address
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_TX_SEND,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, BYTE_SIZE_3, rxData, rxSize, 10) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
+	uint8_t txBuffer[1];
+	txBuffer[0] = 0x00;
 
-	//Check for error
-	if (rxData[0] == 0) {
-		return BAD_FUNCTION_CALL;
+	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_RX_DATA,
+			I2C_MEMADD_SIZE_8BIT, txBuffer, BYTE_SIZE_1, rxData, rxSize, 10) != HAL_OK) {
+		return HAL_ERROR;
 	}
 
-	return TRANSMITTED_MESSAGE;
+	return HAL_OK;
 }
 
-/** Read the Rx buffer on the pozyx master tag
+/** Wait for the RX_DATA interrupt of the pozyx master tag and read its Rx buffer
  *  @param hi2c pointer to a i2c handle
  *  @param rxData data buffer to store received data
  *  @param rxSize size of rxData
+ *  @return HAL_TIMEOUT if no data arrived within REMOTE_RX_TIMEOUT, otherwise HAL status of the read
  */
 HAL_StatusTypeDef Read_Rx_Buffer(I2C_HandleTypeDef *hi2c, uint8_t *rxData, uint16_t rxSize) {
+	remoteOp_t op;
+
+	//wait until the reply from the remote tag has arrived in the rx data buffer
+	Remote_Op_Receive(&op, hi2c, rxData, rxSize);
+	switch (Remote_Op_Wait(&op)) {
+		case TRANSMITTED_MESSAGE:
+			return HAL_OK;
+		case INT_TIMEOUT_ERROR:
+			return HAL_TIMEOUT;
+		default:
+			return HAL_ERROR;
+	}
+}
 
-	uint8_t rxBuffer[1], txBuffer[1];
+/** Get the time a remote tag is given to send back its position
+ *  @param request the outstanding request
+ *  @return timeout in ms
+ */
+static uint32_t Request_Timeout(positioningRequest_t *request) {
+	return (request->timeout == 0) ? REMOTE_POS_TIMEOUT : request->timeout;
+}
 
-	//wait until rx data buffer full
-	while ((rxBuffer[0] & POZYX_INT_STATUS_RX_DATA) == POZYX_INT_STATUS_RX_DATA) {
-		I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxBuffer, sizeof (rxBuffer));
+/** Read a position sent by a remote tag out of RX_DATA, once the RX_DATA interrupt has been seen
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param coordinates position struct
+ *  @return POSITIONS_NOT_READY if the message is not a position from the tag, < 0 for an error,
+ *  otherwise POSITIONS_RETRIEVED
+ */
+static int Read_Remote_Position(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates) {
+	uint8_t rxInfo[3];
+	uint8_t rxBuffer[sizeof (coordinates_t) + 1];
+
+	//Check who sent the message and how long it is, it must be the position of the tag
+	if (read_register_block(SLAVE_ADDR, hi2c, POZYX_RX_NETWORK_ID, POZYX_RX_DATA_LEN,
+			rxInfo, sizeof (rxInfo)) != GOOD_READ) {
+		return BAD_READ_ERROR;
+	}
+	if ((((rxInfo[1] << 8) | rxInfo[0]) != networkAddr) || (rxInfo[2] != sizeof (coordinates_t))) {
+		return POSITIONS_NOT_READY;
 	}
 
-	txBuffer[0] = 0x00;
+	//rxBuffer[0] holds the result of the read
+	if (Read_Rx_Data(hi2c, rxBuffer, sizeof (rxBuffer)) != HAL_OK) {
+		return BAD_FUNCTION_CALL;
+	}
+	memcpy(coordinates, rxBuffer + 1, sizeof (coordinates_t));
 
-	if (I2C_Send_Function_Call(hi2c, SLAVE_ADDR, POZYX_RX_DATA,
-			I2C_MEMADD_SIZE_8BIT, txBuffer, BYTE_SIZE_1, rxData, rxSize, 10) != HAL_OK) {
-		return HAL_ERROR;
+	return POSITIONS_RETRIEVED;
+}
+
+/** Wait for a remote tag to send back the position it has just calculated
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param coordinates position struct
+ *  @param timeout time to wait in ms
+ *  @return POSITIONS_NOT_READY if no position arrived in time, < 0 for an error, otherwise POSITIONS_RETRIEVED
+ */
+static int Wait_Remote_Position(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates,
+		uint32_t timeout) {
+	uint32_t start = HAL_GetTick();
+	uint32_t elapsed;
+
+	while ((elapsed = HAL_GetTick() - start) < timeout) {
+		switch (wait_for_interrupt(SLAVE_ADDR, hi2c, POZYX_INT_STATUS_RX_DATA, timeout - elapsed, NULL)) {
+			case INTERRUPT:
+				break;
+			case INT_TIMEOUT_ERROR:
+				return POSITIONS_NOT_READY;
+			case INT_ERR:
+				return INT_ERR;
+			default:
+				return BAD_READ_ERROR;
+		}
+
+		int errCode = Read_Remote_Position(hi2c, networkAddr, coordinates);
+		if (errCode != POSITIONS_NOT_READY) {
+			return errCode;
+		}
 	}
 
-	return HAL_OK;
+	return POSITIONS_NOT_READY;
 }
 
 /** Remotely connect to a tag at the specified network address and perform a function call
@@ -213,13 +435,19 @@ HAL_StatusTypeDef Read_Rx_Buffer(I2C_HandleTypeDef *hi2c, uint8_t *rxData, uint1
  */
 int Remote_Function_Call_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress,
 		uint8_t *txData, uint16_t txSize, uint8_t *rxData, uint16_t rxSize) {
-	if (Remote_Function_Call(hi2c, networkAddr, MemAddress, txData, txSize) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
-	}
-	if (Read_Rx_Buffer(hi2c, rxData, rxSize) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
-	return TRANSMITTED_MESSAGE;
+	retryState_t retry;
+	int errCode;
+
+	retry_start(&retry, RETRY_REMOTE_FUNCTION, networkAddr);
+	do {
+		errCode = BAD_FUNCTION_CALL;
+		if ((Remote_Function_Call(hi2c, networkAddr, MemAddress, txData, txSize) == TRANSMITTED_MESSAGE) &&
+				(Read_Rx_Buffer(hi2c, rxData, rxSize) == HAL_OK)) {
+			errCode = TRANSMITTED_MESSAGE;
+		}
+	} while (retry_again(&retry, errCode));
+
+	return errCode;
 }
 
 /** Send a read request to a remote tag specified by the network address. Subsequently read the received
@@ -233,13 +461,19 @@ int Remote_Function_Call_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uin
  */
 int Remote_Read_Reg_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress,
 		uint8_t *rxData, uint16_t rxSize, uint16_t regSize) {
-	if (Remote_Read_Reg(hi2c, networkAddr, MemAddress, regSize) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
-	}
-	if (Read_Rx_Buffer(hi2c, rxData, rxSize) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
-	return TRANSMITTED_MESSAGE;
+	retryState_t retry;
+	int errCode;
+
+	retry_start(&retry, RETRY_REMOTE_READ, networkAddr);
+	do {
+		errCode = BAD_FUNCTION_CALL;
+		if ((Remote_Read_Reg(hi2c, networkAddr, MemAddress, regSize) == TRANSMITTED_MESSAGE) &&
+				(Read_Rx_Buffer(hi2c, rxData, rxSize) == HAL_OK)) {
+			errCode = TRANSMITTED_MESSAGE;
+		}
+	} while (retry_again(&retry, errCode));
+
+	return errCode;
 }
 
 /** Remotely connect to a tag at the specified network address and perform a write to the given
@@ -254,178 +488,469 @@ int Remote_Read_Reg_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t
  */
 int Remote_Write_Reg_Read(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t MemAddress,
 		uint8_t *txData, uint16_t txSize, uint8_t *rxData, uint16_t rxSize) {
-	if (Remote_Write_Reg(hi2c, networkAddr, MemAddress, txData, txSize) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
-	}
-	if (Read_Rx_Buffer(hi2c, rxData, rxSize) != HAL_OK) {
-		return BAD_FUNCTION_CALL;
-	}
-	return TRANSMITTED_MESSAGE;
+	retryState_t retry;
+	int errCode;
+
+	retry_start(&retry, RETRY_REMOTE_WRITE, networkAddr);
+	do {
+		errCode = BAD_FUNCTION_CALL;
+		if ((Remote_Write_Reg(hi2c, networkAddr, MemAddress, txData, txSize) == TRANSMITTED_MESSAGE) &&
+				(Read_Rx_Buffer(hi2c, rxData, rxSize) == HAL_OK)) {
+			errCode = TRANSMITTED_MESSAGE;
+		}
+	} while (retry_again(&retry, errCode));
+
+	return errCode;
 }
 
 /** Initialise a remote tag for positioning
  *  @param hi2c pointer to a i2c handle
  *  @parm networkAddr the network address of the remote tag
+ *  @param bootTimeout time to wait for the tag to power up in ms, 0 to ask it only once
  *  @return < 0 for an error, otherwise > 0
  */
-int remote_tag_init(I2C_HandleTypeDef *hi2c, uint16_t networkAddr) {
+int remote_tag_init(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint32_t bootTimeout) {
+
+	uint8_t rxBuffer[2];
+	uint32_t start = HAL_GetTick();
+
+	//Wait for tag to power up, rxBuffer[0] holds the result of the read
+	do {
+		memset(rxBuffer, '\0', sizeof (rxBuffer));
+		if ((Remote_Read_Reg_Read(hi2c, networkAddr, POZYX_WHO_AM_I, rxBuffer, sizeof (rxBuffer),
+				BYTE_SIZE_1) == TRANSMITTED_MESSAGE) && (rxBuffer[1] == 0x43)) {
+			break;
+		}
+		HAL_Delay(REMOTE_READY_POLL);
+	} while ((HAL_GetTick() - start) < bootTimeout);
+
+	if (rxBuffer[1] != 0x43) {
+		return BAD_READ_ERROR;
+	}
+
+	//The tag may have been reset since it was last seen, so its registers are read back before the sync
+	shadow_invalidate_remote(networkAddr);
 
-	HAL_Delay(2500);	//wait for tag to power up
+	//Write and flash only the configuration registers that differ from the desired config
+	if (shadow_sync_remote(hi2c, networkAddr, remoteConfig,
+			sizeof (remoteConfig) / sizeof (remoteConfig[0]), 1) < 0) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	return GOOD_INIT;
+}
 
-	uint8_t txBuffer[10], rxBuffer[10];
+/** Add an anchor to the internal list of a remote tag
+ *  @param hi2c i2c handle
+ *  @param device the relevant pozyx device network ID, flag and position
+ *  @param networkAddr the network address of the remote tag
+ *  @return < 0 for an error, otherwise > 0
+ */
+int remote_add_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t device, uint16_t networkAddr) {
+	uint8_t txBuffer[15];
+	uint8_t rxBuffer[15];
 	memset(txBuffer, '\0', sizeof (txBuffer));
 	memset(rxBuffer, '\0', sizeof (rxBuffer));
 
-	//Clear devices list
-	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICES_CLEAR, NULL,
-			0, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
+	//send function call to add anchor to remote tag memory
+	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICE_ADD, (uint8_t *) &device,
+			sizeof (deviceCoords_t), rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
 		return BAD_FUNCTION_CALL;
 	}
-	if (rxBuffer[1] != 0x01) {
+	if (rxBuffer[0] != 0x01 && rxBuffer[1] != 0x01) {
 		return BAD_FUNCTION_CALL;
 	}
 
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	return DEVICE_ADDED;
 
-	//Set position algorithm to UWB only
-	txBuffer[0] = (POZYX_POS_ALG_UWB_ONLY | (DIMENSION << 4));
-	if (Remote_Write_Reg_Read(hi2c, networkAddr, POZYX_POS_ALG, txBuffer,
-			BYTE_SIZE_1, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
+}
+
+/** Send the positioning command of a request, its reply is read back as remote_positioning_ready
+ *  advances the request
+ *  @param request the request
+ */
+static void Request_Send(positioningRequest_t *request) {
+	memset(positioningCommand.reply, '\0', sizeof (positioningCommand.reply));
+	request->step = REQUEST_SENDING;
+	request->requestTick = HAL_GetTick();
+
+	//The transmit chain clears the interrupt status register before the command is sent
+	uint8_t txBuffer[2] = { 0x00, POZYX_DO_POSITIONING };
+	Remote_Op_Start(&positioningCommand.op, positioningCommand.op.hi2c, request->networkAddr, txBuffer,
+			sizeof (txBuffer), 0x08, positioningCommand.reply, sizeof (positioningCommand.reply));
+}
+
+/** Ask a remote tag to position itself without waiting for the result, collect it with
+ *  remote_positioning_collect once remote_positioning_ready. No other remote operation should be sent
+ *  to the tag until then
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param request struct to track the request
+ *  @return < 0 for an error, otherwise POSITIONS_REQUESTED
+ */
+int remote_positioning_request(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, positioningRequest_t *request) {
+
+	request->pending = 0;
+	request->networkAddr = networkAddr;
+	positioningCommand.op.hi2c = hi2c;
+	retry_start(&positioningCommand.retry, RETRY_REMOTE_FUNCTION, networkAddr);
+
+	Request_Send(request);
+	if (positioningCommand.op.state == REMOTE_OP_DONE) {
+		return positioningCommand.op.status;		//could not be queued
 	}
-	if (rxBuffer[0] == 0x00) {
-		return BAD_FUNCTION_CALL;
+
+	request->pending = 1;
+
+	return POSITIONS_REQUESTED;
+}
+
+/** Advance an outstanding positioning request and check if it can be collected without blocking for
+ *  long, either the command failed every attempt, the pozyx has raised an interrupt after the command
+ *  was acknowledged or the request has timed out
+ *  @param request the outstanding request
+ *  @return 1 if ready to collect, otherwise 0
+ */
+uint8_t remote_positioning_ready(positioningRequest_t *request) {
+	uint32_t wait;
+
+	if (!request->pending) {
+		return 0;
 	}
 
-	remote_flash_register(hi2c, networkAddr, POZYX_POS_ALG_UWB_ONLY);
+	switch (request->step) {
+		case REQUEST_BACKOFF:
+			if ((int32_t) (HAL_GetTick() - request->retryTick) >= 0) {
+				Request_Send(request);
+			}
+			return 0;
+
+		case REQUEST_SENDING:
+			if (!Remote_Op_Poll(&positioningCommand.op)) {
+				return 0;
+			}
+			if (retry_schedule(&positioningCommand.retry, positioningCommand.op.status, &wait)) {
+				request->retryTick = HAL_GetTick() + wait;
+				request->step = REQUEST_BACKOFF;
+				return 0;
+			}
+			request->step = (positioningCommand.op.status == TRANSMITTED_MESSAGE) ? REQUEST_POSITIONING : REQUEST_FAILED;
+			return (request->step == REQUEST_FAILED);
+
+		case REQUEST_POSITIONING:
+			return (pozyx_int_pending() || ((HAL_GetTick() - request->requestTick) >= Request_Timeout(request)));
+
+		default:
+			return 1;
+	}
+}
+
+/** Collect the position of an outstanding positioning request, waiting for the remote tag to send
+ *  it back for up to the request timeout
+ *  @param hi2c i2c handle
+ *  @param request the outstanding request
+ *  @param coordinates position struct
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time, may be NULL
+ *  @return POSITIONS_NOT_READY if the position did not arrive in time,
+ *  < 0 for an error, otherwise > 0
+ */
+int remote_positioning_collect(I2C_HandleTypeDef *hi2c, positioningRequest_t *request, coordinates_t *coordinates,
+		covariance_t *covariance, telemetry_t *telemetry) {
+	uint8_t rxBuffer[POSITION_BLOCK_SIZE + 1];
+
+	if (!request->pending) {
+		return POSITIONS_NOT_READY;
+	}
+	request->pending = 0;
+
+	//The positioning command never reached the tag
+	if (request->step == REQUEST_FAILED) {
+		return positioningCommand.op.status;
+	} else if (request->step != REQUEST_POSITIONING) {
+		return POSITIONS_NOT_READY;
+	}
+
+	//The tag sends its position back once positioning is done
+	uint32_t timeout = Request_Timeout(request);
+	uint32_t elapsed = HAL_GetTick() - request->requestTick;
+	int errCode = Wait_Remote_Position(hi2c, request->networkAddr, coordinates,
+			(elapsed < timeout) ? (timeout - elapsed) : 0);
+	if (errCode != POSITIONS_RETRIEVED) {
+		return errCode;
+	}
+
+	if (telemetry != NULL) {
+		telemetry->positioningTime = HAL_GetTick() - request->requestTick;
+	}
+
+	if (covariance == NULL) {
+		return POSITIONS_RETRIEVED;
+	}
 
-	memset(txBuffer, '\0', sizeof (txBuffer));
 	memset(rxBuffer, '\0', sizeof (rxBuffer));
 
-	//Turn off on board sensors
-	txBuffer[0] = 0x00;
-	if (Remote_Write_Reg_Read(hi2c, networkAddr, POZYX_SENSORS_MODE, txBuffer,
-			BYTE_SIZE_1, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
+	//Get POS_X through POS_ERR_YZ in a single UWB exchange, rxBuffer[0] holds the result
+	if (Remote_Read_Reg_Read(hi2c, request->networkAddr, POZYX_POS_X, rxBuffer,
+			POSITION_BLOCK_SIZE + 1, POSITION_BLOCK_SIZE) != TRANSMITTED_MESSAGE) {
 		return BAD_FUNCTION_CALL;
 	}
-	if (rxBuffer[0] == 0x00) {
+	if (rxBuffer[0] == POZYX_FAILURE) {
 		return BAD_FUNCTION_CALL;
 	}
 
-	remote_flash_register(hi2c, networkAddr, POZYX_SENSORS_MODE);
+	decode_position_block(rxBuffer + 1, coordinates, covariance);
 
-	memset(txBuffer, '\0', sizeof (txBuffer));
-	memset(rxBuffer ,'\0', sizeof (rxBuffer));
+	return POSITIONS_RETRIEVED;
+}
+
+/** Range a remote tag to an anchor
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param anchorID the network address of the anchor
+ *  @param range struct to store the distance and signal strength, the anchor position is left as it is
+ *  @return RANGING_ERROR if the tag did not send back its range in time, < 0 for another error,
+ *  otherwise GOOD_READ
+ */
+int remote_range(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t anchorID, rangeMeasurement_t *range) {
+	uint8_t txBuffer[2];
+	uint8_t rxInfo[3];
+	uint8_t rxBuffer[RANGE_INFO_SIZE + 2];	//rxBuffer[1] holds the result of the call, rxBuffer[0] of the range
+	uint32_t distance;
+	int16_t rss;
 
-	//Set moving average filter to a strength of 10
-	txBuffer[0] = (0x04 | (10 << 4));
-	if (Remote_Write_Reg_Read(hi2c, networkAddr, POZYX_POS_FILTER, txBuffer,
-			BYTE_SIZE_1, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
+	txBuffer[0] = anchorID & 0xFF;
+	txBuffer[1] = anchorID >> 8;
+
+	//Start ranging to the anchor
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	if ((Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DO_RANGING, txBuffer, sizeof (txBuffer),
+			rxBuffer, sizeof (rxBuffer)) != TRANSMITTED_MESSAGE) || (rxBuffer[1] != POZYX_SUCCESS)) {
 		return BAD_FUNCTION_CALL;
 	}
-	if (rxBuffer[0] == 0x00) {
+
+	//The tag sends the range back once it has ranged, until then RX_DATA holds the previous message
+	if (wait_for_interrupt(SLAVE_ADDR, hi2c, POZYX_INT_STATUS_RX_DATA, REMOTE_RX_TIMEOUT, NULL) != INTERRUPT) {
+		return RANGING_ERROR;
+	}
+
+	//Check who sent the message and how long it is, it must be the range of the tag
+	if (read_register_block(SLAVE_ADDR, hi2c, POZYX_RX_NETWORK_ID, POZYX_RX_DATA_LEN,
+			rxInfo, sizeof (rxInfo)) != GOOD_READ) {
+		return BAD_READ_ERROR;
+	}
+	if ((((rxInfo[1] << 8) | rxInfo[0]) != networkAddr) || (rxInfo[2] != RANGE_INFO_SIZE)) {
+		return RANGING_ERROR;
+	}
+
+	//rxBuffer[0] holds the result of the read
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	if (Read_Rx_Data(hi2c, rxBuffer, RANGE_INFO_SIZE + 1) != HAL_OK) {
 		return BAD_FUNCTION_CALL;
 	}
 
-	remote_flash_register(hi2c, networkAddr, POZYX_POS_FILTER);
+	memcpy(&distance, rxBuffer + 5, sizeof (distance));
+	memcpy(&rss, rxBuffer + 9, sizeof (rss));
+	range->networkID = anchorID;
+	range->distance = distance;
+	range->rss = rss;
 
-	return GOOD_INIT;
+	return GOOD_READ;
 }
 
-/** Add an anchor to the internal list of a remote tag
+/** Read the linear acceleration of a remote tag, gravity removed, in the axes of the tag
  *  @param hi2c i2c handle
- *  @param device the relevant pozyx device network ID, flag and position
- *  @param networkAddr the network address of the remote tag
- *  @return < 0 for an error, otherwise > 0
+ *  @param networkAddr the network address of the tag
+ *  @param acceleration x and y acceleration to fill in mg
+ *  @return < 0 for an error, otherwise GOOD_READ
  */
-int remote_add_anchors(I2C_HandleTypeDef *hi2c, deviceCoords_t device, uint16_t networkAddr) {
-	uint8_t txBuffer[15];
-	uint8_t rxBuffer[15];
-	memset(txBuffer, '\0', sizeof (txBuffer));
+int remote_read_acceleration(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, int16_t acceleration[2]) {
+	uint8_t rxBuffer[ACCELERATION_BLOCK_SIZE + 1];	//rxBuffer[0] holds the result
+
 	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	if ((Remote_Read_Reg_Read(hi2c, networkAddr, POZYX_LIA_X, rxBuffer, sizeof (rxBuffer),
+			ACCELERATION_BLOCK_SIZE) != TRANSMITTED_MESSAGE) || (rxBuffer[0] == POZYX_FAILURE)) {
+		return BAD_READ_ERROR;
+	}
 
-	//send function call to add anchor to remote tag memory
-	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICE_ADD, (uint8_t *) &device,
-			sizeof (deviceCoords_t), rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
+	memcpy(acceleration, rxBuffer + 1, ACCELERATION_BLOCK_SIZE);
+
+	return GOOD_READ;
+}
+
+/** Range a remote tag to the selected anchors one after the other and solve its position on the master
+ *  controller. No other remote operation should be sent to the tag until it returns
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param anchors the anchor table
+ *  @param anchorCount number of anchors in the table
+ *  @param anchorMask bit per entry of the anchor table to range to
+ *  @param coordinates the previous position to start the solve from, set to the solved position
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time and ranges used, may be NULL
+ *  @return RANGING_ERROR if too few ranges succeeded to solve a position, otherwise POSITIONS_RETRIEVED
+ */
+int remote_ranging_position(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const deviceCoords_t *anchors,
+		uint8_t anchorCount, uint32_t anchorMask, coordinates_t *coordinates, covariance_t *covariance,
+		telemetry_t *telemetry) {
+	rangeMeasurement_t ranges[MULTILAT_MAX_RANGES];
+	multilatResult_t result;
+	uint8_t rangeCount = 0;
+	uint32_t start = HAL_GetTick();
+
+	for (uint8_t i = 0; (i < anchorCount) && (i < MULTILAT_MAX_RANGES); i++) {
+		if (!(anchorMask & (1UL << i))) {
+			continue;
+		}
+
+		//A failed range is kept with a distance of 0 so the solver skips it
+		rangeMeasurement_t *range = &ranges[rangeCount++];
+		memset(range, '\0', sizeof (rangeMeasurement_t));
+		range->posX = anchors[i].posX;
+		range->posY = anchors[i].posY;
+		range->posZ = anchors[i].posZ;
+		remote_range(hi2c, networkAddr, anchors[i].networkID, range);
 	}
-	if (rxBuffer[0] != 0x01 && rxBuffer[1] != 0x01) {
-		return BAD_FUNCTION_CALL;
+
+	int errCode = multilat_solve(ranges, rangeCount, coordinates, &result);
+
+	if (covariance != NULL) {
+		*covariance = result.covariance;
 	}
 
-	return DEVICE_ADDED;
+	if (telemetry != NULL) {
+		telemetry->positioningTime = HAL_GetTick() - start;
+		telemetry->rangesUsed = result.used;
+		telemetry->rangesRejected = result.rejected;
+		telemetry->rangeResidual = result.residual;
+	}
 
+	return errCode;
 }
 
-/** Position a remote tag given by the network address & save the positions to a given struct
+/** Put a remote tag into continuous positioning, after which it sends each new position to the
+ *  master tag by itself. No other remote operation should be sent to the tag until it is stopped
  *  @param hi2c i2c handle
  *  @param networkAddr the network address of the tag
- *  @param coordinates position struct
- *  @return < 0 for an error, otherwise > 0
+ *  @param interval time between positions in ms
+ *  @param request struct to track the positions, pending while the tag is positioning
+ *  @return < 0 for an error, otherwise POSITIONS_REQUESTED
  */
-int remote_positioning(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates) {
-	uint8_t rxBuffer[50];
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
+int remote_continuous_start(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t interval,
+		positioningRequest_t *request) {
+	uint8_t rxBuffer[1];
+	const configEntry_t posInterval[] = {
+		{ POZYX_POS_INTERVAL, (interval & 0xFF) },
+		{ POZYX_POS_INTERVAL + 1, (interval >> 8) }
+	};
+
+	request->pending = 0;
+	request->networkAddr = networkAddr;
 
 	//Clear interrupt status register by reading from it
 	if (I2C_Read_Reg(hi2c, POZYX_INT_STATUS, rxBuffer, sizeof (rxBuffer)) != HAL_OK) {
 		return BAD_READ_ERROR;
 	}
 
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
-
-	//Send positioning command
-	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DO_POSITIONING, NULL,
-			0, rxBuffer, sizeof (rxBuffer)) != TRANSMITTED_MESSAGE) {
+	//Not flashed so the tag is back in single shot mode after a reset
+	if (shadow_sync_remote(hi2c, networkAddr, posInterval, sizeof (posInterval) / sizeof (posInterval[0]), 0) < 0) {
 		return BAD_FUNCTION_CALL;
 	}
 
-	uint8_t rxBufferX[4];
-	uint8_t rxBufferY[4];
-	uint8_t rxBufferZ[4];
+	request->requestTick = HAL_GetTick();
+	request->pending = 1;
 
-	memset(rxBufferX, '\0', sizeof (rxBufferX));
-	memset(rxBufferY, '\0', sizeof (rxBufferY));
-	memset(rxBufferZ, '\0', sizeof (rxBufferZ));
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	return POSITIONS_REQUESTED;
+}
+
+/** Take a remote tag out of continuous positioning
+ *  @param hi2c i2c handle
+ *  @param request the request returned by remote_continuous_start
+ *  @return < 0 for an error, otherwise TRANSMITTED_MESSAGE
+ */
+int remote_continuous_stop(I2C_HandleTypeDef *hi2c, positioningRequest_t *request) {
+	const configEntry_t posInterval[] = {
+		{ POZYX_POS_INTERVAL, 0x00 },
+		{ POZYX_POS_INTERVAL + 1, 0x00 }
+	};
 
-	HAL_Delay(70);
+	request->pending = 0;
 
-	//Get x positions
-	if (Remote_Read_Reg_Read(hi2c, networkAddr, POZYX_POS_X, rxBuffer,
-			BYTE_SIZE_1 * 5, BYTE_SIZE_2 * 2) != TRANSMITTED_MESSAGE) {
+	if (shadow_sync_remote(hi2c, request->networkAddr, posInterval,
+			sizeof (posInterval) / sizeof (posInterval[0]), 0) < 0) {
 		return BAD_FUNCTION_CALL;
 	}
 
-	for (int i = 0; i < 4; i++) {
-		rxBufferX[3 - i] = rxBuffer[4 - i];
-	}
+	return TRANSMITTED_MESSAGE;
+}
 
-	memset(rxBuffer, '\0', sizeof (rxBuffer));
+/** Drain a position sent by a remote tag in continuous positioning. Does not block, call it when
+ *  the pozyx has raised an interrupt
+ *  @param hi2c i2c handle
+ *  @param request the request returned by remote_continuous_start
+ *  @param coordinates position struct
+ *  @param telemetry struct to store the time since the last position, may be NULL
+ *  @return POSITIONS_NOT_READY if no new position has arrived, < 0 for an error, otherwise POSITIONS_RETRIEVED
+ */
+int remote_continuous_collect(I2C_HandleTypeDef *hi2c, positioningRequest_t *request, coordinates_t *coordinates,
+		telemetry_t *telemetry) {
+	int errCode;
 
-	//Get y positions
-	if (Remote_Read_Reg_Read(hi2c, networkAddr, POZYX_POS_Y, rxBuffer,
-			BYTE_SIZE_1 * 5, BYTE_SIZE_2 * 2) != TRANSMITTED_MESSAGE) {
-		return BAD_FUNCTION_CALL;
+	if (!request->pending) {
+		return POSITIONS_NOT_READY;
 	}
 
-	for (int i = 0; i < 4; i++) {
-		rxBufferY[3 - i] = rxBuffer[4 - i];
+	switch (errCode = wait_for_interrupt(SLAVE_ADDR, hi2c, POZYX_INT_STATUS_RX_DATA, 0, NULL)) {
+		case INTERRUPT:
+			break;
+		case INT_TIMEOUT_ERROR:
+			return POSITIONS_NOT_READY;
+		default:
+			return errCode;
 	}
 
-	coordinates->posX &= 0;
-	coordinates->posY &= 0;
-	coordinates->posZ &= 0;
+	if ((errCode = Read_Remote_Position(hi2c, request->networkAddr, coordinates)) != POSITIONS_RETRIEVED) {
+		return errCode;
+	}
 
-	for (int j = 0; j < 4; j++) {
-		coordinates->posX |= (rxBufferX[j] << (j * 8));
-		coordinates->posY |= (rxBufferY[j] << (j * 8));
-		coordinates->posZ |= (rxBufferZ[j] << (j * 8));
+	if (telemetry != NULL) {
+		telemetry->positioningTime = HAL_GetTick() - request->requestTick;
 	}
+	request->requestTick = HAL_GetTick();
 
 	return POSITIONS_RETRIEVED;
 }
 
+/** Position a remote tag given by the network address & save the positions to a given struct.
+ *  The remote tag sends its position back as soon as it is done, which is picked up from the
+ *  RX_DATA interrupt
+ *  @param hi2c i2c handle
+ *  @param networkAddr the network address of the tag
+ *  @param coordinates position struct
+ *  @param covariance struct to store the position error covariance, may be NULL
+ *  @param telemetry struct to store the positioning time, may be NULL
+ *  @return POSITIONS_NOT_READY if the position did not arrive within REMOTE_POS_TIMEOUT,
+ *  < 0 for an error, otherwise > 0
+ */
+int remote_positioning(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, coordinates_t *coordinates,
+		covariance_t *covariance, telemetry_t *telemetry) {
+	positioningRequest_t request;
+	int errCode;
+
+	request.timeout = 0;
+
+	if ((errCode = remote_positioning_request(hi2c, networkAddr, &request)) != POSITIONS_REQUESTED) {
+		return errCode;
+	}
+
+	//Drive the positioning command through its retries until it is acknowledged
+	while (!remote_positioning_ready(&request)) {
+		I2C_Queue_Process();
+	}
+
+	return remote_positioning_collect(hi2c, &request, coordinates, covariance, telemetry);
+}
+
 /** Perform a remote calibration on the remote tag specified by the network address
  *  anchorIDs provide the relevant anchor IDs to calibrate.
  *  	anchorID1 -> this anchor will be used as the origin
@@ -480,6 +1005,28 @@ int remote_flash_register(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_
 	return GOOD_READ;
 }
 
+/** Save several writable registers on a remote tag in non-volatile flash memory in a single
+ *  flash operation
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param regs the memory addresses of the registers to save in flash
+ *  @param regCount number of registers in regs
+ */
+int remote_flash_registers(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint8_t *regs, uint8_t regCount) {
+	uint8_t txBuffer[1 + regCount], rxBuffer[2];
+	txBuffer[0] = 0x01;
+	memcpy(txBuffer + 1, regs, regCount);
+
+	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_FLASH_SAVE, txBuffer,
+			sizeof (txBuffer), rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	HAL_Delay(300);
+
+	return GOOD_READ;
+}
+
 /** Save the device list on a remote tag in non-volatile flash memory
  *  @param hi2c pointer to i2c handle
  *  @param networkAddr the network address of the remote tag
@@ -498,4 +1045,121 @@ int remote_save_device_list(I2C_HandleTypeDef *hi2c, uint16_t networkAddr) {
 	return GOOD_READ;
 }
 
+/** Make sure the device list of a remote tag holds the given devices. The stored list is read
+ *  back and left as it is if it already matches, otherwise it is cleared, the devices are added
+ *  and the list is flashed into remote tag memory
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param devices the devices
+ *  @param deviceCount number of devices
+ *  @return DEVICES_MATCHED if the list was kept, DEVICE_ADDED if it was rebuilt, < 0 for an error
+ */
+int remote_provision_devices(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, const deviceCoords_t *devices,
+		uint8_t deviceCount) {
+	uint8_t rxBuffer[2 + (2 * MAX_ANCHORS_IN_LIST)];
+	uint8_t txBuffer[2];
 
+	if (deviceCount > MAX_ANCHORS_IN_LIST) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	//Compare the number of devices and the checksum of their ids and coordinates with the expected list,
+	//rxBuffer[0] holds the result of the read
+	memset(rxBuffer, '\0', sizeof (rxBuffer));
+	if (Remote_Read_Reg_Read(hi2c, networkAddr, POZYX_DEVICE_LIST_SIZE, rxBuffer, BYTE_SIZE_2,
+			BYTE_SIZE_1) != TRANSMITTED_MESSAGE) {
+		return BAD_FUNCTION_CALL;
+	}
+	if ((rxBuffer[1] == deviceCount) && (deviceCount > 0)) {
+		txBuffer[0] = 0;				//offset
+		txBuffer[1] = deviceCount;		//number of ids
+		if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICES_GETIDS, txBuffer, sizeof (txBuffer),
+				rxBuffer, 2 + (2 * deviceCount)) != TRANSMITTED_MESSAGE) {
+			return BAD_FUNCTION_CALL;
+		}
+		if (rxBuffer[1] == POZYX_SUCCESS) {
+			uint16_t crc = CRC16_INIT;
+			uint8_t i;
+
+			//Read back the coordinates stored for each id, coordinates[1] holds the result of the call
+			for (i = 0; i < deviceCount; i++) {
+				uint8_t coordinates[2 + 12];
+				deviceCoords_t stored;
+
+				if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICE_GETCOORDS, rxBuffer + 2 + (2 * i), 2,
+						coordinates, sizeof (coordinates)) != TRANSMITTED_MESSAGE) {
+					return BAD_FUNCTION_CALL;
+				}
+				if (coordinates[1] != POZYX_SUCCESS) {
+					break;
+				}
+				stored = stored_device(rxBuffer + 2 + (2 * i), coordinates + 2);
+				crc = device_crc_update(crc, &stored);
+			}
+
+			if ((i == deviceCount) && (crc == device_list_crc(devices, deviceCount))) {
+				return DEVICES_MATCHED;
+			}
+		}
+	}
+
+	//Clear devices list
+	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_DEVICES_CLEAR, NULL,
+			0, rxBuffer, BYTE_SIZE_2) != TRANSMITTED_MESSAGE) {
+		return BAD_FUNCTION_CALL;
+	}
+	if (rxBuffer[1] != 0x01) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	for (uint8_t i = 0; i < deviceCount; i++) {
+		if (remote_add_anchors(hi2c, devices[i], networkAddr) != DEVICE_ADDED) {
+			return BAD_FUNCTION_CALL;
+		}
+	}
+
+	//Flash device list into remote tag memory
+	if (remote_save_device_list(hi2c, networkAddr) != GOOD_READ) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	return DEVICE_ADDED;
+}
+
+/** Select the anchors a remote tag positions with out of its device list, switching the tag to
+ *  manual anchor selection
+ *  @param hi2c pointer to i2c handle
+ *  @param networkAddr the network address of the remote tag
+ *  @param anchorIDs network ids of the anchors, each must be in the device list of the tag
+ *  @param anchorCount number of anchors
+ *  @return < 0 for an error, otherwise TRANSMITTED_MESSAGE
+ */
+int remote_set_anchor_ids(I2C_HandleTypeDef *hi2c, uint16_t networkAddr, uint16_t *anchorIDs, uint8_t anchorCount) {
+	uint8_t txBuffer[2 * MAX_ANCHORS_IN_LIST];
+	uint8_t rxBuffer[2];
+	const configEntry_t numAnchors = { POZYX_POS_NUM_ANCHORS, ((POZYX_ANCHOR_SEL_MANUAL << 7) | anchorCount) };
+
+	if ((anchorCount == 0) || (anchorCount > MAX_ANCHORS_IN_LIST)) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	//Only the number of anchors and the selection mode, skipped if already set
+	if (shadow_sync_remote(hi2c, networkAddr, &numAnchors, 1, 0) < 0) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	for (uint8_t i = 0; i < anchorCount; i++) {
+		txBuffer[2 * i] = anchorIDs[i] & 0xFF;
+		txBuffer[(2 * i) + 1] = anchorIDs[i] >> 8;
+	}
+
+	if (Remote_Function_Call_Read(hi2c, networkAddr, POZYX_POS_SET_ANCHOR_IDS, txBuffer,
+			2 * anchorCount, rxBuffer, sizeof (rxBuffer)) != TRANSMITTED_MESSAGE) {
+		return BAD_FUNCTION_CALL;
+	}
+	if (rxBuffer[1] != 0x01) {
+		return BAD_FUNCTION_CALL;
+	}
+
+	return TRANSMITTED_MESSAGE;
+}
@@ -8,64 +8,95 @@
 */
 
 #include "zigbee.h"
+#include "stdarg.h"
 
-/** Send the given positions, mass and ID of the crane through the zigbee modules
+/** Transmit a buffer to the zigbee module, with a timeout long enough for the whole buffer
  *  @param huart pointer to uart handle
- *  @param positions struct holding (x, y) positions of crane
- *  @param mass raw adc value of crane load gauge
- *  @param craneID id of crane
+ *  @param data pointer to data buffer
+ *  @param size size of data buffer
  */
-void zigbee_send_data(UART_HandleTypeDef *huart, coordinates_t positions, uint32_t mass, uint8_t craneID) {
-	int32_t posX = positions.posX;
-	int32_t posY = positions.posY;
-
-	//Get number of digits in positions, mass and id
-	uint8_t posXSize = log10(posX) + 1;
-	uint8_t posYSize = log10(posY) + 1;
-	uint8_t massSize = log10(mass) + 1;
-	uint8_t idSize = log10(craneID) + 1;
+static void zigbee_transmit(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size) {
 
-	//If mass and positions are zero, set number of digits accordingly
-	if (posXSize == 0) {
-		posXSize = 1;
-	}
-	if (posYSize == 0) {
-		posYSize = 1;
-	}
-	if (massSize == 0) {
-		massSize = 1;
-	}
+	//10 bits per byte on the wire plus some margin
+	uint32_t timeout = ((uint32_t) size * 10 * 1000) / huart->Init.BaudRate + ZIGBEE_TX_MARGIN;
+
+	HAL_UART_Transmit(huart, data, size, timeout);
+}
 
-	//populate char arrays with positions, mass and id
-	char posYArr[posYSize + 3];
-	memset(posYArr, 0, sizeof (posYArr));
-	sprintf(posYArr, "y%d\r\n", posY);
+/** Append formatted text to a frame, keeping the length within the frame if the text is cut short
+ *  @param frame the frame
+ *  @param size size of the frame
+ *  @param length length of the text already in the frame
+ *  @param format printf style format of the text
+ *  @return length of the text in the frame, at most size - 1
+ */
+static int zigbee_append(char *frame, int size, int length, const char *format, ...) {
+	va_list args;
 
-	char idArr[idSize + 3];
-	memset(idArr, 0, sizeof (idArr));
-	sprintf(idArr, " i%d ", craneID);
+	if (length >= (size - 1)) {
+		return size - 1;
+	}
+
+	va_start(args, format);
+	int written = vsnprintf(frame + length, size - length, format, args);
+	va_end(args);
 
-	char posXArr[posXSize + 2];
-	memset(posXArr, 0, sizeof (posXArr));
-	sprintf(posXArr, "x%d ", posX);
+	if (written < 0) {
+		return length;
+	}
+	return ((length + written) < size) ? (length + written) : (size - 1);
+}
 
-	char massArr[massSize + 2];
-	memset(massArr, 0, sizeof (massArr));
-	sprintf(massArr, "m%d ", mass);
+/** Send the given positions, mass and ID of the crane through the zigbee modules
+ *  @param huart pointer to uart handle
+ *  @param positions struct holding (x, y) positions of crane
+ *  @param mass raw adc value of crane load gauge
+ *  @param craneID id of crane
+ *  @param telemetry telemetry appended to the frame, may be NULL
+ */
+void zigbee_send_data(UART_HandleTypeDef *huart, coordinates_t positions, uint32_t mass, uint8_t craneID,
+		telemetry_t *telemetry) {
+	char dataArr[ZIGBEE_MAX_FRAME];
+	int frameSize = sizeof (dataArr) - 2;	//room is kept for the line ending
+	int dataLength = 0;
+
+	//populate the frame with the id, mass and positions of the crane
+	dataLength = zigbee_append(dataArr, frameSize, dataLength, " i%d m%lu x%ld y%ld", craneID, (unsigned long) mass,
+			(long) positions.posX, (long) positions.posY);
+
+	//The host reads any 'i' in an unknown token as the crane id, so telemetry tokens must not contain one
+	if (telemetry != NULL) {
+		dataLength = zigbee_append(dataArr, frameSize, dataLength, " t%lu u%d v%d s%u",
+				(unsigned long) telemetry->positioningTime, telemetry->velX, telemetry->velY, telemetry->motion);
+
+		//Positions carried on the accelerometer between fixes carry the time since the last fix
+		if (telemetry->coasted > 0) {
+			dataLength = zigbee_append(dataArr, frameSize, dataLength, " a%u", telemetry->coasted);
+		}
+
+		//Score of the position, 0 to 100
+		if (telemetry->quality != QUALITY_UNKNOWN) {
+			dataLength = zigbee_append(dataArr, frameSize, dataLength, " q%u", telemetry->quality);
+		}
+
+		//Positions solved from ranges carry the ranges used, rejected and their rms residual in mm
+		if (telemetry->rangesUsed > 0) {
+			dataLength = zigbee_append(dataArr, frameSize, dataLength, " n%u o%u e%u",
+					telemetry->rangesUsed, telemetry->rangesRejected, telemetry->rangeResidual);
+		}
+	}
+	memcpy(dataArr + dataLength, "\r\n", 2);
+	dataLength += 2;
 
 	//integrate char arrays and other commands for zigbee communication
-	uint8_t dataLength = sizeof (posXArr) + sizeof (posYArr) + sizeof (massArr) + sizeof (idArr);
 	uint8_t data[4 + dataLength];
 	data[0] = 0xFD;
 	data[1] = dataLength;
 	data[2] = 0xFF;
 	data[3] = 0xFF;
-	memcpy(data + 4, idArr, sizeof (idArr));
-	memcpy(data + 4 + sizeof (idArr), massArr, sizeof (massArr));
-	memcpy(data + 4 + sizeof (idArr) + sizeof (massArr), posXArr, sizeof (posXArr));
-	memcpy(data + 4 + sizeof (idArr) + sizeof (massArr) + sizeof (posXArr), posYArr, sizeof (posYArr));
+	memcpy(data + 4, dataArr, dataLength);
 
-	HAL_UART_Transmit(huart, data, sizeof (data), 10);	//send data
+	zigbee_transmit(huart, data, sizeof (data));	//send data
 }
 
 /** Send through a set data buffer through zigbee
@@ -84,7 +115,7 @@ void zigbee_send_other_data(UART_HandleTypeDef *huart, uint8_t *txData, uint16_t
 	txBuffer[3] = 0xFF;
 	memcpy(txBuffer + 4, txData, txSize);
 
-	HAL_UART_Transmit(huart, txBuffer, sizeof (txBuffer), 10);
+	zigbee_transmit(huart, txBuffer, sizeof (txBuffer));
 }
 
 /** Send through the crane ID as an okay message when the crane is stationary
@@ -115,5 +146,5 @@ void zigbee_send_okay(UART_HandleTypeDef *huart, uint8_t craneID) {
 	memcpy(data + 4, idArr, sizeof (idArr));
 	memcpy(data + 4 + sizeof (idArr), kArr, sizeof (kArr));
 
-	HAL_UART_Transmit(huart, data, sizeof (data), 10);	//send data
+	zigbee_transmit(huart, data, sizeof (data));	//send data
 }
@@ -49,6 +49,11 @@ def main():
         cur.execute("CREATE TABLE crane3(time, adc, average mass, mass, x pos, y pos)")
     except sql.OperationalError:
         print("SOMETHING HAPPENED")
+
+    try:
+        cur.execute("CREATE TABLE geofence_events(time, crane, zone, entered, kind, adc, mass)")
+    except sql.OperationalError:
+        print("GEOFENCE EVENTS TABLE EXISTS")
     
     read_serial()   
 
@@ -110,6 +115,24 @@ def read_serial():
         if readFlag == True:
             readFlag = False
             now = datetime.now()    #get time
+
+            #geofence events are stored with the mass on the hook as the crane crossed the zone
+            event = parse_event(rxBuffer)
+            if event is not None:
+                eventMass = model.predict(np.array([event["adc"]]).reshape(-1, 1))
+                cur.execute("INSERT INTO geofence_events VALUES ('" + str(now) + "', '" +
+                            str(event["crane"]) + "', '" + str(event["zone"]) + "', '" +
+                            str(event["entered"]) + "', '" + str(event["kind"]) + "', '" +
+                            str(event["adc"]) + "', '" + str(float(eventMass)) + "')")
+                con.commit()
+                rxBuffer = ""
+                continue
+
+            #statistics and events start with '#', they are not positions
+            if '#' in rxBuffer:
+                print(rxBuffer)
+                rxBuffer = ""
+                continue
             
             dataList = rxBuffer.split(" ")
             if (len(dataList) < 4):
@@ -154,6 +177,32 @@ def read_serial():
 
             rxBuffer = ""
 
+'''
+    @brief parse a geofence event, sent as "#g<zone> c<crane> e<1 entered, 0 left> k<kind> l<load adc>"
+    @param rxBuffer received line
+    @return dictionary of the event, None if the line is not a geofence event
+'''
+def parse_event(rxBuffer):
+    if '#g' not in rxBuffer:
+        return None
+
+    #the tokens follow the '#', any bytes in front of it are dropped
+    tokens = {}
+    for token in rxBuffer[rxBuffer.index('#g') + 1:].split(" "):
+        if len(token) > 1:
+            tokens[token[0]] = token[1::]
+
+    try:
+        return {
+            "zone": int(tokens['g']),
+            "crane": int(tokens['c']),
+            "entered": int(tokens['e']),
+            "kind": int(tokens['k']),
+            "adc": int(tokens['l'])
+        }
+    except (KeyError, ValueError):
+        return None
+
 # run application
 if __name__ == "__main__":
     main()
\ No newline at end of file
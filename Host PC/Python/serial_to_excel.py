@@ -107,6 +107,26 @@ def read_serial():
         if readFlag == True:
             readFlag = False
             now = datetime.now()    #get time
+
+            #geofence events are appended to their own sheet
+            event = parse_event(rxBuffer)
+            if event is not None:
+                wb = openpyxl.load_workbook(spreadsheet)
+                if "Events" not in wb.sheetnames:
+                    create_events_sheet(wb)
+                eventMass = model.predict(pd.DataFrame({'adc': [event["adc"]]}))
+                wb.__getitem__("Events").append([str(now), event["crane"], event["zone"], event["entered"],
+                                                 event["kind"], event["adc"], float(eventMass)])
+                wb.save(filename=spreadsheet)
+                wb.close()
+                rxBuffer = ""
+                continue
+
+            #statistics and events start with '#', they are not positions
+            if '#' in rxBuffer:
+                print(rxBuffer)
+                rxBuffer = ""
+                continue
             
             dataList = rxBuffer.split(" ")
             if (len(dataList) < 4):
@@ -178,6 +198,41 @@ def create_sheet(titlename, wb):
     sheet = wb.__getitem__(titlename)
     sheet.append(['Time', 'Raw ADC', 'Mass', 'X Position', 'Y Position'])
 
+'''
+    @brief create the sheet geofence events are stored into
+    @param wb workbook object of excel doc
+'''
+def create_events_sheet(wb):
+    wb.create_sheet(title="Events")
+    sheet = wb.__getitem__("Events")
+    sheet.append(['Time', 'Crane', 'Zone', 'Entered', 'Kind', 'Raw ADC', 'Mass'])
+
+'''
+    @brief parse a geofence event, sent as "#g<zone> c<crane> e<1 entered, 0 left> k<kind> l<load adc>"
+    @param rxBuffer received line
+    @return dictionary of the event, None if the line is not a geofence event
+'''
+def parse_event(rxBuffer):
+    if '#g' not in rxBuffer:
+        return None
+
+    #the tokens follow the '#', any bytes in front of it are dropped
+    tokens = {}
+    for token in rxBuffer[rxBuffer.index('#g') + 1:].split(" "):
+        if len(token) > 1:
+            tokens[token[0]] = token[1::]
+
+    try:
+        return {
+            "zone": int(tokens['g']),
+            "crane": int(tokens['c']),
+            "entered": int(tokens['e']),
+            "kind": int(tokens['k']),
+            "adc": int(tokens['l'])
+        }
+    except (KeyError, ValueError):
+        return None
+
 # run application
 if __name__ == "__main__":
     main()
\ No newline at end of file
@@ -124,6 +124,21 @@ def read_serial():
         if readFlag == True:
             readFlag = False
             now = datetime.now()    #get time
+
+            #geofence events are published as they arrive on the events subtopic
+            event = parse_event(rxBuffer)
+            if event is not None:
+                event["m"] = float(model.predict(np.array([event["adc"]]).reshape(-1, 1)))
+                event["t"] = str(now)
+                client.publish(topic + "/events", json.dumps(event))
+                rxBuffer = ""
+                continue
+
+            #statistics and events start with '#', they are not positions
+            if '#' in rxBuffer:
+                print(rxBuffer)
+                rxBuffer = ""
+                continue
             
             dataList = rxBuffer.split(" ")
             if (len(dataList) < 4):
@@ -232,6 +247,32 @@ def send_data(craneID, jsonList):
                         "updates": jsonList})
     client.publish(topic, jsonPackage)
 
+'''
+    @brief parse a geofence event, sent as "#g<zone> c<crane> e<1 entered, 0 left> k<kind> l<load adc>"
+    @param rxBuffer received line
+    @return dictionary of the event, None if the line is not a geofence event
+'''
+def parse_event(rxBuffer):
+    if '#g' not in rxBuffer:
+        return None
+
+    #the tokens follow the '#', any bytes in front of it are dropped
+    tokens = {}
+    for token in rxBuffer[rxBuffer.index('#g') + 1:].split(" "):
+        if len(token) > 1:
+            tokens[token[0]] = token[1::]
+
+    try:
+        return {
+            "zone": int(tokens['g']),
+            "crane": int(tokens['c']),
+            "entered": int(tokens['e']),
+            "kind": int(tokens['k']),
+            "adc": int(tokens['l'])
+        }
+    except (KeyError, ValueError):
+        return None
+
 # run application
 if __name__ == "__main__":
     main()
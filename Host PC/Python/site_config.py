@@ -0,0 +1,149 @@
+'''
+This python script will pack a site configuration into the siteConfig_t block
+the STM32 reads from its last flash page, and either write the block to a file
+or upload it over the specified serial port
+    @param -c site configuration json file
+    @param -o image file to write, flashed at 0x0803F800
+    @param -b baudrate
+    @param -p com port
+'''
+
+import json
+import serial
+import struct
+import sys
+import zlib
+
+#Layout of siteConfig_t, these must match siteconfig.h, anchors.h, geofence.h and scheduler.h
+SITE_CONFIG_MAGIC = 0x45544953
+SITE_CONFIG_VERSION = 4
+SITE_CONFIG_SIZE = 1104
+SITE_CONFIG_COMMAND = b'C'
+ANCHOR_TABLE_MAX = 32
+SCHED_MAX_TAGS = 4
+GEOFENCE_MAX_ZONES = 8
+GEOFENCE_MAX_VERTICES = 8
+ANCHOR_FLAG = 0x1
+
+ZONE_KINDS = {"no_go": 0, "rated_load": 1, "maintenance": 2}
+
+'''
+    @brief entry point into program
+'''
+def main():
+
+    config_file = ""
+    image_file = ""
+    com_port = ""
+    baudrate = 38400
+
+    for i in range(len(sys.argv)):
+        if sys.argv[i] == '-c':
+            config_file = sys.argv[i + 1]
+        elif sys.argv[i] == '-o':
+            image_file = sys.argv[i + 1]
+        elif sys.argv[i] == '-b':
+            baudrate = int(sys.argv[i + 1])
+        elif sys.argv[i] == '-p':
+            com_port = sys.argv[i + 1]
+
+    if config_file == "" or (image_file == "" and com_port == ""):
+        print("usage: site_config.py -c config.json [-o image.bin] [-p port [-b baudrate]]")
+        return -1
+
+    with open(config_file) as f:
+        block = pack_config(json.load(f))
+
+    if image_file != "":
+        with open(image_file, "wb") as f:
+            f.write(block)
+        print("Wrote " + str(len(block)) + " bytes to " + image_file)
+
+    if com_port != "":
+        return upload_config(block, com_port, baudrate)
+
+    return 0
+
+'''
+    @brief pack a site configuration into a siteConfig_t block, header and CRC included
+    @param config the site configuration
+    @return the block
+'''
+def pack_config(config):
+
+    anchors = config["anchors"]
+    tags = config["tags"]
+    fences = config.get("fences", [])
+
+    if len(anchors) > ANCHOR_TABLE_MAX or len(tags) > SCHED_MAX_TAGS or len(fences) > GEOFENCE_MAX_ZONES:
+        raise ValueError("too many anchors, tags or fences")
+
+    bay = config["bay"]
+    block = struct.pack("<IHH6i", SITE_CONFIG_MAGIC, SITE_CONFIG_VERSION, SITE_CONFIG_SIZE,
+                        bay["widthMin"], bay["widthMax"], bay["lengthMin"], bay["lengthMax"],
+                        bay["margin"], config["maxCraneSpeed"])
+    block += struct.pack("<3B", config["numAnchors"], len(anchors), len(tags))
+
+    #deviceCoords_t is packed, network id, flag, x, y, z
+    for anchor in anchors:
+        block += struct.pack("<HB3i", int(anchor["id"], 0), ANCHOR_FLAG, anchor["x"], anchor["y"], anchor["z"])
+    block += bytes(15 * (ANCHOR_TABLE_MAX - len(anchors)))
+    block += bytes(1)
+
+    #craneTagConfig_t, network id, crane, period, imu mount
+    for tag in tags:
+        block += struct.pack("<HBxHh", int(tag["id"], 0), tag["crane"], tag["period"], tag.get("imuMount", 0))
+    block += bytes(8 * (SCHED_MAX_TAGS - len(tags)))
+
+    block += struct.pack("<B3x", len(fences))
+
+    #geofenceZone_t, kind, vertex count then the corners
+    for fence in fences:
+        vertices = fence["vertices"]
+        if len(vertices) < 3 or len(vertices) > GEOFENCE_MAX_VERTICES:
+            raise ValueError("a fence needs 3 to " + str(GEOFENCE_MAX_VERTICES) + " vertices")
+        block += struct.pack("<BB2x", ZONE_KINDS[fence["kind"]], len(vertices))
+        for vertex in vertices:
+            block += struct.pack("<2i", vertex[0], vertex[1])
+        block += bytes(8 * (GEOFENCE_MAX_VERTICES - len(vertices)))
+    block += bytes(68 * (GEOFENCE_MAX_ZONES - len(fences)))
+
+    #CRC-32 of every byte before it, then padding to the double word the block is aligned to
+    block += struct.pack("<I", zlib.crc32(block))
+    block += bytes(SITE_CONFIG_SIZE - len(block))
+
+    return block
+
+'''
+    @brief send a configuration block to the STM32 and wait for it to report the result, the board
+           restarts with the configuration once it is stored
+    @param block the block
+    @param com_port com port
+    @param baudrate baudrate
+    @return 0 if stored, otherwise -1
+'''
+def upload_config(block, com_port, baudrate):
+
+    try:
+        ser = serial.Serial(com_port, baudrate=baudrate, timeout=5)
+        print("Serial port has been detected")
+    except serial.SerialException:
+        print("COULD NOT OPEN SERIAL PORT")
+        return -1
+
+    ser.write(SITE_CONFIG_COMMAND + block)
+
+    #the result is a status frame "#c<status>", 2 is stored, anything else was rejected
+    while True:
+        line = ser.readline().decode('utf-8', errors='ignore').strip()
+        if line == "":
+            print("NO REPLY")
+            return -1
+        if '#c' in line:
+            status = int(line[line.index('#c') + 2:].split(" ")[0])
+            print("STORED" if status == 2 else "REJECTED " + str(status))
+            return 0 if status == 2 else -1
+
+# run application
+if __name__ == "__main__":
+    sys.exit(main())
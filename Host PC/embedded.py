@@ -155,6 +155,22 @@ class SqlDatabase(object):
             print(e)
             time.sleep(1)
 
+    '''
+    Send the given geofence event to the SQL database
+    Parameters:
+        event: geofence event to send to database
+        mass: mass on the crane hook as the crane crossed the zone
+    '''
+    def send_event(self, event, mass):
+
+        # Try to send event to SQL database
+        try:
+            self.cur.execute("INSERT INTO dbo.geofence_events (crane_id, update_time, zone, entered, kind, adc, weight) VALUES (%s, getdate(), %s, %s, %s, %s, %s)" %
+                        (event["crane"], event["zone"], event["entered"], event["kind"], event["adc"], mass))
+        except Exception as e:
+            print(e)
+            time.sleep(1)
+
 '''
 SerialReader: Class representing the serial communication between the Turtle board and the host PC
 '''
@@ -165,6 +181,8 @@ class SerialReader(object):
     '''
     def __init__(self, *args, **kwargs):
 
+        self.events = []    # Geofence events received since they were last collected
+
         # Attempt to open serial port
         try:
             self.ser = serial.Serial(COM_PORT, baudrate=BAUDRATE, timeout=1)
@@ -211,6 +229,19 @@ class SerialReader(object):
             # Check if message is ready to be parsed
             if readFlag == True:
                 readFlag = False
+
+                # Keep geofence events for the caller, they are not positions
+                event = self.parse_event(rxBuffer)
+                if event is not None:
+                    self.events.append(event)
+                    rxBuffer = ""
+                    continue
+
+                # Statistics and events start with '#', they are not positions
+                if '#' in rxBuffer:
+                    print(rxBuffer)
+                    rxBuffer = ""
+                    continue
                 
                 dataList = rxBuffer.split(" ")
                 if (len(dataList) < 4):
@@ -241,6 +272,34 @@ class SerialReader(object):
                 rxBuffer = ""
                 return [craneID, posX, posY, rawAdc]    # Return data
 
+    '''
+    Parse a geofence event, sent as "#g<zone> c<crane> e<1 entered, 0 left> k<kind> l<load adc>"
+    Parameters:
+        rxBuffer: received line
+    Returns:
+        dictionary of the event, None if the line is not a geofence event
+    '''
+    def parse_event(self, rxBuffer):
+        if '#g' not in rxBuffer:
+            return None
+
+        # The tokens follow the '#', any bytes in front of it are dropped
+        tokens = {}
+        for token in rxBuffer[rxBuffer.index('#g') + 1:].split(" "):
+            if len(token) > 1:
+                tokens[token[0]] = token[1::]
+
+        try:
+            return {
+                "zone": int(tokens['g']),
+                "crane": int(tokens['c']),
+                "entered": int(tokens['e']),
+                "kind": int(tokens['k']),
+                "adc": int(tokens['l'])
+            }
+        except (KeyError, ValueError):
+            return None
+
 '''
 Main loop for controlling flow of program
 '''
@@ -293,6 +352,13 @@ def main():
         else:
             sqlDatabase.send_to_database(dataList)  # Send to database
 
+        # Send the geofence events received while waiting for the position
+        for event in serialReader.events:
+            print(event)
+            if trainingFlag == False:
+                sqlDatabase.send_event(event, mlModel.get_mass(event["adc"])[0])
+        serialReader.events.clear()
+
 # Run the main program
 if __name__ == "__main__":
     main()